@@ -0,0 +1,118 @@
+// 短连接吞吐测试：每个线程不断地 建立连接 -> 发一个HTTP/1.0请求 -> 读到对端关闭 -> 关闭，统计每秒完成的连接数
+// 编译：g++ -O2 conn_bench.cpp -o conn_bench -pthread
+// 运行：./conn_bench [ip] [port] [path] [线程数] [秒数]
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <string>
+using namespace std;
+
+static struct sockaddr_in server_addr;
+static string request;
+static atomic<bool> stop_flag(false);
+static atomic<long> done_count(0);
+static atomic<long> error_count(0);
+static atomic<long> latency_sum_us(0);
+
+static long now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+static bool one_request()
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return false;
+    // 客户端主动关闭的一方会进入TIME_WAIT，大量短连接会把本地端口用完，这里用RST关闭
+    struct linger lg;
+    lg.l_onoff = 1;
+    lg.l_linger = 0;
+    setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+    bool ok = false;
+    do
+    {
+        if (connect(fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) < 0)
+            break;
+        if (write(fd, request.data(), request.size()) != (ssize_t)request.size())
+            break;
+        char buff[4096];
+        ssize_t n, total = 0;
+        while ((n = read(fd, buff, sizeof(buff))) > 0)
+        {
+            if (total == 0 && (n < 12 || memcmp(buff + 9, "200", 3) != 0))
+                break;
+            total += n;
+        }
+        ok = n == 0 && total > 0;
+    } while (false);
+    close(fd);
+    return ok;
+}
+
+static void *worker(void *)
+{
+    while (!stop_flag)
+    {
+        long start = now_us();
+        if (one_request())
+        {
+            ++done_count;
+            latency_sum_us += now_us() - start;
+        }
+        else
+            ++error_count;
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *ip = argc > 1 ? argv[1] : "127.0.0.1";
+    int port = argc > 2 ? atoi(argv[2]) : 8888;
+    const char *path = argc > 3 ? argv[3] : "/index.html";
+    int threads = argc > 4 ? atoi(argv[4]) : 8;
+    int seconds = argc > 5 ? atoi(argv[5]) : 10;
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, ip, &server_addr.sin_addr) != 1)
+    {
+        fprintf(stderr, "invalid ip %s\n", ip);
+        return 1;
+    }
+    request = string("GET ") + path + " HTTP/1.0\r\nHost: " + ip + "\r\nUser-Agent: conn_bench\r\n\r\n";
+
+    pthread_t *tids = new pthread_t[threads];
+    for (int i = 0; i < threads; ++i)
+        pthread_create(&tids[i], NULL, worker, NULL);
+    long last = 0;
+    for (int i = 0; i < seconds; ++i)
+    {
+        sleep(1);
+        long done = done_count;
+        printf("%ds: %ld conn/s\n", i + 1, done - last);
+        last = done;
+    }
+    stop_flag = true;
+    for (int i = 0; i < threads; ++i)
+        pthread_join(tids[i], NULL);
+    delete[] tids;
+
+    long done = done_count;
+    printf("threads %d, %ld connections in %ds, %.0f conn/s, avg latency %.1f us, errors %ld\n",
+           threads, done, seconds, (double)done / seconds,
+           done > 0 ? (double)latency_sum_us / done : 0.0, error_count.load());
+    return 0;
+}
@@ -0,0 +1,697 @@
+// 行为测试：在临时目录里建好docroot和配置文件，启动服务器(固定监听8888端口)，逐条发请求检查响应
+// 编译：g++ -std=c++20 -O2 http_test.cpp -o http_test -pthread
+// 运行：./http_test ../version1.0/simpleServerWeb [../version1.0/bundlePack]
+// 给出bundlePack时再把一个目录打包，换成打包文件重启服务器，检查按Accept-Encoding选预压缩版本
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <string>
+using namespace std;
+
+const int SERVER_PORT = 8888;
+const int BACKEND_PORT = 18888;     //测试用的后端，反向代理转发到这里
+const int IO_TIMEOUT = 5000;        //等一个响应的最长时间(毫秒)
+
+static string work_dir;
+static string big_body;             //比socket缓冲区大得多的文件内容
+static atomic<int> backend_hits(0); //后端处理过的请求数
+static pid_t server_pid = -1;
+static int failures = 0;
+
+#define CHECK(cond) do { if (!(cond)) { ++failures; printf("  FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); } } while (0)
+
+static long now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+static void write_file(const string &path, const string &content)
+{
+    FILE *fp = fopen(path.c_str(), "wb");
+    if (fp == NULL)
+    {
+        perror(path.c_str());
+        exit(2);
+    }
+    fwrite(content.data(), 1, content.size(), fp);
+    fclose(fp);
+}
+
+// rcvbuf不为0时在连接之前设置接收缓冲区，模拟收得慢的客户端
+static int connect_to(int port, int rcvbuf = 0)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (rcvbuf > 0)
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// 首部名不区分大小写，没有时返回空串
+static string header_of(const string &resp, const string &name)
+{
+    size_t head_end = resp.find("\r\n\r\n");
+    size_t pos = resp.find("\r\n");
+    while (pos != string::npos && pos < head_end)
+    {
+        pos += 2;
+        if (strncasecmp(resp.c_str() + pos, name.c_str(), name.size()) == 0 && resp.compare(pos + name.size(), 2, ": ") == 0)
+        {
+            pos += name.size() + 2;
+            return resp.substr(pos, resp.find("\r\n", pos) - pos);
+        }
+        pos = resp.find("\r\n", pos);
+    }
+    return "";
+}
+
+// 一个到服务器的连接，可以在上面连续发多个请求
+struct Conn
+{
+    int fd;
+    string pending;                 //读多了的属于下一个响应
+
+    explicit Conn(int rcvbuf = 0): fd(connect_to(SERVER_PORT, rcvbuf)) {}
+    ~Conn() { if (fd >= 0) close(fd); }
+
+    bool send(const string &data)
+    {
+        return fd >= 0 && write(fd, data.data(), data.size()) == (ssize_t)data.size();
+    }
+
+    // 读到至少n字节，或者对端关闭、超时
+    bool fill(size_t n)
+    {
+        long deadline = now_ms() + IO_TIMEOUT;
+        while (pending.size() < n)
+        {
+            struct pollfd pfd = {fd, POLLIN, 0};
+            long left = deadline - now_ms();
+            if (left <= 0 || poll(&pfd, 1, (int)left) <= 0)
+                return false;
+            char buff[16384];
+            ssize_t nread = read(fd, buff, sizeof(buff));
+            if (nread <= 0)
+                return false;
+            pending.append(buff, nread);
+        }
+        return true;
+    }
+
+    // 读一个完整的响应(按Content-Length，没有的话读到关闭)，失败返回空串
+    string response()
+    {
+        size_t end;
+        while ((end = pending.find("\r\n\r\n")) == string::npos)
+            if (!fill(pending.size() + 1))
+                return "";
+        end += 4;
+        string length = header_of(pending.substr(0, end), "Content-Length");
+        size_t total;
+        if (!length.empty())
+            total = end + strtoul(length.c_str(), NULL, 10);
+        else
+        {
+            while (fill(pending.size() + 1))
+                ;
+            total = pending.size();
+        }
+        if (!fill(total))
+            return "";
+        string resp = pending.substr(0, total);
+        pending.erase(0, total);
+        return resp;
+    }
+
+    // 对端是否已经关闭了连接
+    bool closed()
+    {
+        return pending.empty() && !fill(1) && pending.empty();
+    }
+};
+
+static string request(const string &raw)
+{
+    Conn conn;
+    if (!conn.send(raw))
+        return "";
+    return conn.response();
+}
+
+static int status_of(const string &resp)
+{
+    return resp.size() > 12 ? atoi(resp.c_str() + 9) : 0;
+}
+
+static string body_of(const string &resp)
+{
+    size_t pos = resp.find("\r\n\r\n");
+    return pos == string::npos ? "" : resp.substr(pos + 4);
+}
+
+static void start_server(const char *binary, const string &config)
+{
+    string conf_path = work_dir + "/test.conf";
+    write_file(conf_path, config);
+    server_pid = fork();
+    if (server_pid == 0)
+    {
+        // 服务器的日志不混进测试输出
+        freopen((work_dir + "/server.log").c_str(), "w", stdout);
+        freopen((work_dir + "/server.log").c_str(), "a", stderr);
+        chdir(work_dir.c_str());
+        execl(binary, binary, conf_path.c_str(), (char*)NULL);
+        perror(binary);
+        _exit(127);
+    }
+    for (int i = 0; i < 100; ++i)
+    {
+        int fd = connect_to(SERVER_PORT);
+        if (fd >= 0)
+        {
+            close(fd);
+            return;
+        }
+        usleep(50000);
+    }
+    fprintf(stderr, "server did not start, see %s/server.log\n", work_dir.c_str());
+    kill(server_pid, SIGKILL);
+    exit(2);
+}
+
+static void stop_server()
+{
+    kill(server_pid, SIGKILL);
+    waitpid(server_pid, NULL, 0);
+}
+
+// 同一个长连接上的第二个请求不能看到第一个请求的首部
+static void test_headers_across_requests()
+{
+    Conn conn;
+    CHECK(conn.send("GET /index.html HTTP/1.1\r\nHost: a\r\nConnection: keep-alive\r\nRange: bytes=0-3\r\n\r\n"));
+    string first = conn.response();
+    CHECK(status_of(first) == 206);
+    CHECK(header_of(first, "Connection") == "keep-alive");
+
+    CHECK(conn.send("GET /index.html HTTP/1.0\r\nHost: a\r\n\r\n"));
+    string second = conn.response();
+    CHECK(status_of(second) == 200);
+    CHECK(header_of(second, "Connection") != "keep-alive");
+    CHECK(body_of(second) == "<html>index</html>\n");
+    CHECK(conn.closed());
+}
+
+// 路径规范化：解码、"."和".."都在docroot里解决，越过docroot或者编码非法时回400
+static void test_path_normalization()
+{
+    string resp = request("GET /sub/../%69ndex.html HTTP/1.1\r\nHost: a\r\n\r\n");
+    CHECK(status_of(resp) == 200);
+    CHECK(body_of(resp) == "<html>index</html>\n");
+    resp = request("GET //sub/./page.txt?x=1 HTTP/1.1\r\nHost: a\r\n\r\n");
+    CHECK(status_of(resp) == 200);
+    CHECK(body_of(resp) == "page");
+    CHECK(status_of(request("GET /../secret.txt HTTP/1.1\r\nHost: a\r\n\r\n")) == 400);
+    CHECK(status_of(request("GET /sub/%2e%2e/%2E%2E/secret.txt HTTP/1.1\r\nHost: a\r\n\r\n")) == 400);
+    CHECK(status_of(request("GET /bad%zz HTTP/1.1\r\nHost: a\r\n\r\n")) == 400);
+    CHECK(status_of(request("GET /nothere.txt HTTP/1.1\r\nHost: a\r\n\r\n")) == 404);
+}
+
+// POST的正文分几次到达，协程处理函数挂起等待，收完之后连接还能接着用
+static void test_post_body()
+{
+    Conn conn;
+    CHECK(conn.send("POST /form HTTP/1.1\r\nHost: a\r\nConnection: keep-alive\r\nContent-Length: 10\r\n\r\n01234"));
+    usleep(100 * 1000);
+    CHECK(conn.send("56789"));
+    string resp = conn.response();
+    CHECK(status_of(resp) == 200);
+    CHECK(body_of(resp) == "I have receiced this.");
+    CHECK(conn.send("GET /index.html HTTP/1.1\r\nHost: a\r\n\r\n"));
+    CHECK(status_of(conn.response()) == 200);
+    CHECK(conn.closed());
+}
+
+// Content-Length不是纯数字回400，超过max_body_kb回413，没有Content-Length的POST回411，
+// 都要有响应而不是直接断开；转发给后端的请求也一样
+static void test_post_length()
+{
+    const char *paths[] = {"/form", "/api/echo"};
+    for (const char *path : paths)
+    {
+        string head = string("POST ") + path + " HTTP/1.1\r\nHost: a\r\n";
+        CHECK(status_of(request(head + "Content-Length: abc\r\n\r\n")) == 400);
+        CHECK(status_of(request(head + "Content-Length: -1\r\n\r\n")) == 400);
+        CHECK(status_of(request(head + "Content-Length: +5\r\n\r\n01234")) == 400);
+        CHECK(status_of(request(head + "Content-Length: 99999999999999999999999\r\n\r\n")) == 400);
+        CHECK(status_of(request(head + "Content-Length: 4097\r\n\r\n")) == 413);
+        CHECK(status_of(request(head + "Content-Length: 5 \r\n\r\n01234")) == 200);
+    }
+    CHECK(status_of(request("POST /form HTTP/1.1\r\nHost: a\r\n\r\n")) == 411);
+    string body(4096, 'x');
+    string resp = request("POST /form HTTP/1.1\r\nHost: a\r\nContent-Length: 4096\r\n\r\n" + body);
+    CHECK(status_of(resp) == 200);
+}
+
+// 比工作线程多的客户端请求大文件但是不收：响应写不进去的连接回到epoll等待，
+// 不占着工作线程，别的请求照常处理；之后慢客户端再收，内容完整
+static void test_slow_readers()
+{
+    const int slow_count = 8;
+    Conn *slow[slow_count];
+    for (int i = 0; i < slow_count; ++i)
+    {
+        slow[i] = new Conn(4096);
+        CHECK(slow[i]->send("GET /big.bin HTTP/1.1\r\nHost: a\r\n\r\n"));
+    }
+    usleep(200 * 1000);
+    long start = now_ms();
+    string resp = request("GET /index.html HTTP/1.1\r\nHost: a\r\n\r\n");
+    CHECK(status_of(resp) == 200);
+    CHECK(now_ms() - start < 1000);
+    for (int i = 0; i < slow_count; ++i)
+    {
+        string big = slow[i]->response();
+        CHECK(status_of(big) == 200);
+        CHECK(body_of(big) == big_body);
+        delete slow[i];
+    }
+}
+
+/* 测试用的后端：每个连接一个线程，连接上可以连续处理多个请求
+       /api/echo     回送方法、路径、X-Forwarded-For和请求正文
+       路径里有slow  等一秒再回
+       /api/chunked  分块编码的响应
+       其余的        回送一个计数，带Cache-Control: max-age，给微缓存用；
+                     路径里有vary-enc/vary-lang/vary-star时带上Vary: Accept-Encoding/Accept-Language/* */
+static void *backend_conn(void *arg)
+{
+    int fd = (int)(long)arg;
+    string in;
+    char buff[16384];
+    while (true)
+    {
+        size_t head_end;
+        while ((head_end = in.find("\r\n\r\n")) == string::npos)
+        {
+            ssize_t n = read(fd, buff, sizeof(buff));
+            if (n <= 0)
+            {
+                close(fd);
+                return NULL;
+            }
+            in.append(buff, n);
+        }
+        string head = in.substr(0, head_end + 4);
+        size_t body_len = strtoul(header_of(head, "Content-Length").c_str(), NULL, 10);
+        while (in.size() < head_end + 4 + body_len)
+        {
+            ssize_t n = read(fd, buff, sizeof(buff));
+            if (n <= 0)
+            {
+                close(fd);
+                return NULL;
+            }
+            in.append(buff, n);
+        }
+        string body = in.substr(head_end + 4, body_len);
+        in.erase(0, head_end + 4 + body_len);
+        string method = head.substr(0, head.find(' '));
+        string path = head.substr(method.size() + 1, head.find(' ', method.size() + 1) - method.size() - 1);
+        int hits = ++backend_hits;
+
+        string resp;
+        if (path == "/api/chunked")
+            resp = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nhello\r\n1\r\n \r\n5\r\nworld\r\n0\r\n\r\n";
+        else
+        {
+            string content;
+            if (path == "/api/echo")
+                content = method + " " + path + " " + header_of(head, "X-Forwarded-For") + " " + body;
+            else
+            {
+                if (path.find("slow") != string::npos)
+                    sleep(1);
+                content = "hit " + to_string(hits);
+            }
+            string vary;
+            if (path.find("vary-enc") != string::npos)
+                vary = "Vary: Accept-Encoding\r\n";
+            else if (path.find("vary-lang") != string::npos)
+                vary = "Vary: accept-language\r\n";
+            else if (path.find("vary-star") != string::npos)
+                vary = "Vary: *\r\n";
+            resp = "HTTP/1.1 200 OK\r\nCache-Control: max-age=1\r\n" + vary + "Content-Length: " + to_string(content.size()) + "\r\n\r\n" + content;
+        }
+        if (write(fd, resp.data(), resp.size()) != (ssize_t)resp.size())
+        {
+            close(fd);
+            return NULL;
+        }
+    }
+}
+
+static void *backend_main(void *arg)
+{
+    int listen_fd = (int)(long)arg;
+    while (true)
+    {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0)
+            continue;
+        pthread_t tid;
+        pthread_create(&tid, NULL, backend_conn, (void*)(long)fd);
+        pthread_detach(tid);
+    }
+    return NULL;
+}
+
+static void start_backend()
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(BACKEND_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 128) < 0)
+    {
+        perror("backend");
+        exit(2);
+    }
+    pthread_t tid;
+    pthread_create(&tid, NULL, backend_main, (void*)(long)fd);
+    pthread_detach(tid);
+}
+
+// 反向代理：请求和正文转发给后端，响应原样转发回来，后端连接复用
+static void test_proxy_relay()
+{
+    Conn conn;
+    CHECK(conn.send("GET /api/echo HTTP/1.1\r\nHost: a\r\nConnection: keep-alive\r\n\r\n"));
+    string resp = conn.response();
+    CHECK(status_of(resp) == 200);
+    CHECK(body_of(resp) == "GET /api/echo 127.0.0.1 ");
+    CHECK(header_of(resp, "Connection") == "keep-alive");
+
+    // 正文分两次到达，转发的协程挂起等客户端
+    CHECK(conn.send("POST /api/echo HTTP/1.1\r\nHost: a\r\nConnection: keep-alive\r\nContent-Length: 10\r\n\r\n01234"));
+    usleep(100 * 1000);
+    CHECK(conn.send("56789"));
+    resp = conn.response();
+    CHECK(status_of(resp) == 200);
+    CHECK(body_of(resp) == "POST /api/echo 127.0.0.1 0123456789");
+
+    // 分块编码的响应原样转发，结束之后连接还能用
+    CHECK(conn.send("GET /api/chunked HTTP/1.1\r\nHost: a\r\nConnection: keep-alive\r\n\r\n"));
+    long deadline = now_ms() + IO_TIMEOUT;
+    while (conn.pending.find("0\r\n\r\n") == string::npos && now_ms() < deadline && conn.fill(conn.pending.size() + 1))
+        ;
+    CHECK(status_of(conn.pending) == 200);
+    CHECK(body_of(conn.pending) == "5\r\nhello\r\n1\r\n \r\n5\r\nworld\r\n0\r\n\r\n");
+    conn.pending.clear();
+    CHECK(conn.send("GET /api/echo HTTP/1.1\r\nHost: a\r\n\r\n"));
+    CHECK(status_of(conn.response()) == 200);
+
+    CHECK(status_of(request("GET /dead/x HTTP/1.1\r\nHost: a\r\n\r\n")) == 502);
+}
+
+// 比工作线程多的请求在等慢后端：等待的请求挂起在epoll上，静态文件照常处理
+static void test_proxy_slow_backend()
+{
+    const int slow_count = 8;
+    Conn *slow[slow_count];
+    for (int i = 0; i < slow_count; ++i)
+    {
+        slow[i] = new Conn;
+        CHECK(slow[i]->send("GET /api/slow HTTP/1.1\r\nHost: a\r\n\r\n"));
+    }
+    usleep(100 * 1000);
+    long start = now_ms();
+    CHECK(status_of(request("GET /index.html HTTP/1.1\r\nHost: a\r\n\r\n")) == 200);
+    CHECK(now_ms() - start < 500);
+    for (int i = 0; i < slow_count; ++i)
+    {
+        string resp = slow[i]->response();
+        CHECK(status_of(resp) == 200);
+        CHECK(body_of(resp).compare(0, 4, "hit ") == 0);
+        delete slow[i];
+    }
+}
+
+// 微缓存：同一个键同时没命中的请求只有一个去找后端，其余的挂起等它，不占工作线程；过了有效期重新找后端
+static void test_microcache()
+{
+    const int count = 8;
+    int hits_before = backend_hits;
+    Conn *conns[count];
+    for (int i = 0; i < count; ++i)
+    {
+        conns[i] = new Conn;
+        CHECK(conns[i]->send("GET /api/mc/slow HTTP/1.1\r\nHost: a\r\n\r\n"));
+    }
+    usleep(100 * 1000);
+    long start = now_ms();
+    CHECK(status_of(request("GET /index.html HTTP/1.1\r\nHost: a\r\n\r\n")) == 200);
+    CHECK(now_ms() - start < 500);
+    int misses = 0;
+    string first;
+    for (int i = 0; i < count; ++i)
+    {
+        string resp = conns[i]->response();
+        CHECK(status_of(resp) == 200);
+        if (i == 0)
+            first = body_of(resp);
+        CHECK(body_of(resp) == first);
+        misses += header_of(resp, "X-Cache") == "MISS" ? 1 : 0;
+        delete conns[i];
+    }
+    CHECK(misses == 1);
+    CHECK(backend_hits == hits_before + 1);
+
+    string resp = request("GET /api/mc/fast HTTP/1.1\r\nHost: a\r\n\r\n");
+    CHECK(header_of(resp, "X-Cache") == "MISS");
+    string again = request("GET /api/mc/fast HTTP/1.1\r\nHost: a\r\n\r\n");
+    CHECK(header_of(again, "X-Cache") == "HIT");
+    CHECK(body_of(again) == body_of(resp));
+    usleep(600 * 1000);
+    string expired = request("GET /api/mc/fast HTTP/1.1\r\nHost: a\r\n\r\n");
+    CHECK(header_of(expired, "X-Cache") == "MISS");
+    CHECK(body_of(expired) != body_of(resp));
+}
+
+// 后端的Vary列出了不在缓存键里的首部(或者是*)时不缓存，列出的首部都在micro_cache的vary里时照常缓存
+static void test_microcache_vary()
+{
+    const char *uncovered[] = {"/api/mc/vary-enc", "/api/mc/vary-star", "/api/mc/vary-lang"};
+    for (size_t i = 0; i < sizeof(uncovered) / sizeof(uncovered[0]); ++i)
+    {
+        string req = string("GET ") + uncovered[i] + " HTTP/1.1\r\nHost: a\r\nAccept-Encoding: gzip\r\n\r\n";
+        string resp = request(req);
+        string again = request(req);
+        CHECK(status_of(again) == 200);
+        CHECK(header_of(again, "X-Cache") == "MISS");
+        CHECK(body_of(again) != body_of(resp));
+    }
+
+    string req = "GET /api/mcl/vary-lang HTTP/1.1\r\nHost: a\r\nAccept-Language: en\r\n\r\n";
+    string resp = request(req);
+    string again = request(req);
+    CHECK(header_of(again, "X-Cache") == "HIT");
+    CHECK(body_of(again) == body_of(resp));
+    string other = request("GET /api/mcl/vary-lang HTTP/1.1\r\nHost: a\r\nAccept-Language: fr\r\n\r\n");
+    CHECK(header_of(other, "X-Cache") == "MISS");
+}
+
+// 按Host选站点：名字不区分大小写、去掉端口，通配名只匹配正好多一级的名字，不匹配的用默认docroot
+static void test_vhost()
+{
+    const char *site_hosts[] = {"site.test", "SITE.Test:8888", "site.test.", "a.site.test"};
+    for (size_t i = 0; i < sizeof(site_hosts) / sizeof(site_hosts[0]); ++i)
+    {
+        string resp = request(string("GET / HTTP/1.1\r\nHost: ") + site_hosts[i] + "\r\n\r\n");
+        CHECK(status_of(resp) == 200);
+        CHECK(body_of(resp) == "<html>site</html>\n");
+    }
+    CHECK(status_of(request("GET /only.txt HTTP/1.1\r\nHost: site.test\r\n\r\n")) == 200);
+
+    const char *default_hosts[] = {"other.test", "a.b.site.test", "xsite.test"};
+    for (size_t i = 0; i < sizeof(default_hosts) / sizeof(default_hosts[0]); ++i)
+    {
+        string resp = request(string("GET / HTTP/1.1\r\nHost: ") + default_hosts[i] + "\r\n\r\n");
+        CHECK(status_of(resp) == 200);
+        CHECK(body_of(resp) == "<html>index</html>\n");
+    }
+    CHECK(status_of(request("GET /only.txt HTTP/1.1\r\nHost: other.test\r\n\r\n")) == 404);
+    // 站点之间也不能用".."互相访问
+    CHECK(status_of(request("GET /../www/index.html HTTP/1.1\r\nHost: site.test\r\n\r\n")) == 400);
+}
+
+// 打包文件里的app.js有.gz和.br两个版本，plain.txt只有原文；期望的编码为空表示发原文
+static void test_bundle_variants()
+{
+    struct Case
+    {
+        const char *path;
+        const char *accept;             //NULL表示不带Accept-Encoding
+        const char *encoding;
+    };
+    static const Case cases[] = {
+        {"/app.js", NULL, ""},
+        {"/app.js", "gzip, deflate, br, zstd", "br"},
+        {"/app.js", "gzip, br;q=0", "gzip"},
+        {"/app.js", "identity, gzip;q=0, br;q=0", ""},
+        {"/app.js", "br;q=0.5, gzip", "gzip"},
+        {"/app.js", "Gzip;Q=1.0", "gzip"},
+        {"/app.js", "x-gzip", "gzip"},
+        {"/app.js", "*", "br"},
+        {"/app.js", "gzip, *;q=0", "gzip"},
+        {"/app.js", "gzip;q=0.5, identity", ""},
+        {"/app.js", "brotli, gzipped", ""},
+        {"/app.js", "br;q=abc, gzip;q=0.2", "gzip"},
+        {"/plain.txt", "br, gzip", ""},
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i)
+    {
+        string req = string("GET ") + cases[i].path + " HTTP/1.1\r\nHost: a\r\n";
+        if (cases[i].accept != NULL)
+            req += string("Accept-Encoding: ") + cases[i].accept + "\r\n";
+        string resp = request(req + "\r\n");
+        string encoding = header_of(resp, "Content-Encoding");
+        string body = body_of(resp);
+        bool ok = status_of(resp) == 200 && encoding == cases[i].encoding;
+        if (strcmp(cases[i].path, "/app.js") == 0)
+            ok = ok && body == (encoding.empty() ? "identity app.js" : encoding + " app.js")
+                    && header_of(resp, "Vary") == "Accept-Encoding";
+        else
+            ok = ok && body == "plain";
+        if (!ok)
+            printf("  Accept-Encoding: %s -> \"%s\" %s\n", cases[i].accept ? cases[i].accept : "(none)",
+                   encoding.c_str(), body.c_str());
+        CHECK(ok);
+    }
+    CHECK(status_of(request("GET /missing.js HTTP/1.1\r\nHost: a\r\n\r\n")) == 404);
+}
+
+struct TestCase
+{
+    const char *name;
+    void (*run)();
+};
+
+static const TestCase cases[] = {
+    {"headers_across_requests", test_headers_across_requests},
+    {"path_normalization", test_path_normalization},
+    {"post_body", test_post_body},
+    {"post_length", test_post_length},
+    {"slow_readers", test_slow_readers},
+    {"proxy_relay", test_proxy_relay},
+    {"proxy_slow_backend", test_proxy_slow_backend},
+    {"microcache", test_microcache},
+    {"microcache_vary", test_microcache_vary},
+    {"vhost", test_vhost},
+};
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s <server binary>\n", argv[0]);
+        return 2;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    char tmpl[] = "/tmp/sws_test.XXXXXX";
+    if (mkdtemp(tmpl) == NULL)
+    {
+        perror("mkdtemp");
+        return 2;
+    }
+    work_dir = tmpl;
+    mkdir((work_dir + "/www").c_str(), 0755);
+    write_file(work_dir + "/www/index.html", "<html>index</html>\n");
+    mkdir((work_dir + "/www/sub").c_str(), 0755);
+    write_file(work_dir + "/www/sub/page.txt", "page");
+    write_file(work_dir + "/secret.txt", "secret");
+    mkdir((work_dir + "/site").c_str(), 0755);
+    write_file(work_dir + "/site/index.html", "<html>site</html>\n");
+    write_file(work_dir + "/site/only.txt", "only");
+    for (int i = 0; big_body.size() < (8 << 20); ++i)
+        big_body += to_string(i) + "\n";
+    write_file(work_dir + "/www/big.bin", big_body);
+
+    string config;
+    config += "thread_num 4\n";
+    config += "max_body_kb 4\n";
+    config += "docroot " + work_dir + "/www\n";
+    config += "upstream app round_robin 127.0.0.1:" + to_string(BACKEND_PORT) + "\n";
+    config += "upstream dead round_robin 127.0.0.1:1\n";
+    config += "proxy_pass /api app\n";
+    config += "proxy_pass /dead dead\n";
+    config += "micro_cache /api/mc 500\n";
+    config += "micro_cache /api/mcl 500 Accept-Language\n";
+    config += "vhost site.test,*.site.test " + work_dir + "/site\n";
+    start_backend();
+    start_server(argv[1], config);
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i)
+    {
+        int before = failures;
+        printf("%s\n", cases[i].name);
+        cases[i].run();
+        printf("  %s\n", failures == before ? "ok" : "FAILED");
+    }
+    stop_server();
+
+    if (argc > 2)
+    {
+        printf("bundle_variants\n");
+        int before = failures;
+        string packed = work_dir + "/packed";
+        mkdir(packed.c_str(), 0755);
+        write_file(packed + "/app.js", "identity app.js");
+        write_file(packed + "/app.js.gz", "gzip app.js");
+        write_file(packed + "/app.js.br", "br app.js");
+        write_file(packed + "/plain.txt", "plain");
+        string bundle = work_dir + "/site.bundle";
+        string command = string(argv[2]) + " " + packed + " " + bundle + " > /dev/null";
+        if (system(command.c_str()) != 0)
+        {
+            printf("  FAIL %s\n", command.c_str());
+            ++failures;
+        }
+        else
+        {
+            start_server(argv[1], "thread_num 2\nbundle " + bundle + "\n");
+            test_bundle_variants();
+            stop_server();
+        }
+        printf("  %s\n", failures == before ? "ok" : "FAILED");
+    }
+    printf("%d failure(s)\n", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,93 @@
+// MimeType查找的微基准：对比原来的unordered_map实现和编译期完美哈希实现
+// 编译：g++ -O2 mime_bench.cpp ../version1.0/mime.cpp -o mime_bench -pthread
+#include "../version1.0/mime.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+#include <string>
+#include <unordered_map>
+using namespace std;
+
+// 原来的实现，原样保留作对照
+class OldMimeType
+{
+private:
+    static pthread_mutex_t lock;
+    static std::unordered_map<std::string, std::string> mime;
+public:
+    static std::string getMime(const std::string &suffix);
+};
+pthread_mutex_t OldMimeType::lock = PTHREAD_MUTEX_INITIALIZER;
+std::unordered_map<std::string, std::string> OldMimeType::mime;
+
+std::string OldMimeType::getMime(const std::string &suffix){
+    if (mime.size() == 0)
+    {
+        pthread_mutex_lock(&lock);
+        if (mime.size() == 0){
+            mime[".html"] = "text/html";
+            mime[".avi"] = "video/x-msvideo";
+            mime[".bmp"] = "image/bmp";
+            mime[".c"] = "text/plain";
+            mime[".doc"] = "application/msword";
+            mime[".gif"] = "image/gif";
+            mime[".gz"] = "application/x-gzip";
+            mime[".htm"] = "text/html";
+            mime[".ico"] = "application/x-ico";
+            mime[".jpg"] = "image/jpeg";
+            mime[".png"] = "image/png";
+            mime[".txt"] = "text/plain";
+            mime[".mp3"] = "audio/mp3";
+            mime["default"] = "text/html";
+        }
+        pthread_mutex_unlock(&lock);
+    }
+    if (mime.find(suffix) == mime.end())
+        return mime["default"];
+    else
+        return mime[suffix];
+}
+
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main()
+{
+    const char *files[] = {"index.html", "images/image1.jpg", "favicon.ico", "video.avi",
+                           "song.mp3", "README", "style.css", "archive.tar.gz"};
+    const int FILE_NUM = sizeof(files) / sizeof(files[0]);
+    const int ROUNDS = 2000000;
+    size_t sink = 0;
+
+    // 旧实现：和analysisRequest()里一样，先substr出扩展名再查表
+    double t0 = now_ns();
+    for (int i = 0; i < ROUNDS; ++i){
+        string file_name = files[i % FILE_NUM];
+        int dot_pos = file_name.find('.');
+        string type = dot_pos < 0 ? OldMimeType::getMime("default")
+                                  : OldMimeType::getMime(file_name.substr(dot_pos));
+        sink += type.size();
+    }
+    double t1 = now_ns();
+
+    for (int i = 0; i < ROUNDS; ++i){
+        string file_name = files[i % FILE_NUM];
+        sink += MimeType::fromFileName(file_name).size();
+    }
+    double t2 = now_ns();
+
+    // 两次循环都包含构造file_name的开销，再单独测一下纯查找
+    for (int i = 0; i < ROUNDS; ++i)
+        sink += MimeType::fromFileName(files[i % FILE_NUM]).size();
+    double t3 = now_ns();
+
+    printf("unordered_map getMime : %6.1f ns/op\n", (t1 - t0) / ROUNDS);
+    printf("perfect hash getMime  : %6.1f ns/op\n", (t2 - t1) / ROUNDS);
+    printf("perfect hash (no copy): %6.1f ns/op\n", (t3 - t2) / ROUNDS);
+    printf("(checksum %zu)\n", sink);
+    return 0;
+}
@@ -0,0 +1,244 @@
+// 首部解析的微基准：对比原来逐字节的状态机和scan.h里按行扫描的标量(SWAR)/SSE2/AVX2实现
+// 编译：g++ -O2 parser_bench.cpp ../version1.0/scan.cpp -o parser_bench
+#include "../version1.0/scan.h"
+#include <stdio.h>
+#include <time.h>
+#include <string>
+using namespace std;
+
+// 几个浏览器和客户端实际发出的首部(请求行之后，含结尾的空行)
+static const char *header_sets[] = {
+    // Chrome
+    "Host: www.example.com\r\n"
+    "Connection: keep-alive\r\n"
+    "sec-ch-ua: \"Chromium\";v=\"128\", \"Not;A=Brand\";v=\"24\", \"Google Chrome\";v=\"128\"\r\n"
+    "sec-ch-ua-mobile: ?0\r\n"
+    "sec-ch-ua-platform: \"Windows\"\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/128.0.0.0 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,image/apng,*/*;q=0.8,application/signed-exchange;v=b3;q=0.7\r\n"
+    "Sec-Fetch-Site: none\r\n"
+    "Sec-Fetch-Mode: navigate\r\n"
+    "Sec-Fetch-User: ?1\r\n"
+    "Sec-Fetch-Dest: document\r\n"
+    "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+    "Accept-Language: en-US,en;q=0.9,zh-CN;q=0.8,zh;q=0.7\r\n"
+    "Cookie: _ga=GA1.1.1234567890.1700000000; session=8f14e45fceea167a5a36dedd4bea2543; theme=dark\r\n"
+    "\r\n",
+    // Firefox
+    "Host: www.example.com\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:130.0) Gecko/20100101 Firefox/130.0\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+    "Connection: keep-alive\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "Sec-Fetch-Dest: document\r\n"
+    "Sec-Fetch-Mode: navigate\r\n"
+    "Sec-Fetch-Site: none\r\n"
+    "Sec-Fetch-User: ?1\r\n"
+    "Priority: u=0, i\r\n"
+    "\r\n",
+    // 手机Safari请求图片
+    "Host: static.example.com\r\n"
+    "Accept: image/webp,image/avif,image/jxl,image/heic,image/heic-sequence,video/*;q=0.8,image/png,image/svg+xml,image/*;q=0.8,*/*;q=0.5\r\n"
+    "Sec-Fetch-Site: same-site\r\n"
+    "Sec-Fetch-Dest: image\r\n"
+    "Accept-Language: zh-CN,zh-Hans;q=0.9\r\n"
+    "Sec-Fetch-Mode: no-cors\r\n"
+    "User-Agent: Mozilla/5.0 (iPhone; CPU iPhone OS 17_6 like Mac OS X) AppleWebKit/605.1.15 (KHTML, like Gecko) Version/17.6 Mobile/15E148 Safari/604.1\r\n"
+    "Referer: https://www.example.com/\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n",
+    // curl
+    "Host: 127.0.0.1:8888\r\n"
+    "User-Agent: curl/8.5.0\r\n"
+    "Accept: */*\r\n"
+    "\r\n",
+};
+
+// 带着一串跟踪Cookie的请求，值有几百字节，原来的状态机(值不超过255字节)会拒绝，只测按行扫描
+static const char *long_header_set =
+    "Host: shop.example.com\r\n"
+    "User-Agent: Mozilla/5.0 (Macintosh; Intel Mac OS X 10_15_7) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/128.0.0.0 Safari/537.36 Edg/128.0.0.0\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,image/apng,*/*;q=0.8\r\n"
+    "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+    "Cookie: _ga=GA1.1.1234567890.1700000000; _ga_ABCDEF1234=GS1.1.1700000000.12.1.1700003600.0.0.0; "
+    "_gid=GA1.2.987654321.1700000000; _fbp=fb.1.1700000000000.1234567890; "
+    "_hjSessionUser_1234567=eyJpZCI6IjEyMzQ1Njc4LTkwYWItY2RlZi0xMjM0LTU2Nzg5MGFiY2RlZiIsImNyZWF0ZWQiOjE3MDAwMDAwMDAwMDB9; "
+    "cart=7f3c9a1e-52d4-4b8e-9c1a-2b7e5f0d3a61; session=8f14e45fceea167a5a36dedd4bea2543c9f0f895fb98ab9159f51fd0297e236d; "
+    "consent=necessary:1|analytics:1|marketing:0; theme=dark; locale=en-US\r\n"
+    "\r\n";
+
+struct Sink
+{
+    size_t headers;
+    size_t bytes;
+};
+
+// 原来parse_Headers()里的状态机，原样保留作对照，只是把结果交给sink
+static bool old_parse(const string &str, Sink &sink)
+{
+    enum { h_start, h_key, h_colon, h_spaces_after_colon, h_value, h_CR, h_LF, h_end_CR, h_end_LF };
+    int h_state = h_start;
+    int key_start = -1, key_end = -1, value_start = -1, value_end = -1;
+    for (size_t i = 0; i < str.size() && h_state != h_end_LF; ++i)
+    {
+        switch (h_state)
+        {
+            case h_start:
+                if (str[i] == '\n' || str[i] == '\r')
+                    break;
+                h_state = h_key;
+                key_start = i;
+                break;
+            case h_key:
+                if (str[i] == ':'){
+                    key_end = i;
+                    if (key_end - key_start <= 0)
+                        return false;
+                    h_state = h_colon;
+                }
+                else if (str[i] == '\n' || str[i] == '\r')
+                    return false;
+                break;
+            case h_colon:
+                if (str[i] != ' ')
+                    return false;
+                h_state = h_spaces_after_colon;
+                break;
+            case h_spaces_after_colon:
+                h_state = h_value;
+                value_start = i;
+                break;
+            case h_value:
+                if (str[i] == '\r'){
+                    h_state = h_CR;
+                    value_end = i;
+                    if (value_end - value_start <= 0)
+                        return false;
+                }
+                else if (i - value_start > 255)
+                    return false;
+                break;
+            case h_CR:
+                if (str[i] != '\n')
+                    return false;
+                h_state = h_LF;
+                ++sink.headers;
+                sink.bytes += (key_end - key_start) + (value_end - value_start);
+                break;
+            case h_LF:
+                if (str[i] == '\r')
+                    h_state = h_end_CR;
+                else{
+                    key_start = i;
+                    h_state = h_key;
+                }
+                break;
+            case h_end_CR:
+                if (str[i] != '\n')
+                    return false;
+                h_state = h_end_LF;
+                break;
+        }
+    }
+    return h_state == h_end_LF;
+}
+
+static bool new_parse(const string &str, Sink &sink)
+{
+    const char *p = str.data();
+    const char *end = p + str.size();
+    while (p < end && *p != '\r')
+    {
+        HeaderLine line;
+        if (scan_header_line(p, end, line) != SCAN_LINE_OK)
+            return false;
+        ++sink.headers;
+        sink.bytes += line.key_len + line.value_len;
+        p = line.next;
+    }
+    return end - p >= 2 && p[1] == '\n';
+}
+
+static double now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main()
+{
+    const int SET_NUM = sizeof(header_sets) / sizeof(header_sets[0]);
+    const int ROUNDS = 1000000;
+    string sets[SET_NUM];
+    size_t total_bytes = 0;
+    for (int i = 0; i < SET_NUM; ++i){
+        sets[i] = header_sets[i];
+        total_bytes += sets[i].size();
+    }
+    double avg_bytes = (double)total_bytes / SET_NUM;
+
+    Sink expect = {0, 0}, sink;
+    for (int i = 0; i < SET_NUM; ++i)
+        if (!old_parse(sets[i], expect)){
+            printf("reference parser rejected set %d\n", i);
+            return 1;
+        }
+
+    double t0 = now_ns();
+    sink = Sink{0, 0};
+    for (int i = 0; i < ROUNDS; ++i)
+        old_parse(sets[i % SET_NUM], sink);
+    double t1 = now_ns();
+    printf("byte state machine: %6.1f ns/request  %5.2f GB/s\n",
+           (t1 - t0) / ROUNDS, avg_bytes * ROUNDS / (t1 - t0));
+
+    const char *names[] = {"scalar", "sse2", "avx2"};
+    const int levels[] = {SCAN_SCALAR, SCAN_SSE2, SCAN_AVX2};
+    for (int k = 0; k < 3; ++k)
+    {
+        if (!scan_select(levels[k])){
+            printf("%-18s: not supported by this CPU\n", names[k]);
+            continue;
+        }
+        Sink check = {0, 0};
+        for (int i = 0; i < SET_NUM; ++i)
+            new_parse(sets[i], check);
+        if (check.headers != expect.headers || check.bytes != expect.bytes){
+            printf("%s: result differs from reference\n", names[k]);
+            return 1;
+        }
+        sink = Sink{0, 0};
+        double s0 = now_ns();
+        for (int i = 0; i < ROUNDS; ++i)
+            new_parse(sets[i % SET_NUM], sink);
+        double s1 = now_ns();
+        printf("line scan %-8s: %6.1f ns/request  %5.2f GB/s\n",
+               names[k], (s1 - s0) / ROUNDS, avg_bytes * ROUNDS / (s1 - s0));
+    }
+
+    string long_set = long_header_set;
+    for (int k = 0; k < 3; ++k)
+    {
+        if (!scan_select(levels[k]))
+            continue;
+        Sink check = {0, 0};
+        if (!new_parse(long_set, check) || check.headers != 5){
+            printf("%s: long header set rejected\n", names[k]);
+            return 1;
+        }
+        sink = Sink{0, 0};
+        double s0 = now_ns();
+        for (int i = 0; i < ROUNDS; ++i)
+            new_parse(long_set, sink);
+        double s1 = now_ns();
+        printf("long cookie %-6s: %6.1f ns/request  %5.2f GB/s\n",
+               names[k], (s1 - s0) / ROUNDS, long_set.size() * (double)ROUNDS / (s1 - s0));
+    }
+    printf("(%d header sets, %.0f bytes on average, checksum %zu)\n", SET_NUM, avg_bytes, sink.bytes);
+    return 0;
+}
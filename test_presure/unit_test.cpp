@@ -0,0 +1,365 @@
+// 单元测试：直接链接服务器的模块，不起服务器，检查各个模块在边界上的行为
+// 编译：g++ -std=c++20 -O2 unit_test.cpp $(ls ../version1.0/*.cpp | grep -v main.cpp) -o unit_test -pthread
+// 运行：./unit_test
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <climits>
+#include <functional>
+#include <string>
+#include <vector>
+#include "../version1.0/config.h"
+#include "../version1.0/header.h"
+#include "../version1.0/metrics.h"
+#include "../version1.0/microcache.h"
+#include "../version1.0/range.h"
+#include "../version1.0/ratelimit.h"
+#include "../version1.0/scan.h"
+#include "../version1.0/vhost.h"
+using namespace std;
+
+static int failures = 0;
+
+#define CHECK(cond) do { if (!(cond)) { ++failures; printf("  FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); } } while (0)
+
+static uint64_t now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// 连续扣count个令牌，返回成功的个数
+static int take_many(atomic<uint64_t> &bucket, int rate, int burst, int count)
+{
+    int allowed = 0;
+    for (int i = 0; i < count; ++i)
+        allowed += ratelimit_take(bucket, rate, burst) ? 1 : 0;
+    return allowed;
+}
+
+static void test_ratelimit()
+{
+    // 容量用完之后按rate补充
+    atomic<uint64_t> bucket(0);
+    CHECK(take_many(bucket, 10, 5, 5) == 5);
+    CHECK(!ratelimit_take(bucket, 10, 5));
+    usleep(250 * 1000);
+    CHECK(take_many(bucket, 10, 5, 5) >= 2);
+    CHECK(!ratelimit_take(bucket, 10, 5));
+
+    atomic<uint64_t> single(0);
+    CHECK(ratelimit_take(single, 1, 1));
+    CHECK(!ratelimit_take(single, 1, 1));
+
+    // burst为0时容量等于rate，但不超过RATELIMIT_MAX_BURST，令牌数不能溢出到时间戳里
+    for (int rate = RATELIMIT_MAX_BURST; rate <= RATELIMIT_MAX_RATE; rate += RATELIMIT_MAX_RATE - RATELIMIT_MAX_BURST)
+    {
+        atomic<uint64_t> big(0);
+        uint64_t before = now_ms();
+        CHECK(ratelimit_take(big, rate, 0));
+        // 低24位是剩余的千分之一令牌，高位是毫秒时间戳(加了1)
+        CHECK((big.load() & ((1 << 24) - 1)) == (uint64_t)(RATELIMIT_MAX_BURST - 1) * 1000);
+        CHECK((big.load() >> 24) >= before && (big.load() >> 24) <= now_ms() + 1);
+        // 一直扣下去总会扣完，扣完之前成功的个数不会比容量加上这段时间补充的多太多
+        int allowed = 1;
+        bool denied = false;
+        uint64_t start = now_ms();
+        while (!denied && allowed < 10 * RATELIMIT_MAX_BURST)
+        {
+            if (ratelimit_take(big, rate, 0))
+                ++allowed;
+            else
+                denied = true;
+        }
+        CHECK(denied);
+        CHECK(allowed >= RATELIMIT_MAX_BURST);
+        CHECK((uint64_t)allowed <= RATELIMIT_MAX_BURST + (now_ms() - start + 2) * rate / 1000);
+    }
+    atomic<uint64_t> capped(0);
+    CHECK(ratelimit_take(capped, 1, RATELIMIT_MAX_BURST * 2));
+    CHECK((capped.load() & ((1 << 24) - 1)) == (uint64_t)(RATELIMIT_MAX_BURST - 1) * 1000);
+}
+
+// 逐字节找，作为扫描结果的对照
+static const char *naive_scan(const char *p, const char *end, const char *set, int set_len)
+{
+    for (; p < end; ++p)
+        for (int k = 0; k < set_len; ++k)
+            if (*p == set[k])
+                return p;
+    return end;
+}
+
+static void test_scan()
+{
+    const int levels[] = {SCAN_SCALAR, SCAN_SSE2, SCAN_AVX2};
+    const char *sets[] = {"\r\n", "\r\n:", " \t,;=\"/"};
+    char buff[100];
+    for (int l = 0; l < 3; ++l)
+    {
+        if (!scan_select(levels[l]))
+            continue;
+        // 命中的位置落在8/16/32字节块的每个位置上，以及块之间的尾部
+        for (int s = 0; s < 3; ++s)
+        {
+            int set_len = strlen(sets[s]);
+            for (int len = 0; len <= 80; ++len)
+                for (int hit = 0; hit <= len; ++hit)
+                {
+                    memset(buff, 'a', sizeof(buff));
+                    if (hit < len)
+                        buff[hit] = sets[s][hit % set_len];
+                    // end之后的字节也在集合里，不能被越过end读到
+                    buff[len] = sets[s][0];
+                    CHECK(scan_any(buff, buff + len, sets[s], set_len) == naive_scan(buff, buff + len, sets[s], set_len));
+                }
+        }
+
+        // 首部的值没有长度限制，很长的Cookie也要能解析
+        string line = "Cookie: " + string(4000, 'c') + "\r\nHost: x\r\n";
+        HeaderLine header;
+        CHECK(scan_header_line(line.data(), line.data() + line.size(), header) == SCAN_LINE_OK);
+        CHECK(header.key_len == 6 && header.value_len == 4000);
+        CHECK(header.next == line.data() + 4000 + 10);
+        CHECK(scan_header_line(line.data(), line.data() + 3000, header) == SCAN_LINE_AGAIN);
+        string bad = "Key:value\r\n";
+        CHECK(scan_header_line(bad.data(), bad.data() + bad.size(), header) == SCAN_LINE_ERROR);
+        bad = "Key: va\nlue\r\n";
+        CHECK(scan_header_line(bad.data(), bad.data() + bad.size(), header) == SCAN_LINE_ERROR);
+    }
+}
+
+// 解析value，结果是SATISFIABLE时再把区间拼成"a-b,c-d"方便比较
+static string ranges_of(const string &value, off_t file_size, int expect)
+{
+    vector<ByteRange> ranges;
+    int flag = parse_range(value, file_size, ranges);
+    if (flag != expect)
+        return "flag " + to_string(flag);
+    string out;
+    for (size_t i = 0; i < ranges.size(); ++i)
+        out += (i > 0 ? "," : "") + to_string(ranges[i].start) + "-" + to_string(ranges[i].end);
+    return out;
+}
+
+static void test_range()
+{
+    // 语法无效的Range按没有处理，返回完整文件
+    CHECK(ranges_of("", 1000, RANGE_NONE) == "");
+    CHECK(ranges_of("items=0-99", 1000, RANGE_NONE) == "");
+    CHECK(ranges_of("bytes=", 1000, RANGE_NONE) == "");
+    CHECK(ranges_of("bytes=99-5", 1000, RANGE_NONE) == "");
+    CHECK(ranges_of("bytes=a-b", 1000, RANGE_NONE) == "");
+    CHECK(ranges_of("bytes=-", 1000, RANGE_NONE) == "");
+    CHECK(ranges_of("bytes=0-1;2-3", 1000, RANGE_NONE) == "");
+    CHECK(ranges_of("bytes=99999999999999999999-", 1000, RANGE_NONE) == "");
+
+    CHECK(ranges_of("bytes=0-99", 1000, RANGE_SATISFIABLE) == "0-99");
+    CHECK(ranges_of(" bytes=0-0", 1000, RANGE_SATISFIABLE) == "0-0");
+    CHECK(ranges_of("bytes=900-", 1000, RANGE_SATISFIABLE) == "900-999");
+    CHECK(ranges_of("bytes=-500", 1000, RANGE_SATISFIABLE) == "500-999");
+    // 超出文件大小的部分截掉
+    CHECK(ranges_of("bytes=-5000", 1000, RANGE_SATISFIABLE) == "0-999");
+    CHECK(ranges_of("bytes=990-5000", 1000, RANGE_SATISFIABLE) == "990-999");
+    // 排序，合并重叠和相邻的区间，忽略空的和不满足的区间
+    CHECK(ranges_of("bytes=200-299, 0-99", 1000, RANGE_SATISFIABLE) == "0-99,200-299");
+    CHECK(ranges_of("bytes=0-99,50-150,151-160", 1000, RANGE_SATISFIABLE) == "0-160");
+    CHECK(ranges_of("bytes=0-9,,2000-", 1000, RANGE_SATISFIABLE) == "0-9");
+
+    // 语法正确但一个都不满足时返回416
+    CHECK(ranges_of("bytes=1000-", 1000, RANGE_UNSATISFIABLE) == "");
+    CHECK(ranges_of("bytes=2000-3000,-0", 1000, RANGE_UNSATISFIABLE) == "");
+    CHECK(ranges_of("bytes=0-", 0, RANGE_UNSATISFIABLE) == "");
+    CHECK(ranges_of("bytes=-1", 0, RANGE_UNSATISFIABLE) == "");
+
+    // 区间太多时整个忽略，不让小区间放大响应
+    string many = "bytes=";
+    for (int i = 0; i <= MAX_RANGES; ++i)
+        many += (i > 0 ? "," : "") + to_string(i * 10) + "-" + to_string(i * 10 + 1);
+    CHECK(ranges_of(many, 1000, RANGE_NONE) == "");
+    many = "bytes=";
+    for (int i = 0; i < MAX_RANGES; ++i)
+        many += (i > 0 ? "," : "") + to_string(i * 10) + "-" + to_string(i * 10 + 1);
+    vector<ByteRange> ranges;
+    CHECK(parse_range(many, 1000, ranges) == RANGE_SATISFIABLE);
+    CHECK(ranges.size() == (size_t)MAX_RANGES);
+}
+
+static void test_vhost()
+{
+    // 没有配置虚拟主机时都用默认站点
+    CHECK(vhost_lookup("example.com") == NULL);
+    CHECK(vhost_root(NULL) == docroot_fd());
+
+    char dir_a[] = "/tmp/vhost_test_XXXXXX";
+    char dir_b[] = "/tmp/vhost_test_XXXXXX";
+    CHECK(mkdtemp(dir_a) != NULL && mkdtemp(dir_b) != NULL);
+    CHECK(vhost_add({"Example.com,www.example.com", dir_a, "limit_req_rate=10"}));
+    CHECK(vhost_add({"*.blog.example.com", dir_b}));
+    // docroot打不开、名字里的'*'不在开头、选项不认识，都不能加
+    CHECK(!vhost_add({"missing.example.com", "/nonexistent/vhost/root"}));
+    CHECK(!vhost_add({"a*.example.com", dir_a}));
+    CHECK(!vhost_add({"opt.example.com", dir_a, "no_such_option=1"}));
+
+    VirtualHost *a = vhost_lookup("example.com");
+    VirtualHost *b = vhost_lookup("x.blog.example.com");
+    CHECK(a != NULL && b != NULL && a != b);
+    if (a == NULL || b == NULL)
+        return;
+    CHECK(a->name == "example.com");
+    CHECK(a->limit_req_rate == 10);
+    CHECK(vhost_root(a) == a->root_fd && vhost_root(b) == b->root_fd);
+    CHECK(vhost_cache(a) != NULL && vhost_cache(a) != vhost_cache(b));
+
+    // 不区分大小写，去掉端口和末尾的'.'
+    CHECK(vhost_lookup("WWW.Example.COM") == a);
+    CHECK(vhost_lookup("www.example.com:8080") == a);
+    CHECK(vhost_lookup("example.com.") == a);
+    // 通配名只匹配正好多一级的名字
+    CHECK(vhost_lookup("Y.Blog.Example.com:443") == b);
+    CHECK(vhost_lookup("blog.example.com") == NULL);
+    CHECK(vhost_lookup("a.b.blog.example.com") == NULL);
+    CHECK(vhost_lookup("other.example.com") == NULL);
+    CHECK(vhost_lookup("example.org") == NULL);
+    CHECK(vhost_lookup("") == NULL);
+    CHECK(vhost_lookup(":8080") == NULL);
+    // IPv6地址里的冒号不是端口
+    CHECK(vhost_lookup("[::1]:8080") == NULL);
+
+    vector<int> roots;
+    vhost_roots(roots);
+    CHECK(roots.size() == 2);
+    rmdir(dir_a);
+    rmdir(dir_b);
+}
+
+static void test_coding_q()
+{
+    CHECK(header_coding_q("", "gzip") == -1);
+    CHECK(header_coding_q("gzip, deflate, br", "br") == 1000);
+    CHECK(header_coding_q("gzip, deflate, br", "zstd") == -1);
+    CHECK(header_coding_q("gzip, br;q=0", "br") == 0);
+    CHECK(header_coding_q("br;q=0.5,gzip", "br") == 500);
+    CHECK(header_coding_q("br ; q=0.25 ", "br") == 250);
+    CHECK(header_coding_q("BR;Q=1.000", "br") == 1000);
+    CHECK(header_coding_q("x-gzip", "gzip") == 1000);
+    // 整个词比较，不是子串
+    CHECK(header_coding_q("brotli, gzipped", "br") == -1);
+    CHECK(header_coding_q("brotli, gzipped", "gzip") == -1);
+    // 没列出的按"*"
+    CHECK(header_coding_q("gzip, *;q=0", "br") == 0);
+    CHECK(header_coding_q("*;q=0.1, br;q=0.9", "br") == 900);
+    CHECK(header_coding_q("*", "identity") == 1000);
+    // q值写错的按拒绝处理
+    CHECK(header_coding_q("br;q=abc", "br") == 0);
+    CHECK(header_coding_q("br;q=1.5", "br") == 0);
+    CHECK(header_coding_q("br;q=0.12345", "br") == 0);
+}
+
+static void test_content_length()
+{
+    CHECK(header_content_length("0") == 0);
+    CHECK(header_content_length("1024") == 1024);
+    CHECK(header_content_length(" 12\t") == 12);
+    CHECK(header_content_length("9223372036854775807") == LONG_MAX);
+    CHECK(header_content_length("9223372036854775808") == -1);
+    CHECK(header_content_length("") == -1);
+    CHECK(header_content_length("abc") == -1);
+    CHECK(header_content_length("-1") == -1);
+    CHECK(header_content_length("+1") == -1);
+    CHECK(header_content_length("1 2") == -1);
+    CHECK(header_content_length("12abc") == -1);
+}
+
+// 没有命中时填进去，命中时返回true
+static bool micro_fill(const string &key, size_t body_size)
+{
+    MicroHit hit;
+    MicroWaiter waiter(NULL);
+    int ret = microcache_lookup(key, hit, waiter);
+    if (ret == MICRO_HIT)
+    {
+        seg_unref(hit.seg);
+        return true;
+    }
+    if (ret == MICRO_FILL)
+    {
+        MicroFill fill;
+        fill.begin(key);
+        fill.commit(60000, "HTTP/1.1 200 OK\r\n", string(body_size, 'x'));
+    }
+    return false;
+}
+
+static void test_microcache_evict()
+{
+    // micro_cache_mb 1：每片64KB，放得下三个20000字节的结果
+    ServerConfig *config = new ServerConfig(config_get());
+    config->micro_cache_mb = 1;
+    config_publish(config);
+    long capacity = (1 << 20) / MICROCACHE_SHARDS;
+
+    // 挑出落在同一片里的键
+    vector<string> keys;
+    for (int i = 0; keys.size() < 6; ++i)
+    {
+        string key = "GET a /evict/" + to_string(i);
+        if (hash<string>()(key) % MICROCACHE_SHARDS == 0)
+            keys.push_back(key);
+    }
+    long evictions = server_metrics.microcache_evictions;
+    CHECK(!micro_fill(keys[0], 20000));
+    CHECK(!micro_fill(keys[1], 20000));
+    CHECK(!micro_fill(keys[2], 20000));
+    CHECK(server_metrics.microcache_evictions == evictions);
+    // 命中过的keys[0]变成最近用过的，放keys[3]时清掉的是keys[1]
+    CHECK(micro_fill(keys[0], 20000));
+    CHECK(!micro_fill(keys[3], 20000));
+    CHECK(server_metrics.microcache_evictions == evictions + 1);
+    CHECK(micro_fill(keys[0], 20000));
+    CHECK(micro_fill(keys[2], 20000));
+    CHECK(micro_fill(keys[3], 20000));
+    CHECK(!micro_fill(keys[1], 20000));         //重新放入，清掉keys[0]
+    CHECK(server_metrics.microcache_evictions == evictions + 2);
+    CHECK(server_metrics.microcache_bytes <= capacity);
+
+    // 比一片还大的不放，也不清掉别的结果；之后同一个键还是由下一个请求去算，不会挂着等
+    CHECK(!micro_fill(keys[4], capacity));
+    CHECK(!micro_fill(keys[4], 100));
+    CHECK(micro_fill(keys[4], 100));
+    CHECK(micro_fill(keys[3], 20000));
+    CHECK(server_metrics.microcache_bytes <= capacity);
+}
+
+struct TestCase
+{
+    const char *name;
+    void (*run)();
+};
+
+static const TestCase cases[] = {
+    {"ratelimit", test_ratelimit},
+    {"scan", test_scan},
+    {"range", test_range},
+    {"vhost", test_vhost},
+    {"coding_q", test_coding_q},
+    {"content_length", test_content_length},
+    {"microcache_evict", test_microcache_evict},
+};
+
+int main()
+{
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i)
+    {
+        int before = failures;
+        printf("%s\n", cases[i].name);
+        cases[i].run();
+        printf("  %s\n", failures == before ? "ok" : "FAILED");
+    }
+    printf("%d failure(s)\n", failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,64 @@
+#include "admin.h"
+#include "config.h"
+#include "metrics.h"
+#include "proxy.h"
+#include "profiler.h"
+#include "vhost.h"
+#include <stdlib.h>
+using namespace std;
+
+// 去掉配置里前缀开头的'/'，和file_name的格式保持一致
+static bool admin_path(const string &file_name, string &sub_path)
+{
+    const string &prefix = config_get().admin_prefix;
+    if (prefix.size() < 2)
+        return false;
+    size_t len = prefix.size() - 1;
+    if (file_name.compare(0, len, prefix, 1, len) != 0)
+        return false;
+    if (file_name.size() > len && file_name[len] != '/')
+        return false;
+    sub_path = file_name.size() > len + 1 ? file_name.substr(len + 1) : "";
+    return true;
+}
+
+bool admin_match(const string &file_name)
+{
+    string sub_path;
+    return admin_path(file_name, sub_path);
+}
+
+bool admin_render(const string &file_name, string &body, string &content_type)
+{
+    string sub_path;
+    if (!admin_path(file_name, sub_path))
+        return false;
+    if (sub_path == "metrics")
+    {
+        metrics_dump(body);
+        content_type = "text/plain";
+        return true;
+    }
+    // profile或者profile/<秒数>：这个工作线程会一直等到采样结束
+    if (sub_path == "profile" || sub_path.compare(0, 8, "profile/") == 0)
+    {
+        int seconds = sub_path.size() > 8 ? atoi(sub_path.c_str() + 8) : PROFILE_DEFAULT_SECONDS;
+        if (!profiler_run(seconds, body))
+            body = "profiler busy\n";
+        content_type = "text/plain";
+        return true;
+    }
+    if (sub_path == "upstreams")
+    {
+        proxy_dump(body);
+        content_type = "text/plain";
+        return true;
+    }
+    if (sub_path == "vhosts")
+    {
+        vhost_dump(body);
+        content_type = "text/plain";
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,16 @@
+#ifndef ADMIN
+#define ADMIN
+#include <string>
+
+/* 管理接口：配置了admin_prefix(例如/__admin)后，
+   GET <prefix>/metrics 返回运行时指标
+   GET <prefix>/upstreams 返回每个反向代理后端的状态
+   GET <prefix>/vhosts 返回每个虚拟主机的请求数和被限流的次数
+   GET <prefix>/profile/<秒数> 采样CPU调用栈，返回折叠格式，见profiler.h */
+
+// file_name是去掉开头'/'之后的请求路径，是管理接口返回true
+bool admin_match(const std::string &file_name);
+// 生成管理接口的响应正文，找不到对应接口返回false
+bool admin_render(const std::string &file_name, std::string &body, std::string &content_type);
+
+#endif
@@ -0,0 +1,210 @@
+#include "bufchain.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <new>
+#include <sys/uio.h>
+
+BufSegment *seg_alloc(size_t len)
+{
+    void *mem = ::operator new(sizeof(BufSegment) + len);
+    BufSegment *seg = new (mem) BufSegment;
+    seg->refs.store(1, std::memory_order_relaxed);
+    seg->len = len;
+    seg->data = (char*)mem + sizeof(BufSegment);
+    return seg;
+}
+
+void seg_ref(BufSegment *seg)
+{
+    seg->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+void seg_unref(BufSegment *seg)
+{
+    if (seg->refs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+        return;
+    seg->~BufSegment();
+    ::operator delete(seg);
+}
+
+BufChain::BufChain(): head(0), total(0), tail(NULL), tail_used(0)
+{}
+
+BufChain::~BufChain()
+{
+    clear();
+}
+
+void BufChain::clear()
+{
+    for (size_t i = head; i < slices.size(); ++i)
+        if (slices[i].seg != NULL)
+            seg_unref(slices[i].seg);
+    slices.clear();
+    head = 0;
+    total = 0;
+    for (size_t i = 0; i < owned_fds.size(); ++i)
+        close(owned_fds[i]);
+    owned_fds.clear();
+    if (tail != NULL)
+        seg_unref(tail);
+    tail = NULL;
+    tail_used = 0;
+}
+
+void BufChain::appendRef(std::string_view s)
+{
+    if (s.empty())
+        return;
+    slices.push_back(Slice{NULL, s.data(), s.size(), -1, 0});
+    total += s.size();
+}
+
+void BufChain::appendCopy(std::string_view s)
+{
+    if (s.empty())
+        return;
+    if (tail == NULL || tail->len - tail_used < s.size())
+    {
+        if (tail != NULL)
+            seg_unref(tail);
+        tail = seg_alloc(s.size() > BUFCHAIN_COPY_BLOCK ? s.size() : BUFCHAIN_COPY_BLOCK);
+        tail_used = 0;
+    }
+    char *dst = tail->data + tail_used;
+    memcpy(dst, s.data(), s.size());
+    tail_used += s.size();
+    total += s.size();
+    // 紧接着上一个片段的就直接延长它
+    if (slices.size() > head && slices.back().seg == tail && slices.back().data + slices.back().len == dst)
+    {
+        slices.back().len += s.size();
+        return;
+    }
+    seg_ref(tail);
+    slices.push_back(Slice{tail, dst, s.size(), -1, 0});
+}
+
+void BufChain::append(BufSegment *seg, size_t offset, size_t len)
+{
+    if (len == 0)
+        return;
+    seg_ref(seg);
+    slices.push_back(Slice{seg, seg->data + offset, len, -1, 0});
+    total += len;
+}
+
+void BufChain::appendFile(int fd, off_t offset, size_t len)
+{
+    if (len == 0)
+        return;
+    slices.push_back(Slice{NULL, NULL, len, fd, offset});
+    total += len;
+}
+
+bool BufChain::retainFiles()
+{
+    // 一个响应的文件片段一般都来自同一个文件，只dup一次
+    int from = -1, to = -1;
+    for (size_t i = head; i < slices.size(); ++i)
+    {
+        if (slices[i].fd < 0)
+            continue;
+        bool owned = false;
+        for (size_t j = 0; j < owned_fds.size(); ++j)
+            if (owned_fds[j] == slices[i].fd)
+                owned = true;
+        if (owned)
+            continue;
+        if (slices[i].fd != from)
+        {
+            from = slices[i].fd;
+            to = fcntl(from, F_DUPFD_CLOEXEC, 0);
+            if (to < 0)
+                return false;
+            owned_fds.push_back(to);
+        }
+        slices[i].fd = to;
+    }
+    return true;
+}
+
+// 跳过已经写完的片段，调整写了一半的那个片段
+void BufChain::consume(size_t n)
+{
+    total -= n;
+    while (n > 0 && head < slices.size())
+    {
+        Slice &slice = slices[head];
+        if (n < slice.len)
+        {
+            if (slice.fd >= 0)
+                slice.offset += n;
+            else
+                slice.data += n;
+            slice.len -= n;
+            return;
+        }
+        n -= slice.len;
+        if (slice.seg != NULL)
+            seg_unref(slice.seg);
+        ++head;
+    }
+    if (head == slices.size())
+    {
+        slices.clear();
+        head = 0;
+    }
+}
+
+ssize_t BufChain::writeSome(const ConnIO &io, bool &blocked)
+{
+    blocked = false;
+    if (head == slices.size())
+        return 0;
+    ssize_t nwritten;
+    size_t want;
+    errno = 0;
+    if (slices[head].fd >= 0)
+    {
+        want = slices[head].len;
+        nwritten = io.sendfilen(slices[head].fd, slices[head].offset, want);
+    }
+    else
+    {
+        // 内存片段一次writev写出去，遇到文件片段为止
+        struct iovec iov[BUFCHAIN_MAX_IOV];
+        int iovcnt = 0;
+        want = 0;
+        for (size_t i = head; i < slices.size() && iovcnt < BUFCHAIN_MAX_IOV && slices[i].fd < 0; ++i)
+        {
+            iov[iovcnt].iov_base = (void*)slices[i].data;
+            iov[iovcnt].iov_len = slices[i].len;
+            want += slices[i].len;
+            ++iovcnt;
+        }
+        nwritten = io.writevn(iov, iovcnt);
+    }
+    if (nwritten < 0)
+        return -1;
+    consume(nwritten);
+    if ((size_t)nwritten < want)
+    {
+        // 写了一部分而不是因为发送缓冲区满，比如文件被截断了
+        if (errno != EAGAIN)
+            return -1;
+        blocked = true;
+    }
+    return nwritten;
+}
+
+bool BufChain::flush(const ConnIO &io)
+{
+    bool blocked = false;
+    while (!empty() && !blocked)
+        if (writeSome(io, blocked) < 0)
+            return false;
+    return true;
+}
@@ -0,0 +1,77 @@
+#ifndef BUFCHAIN
+#define BUFCHAIN
+#include <atomic>
+#include <string_view>
+#include <vector>
+#include <sys/types.h>
+#include "tls.h"
+
+/* 引用计数的不可变缓冲区链：一个响应由若干片段组成，每个片段引用某个BufSegment的一部分，
+   或者引用调用者保证有效的内存(字符串常量、打包文件的映射)，或者文件的一段(用sendfile发送)。
+   BufSegment发布之后内容不再改变，可以被任意多个连接同时引用，最后一个引用放掉时才释放，
+   缓存里的同一个文件发给一万个客户端，内存里只有一份。
+   发送时一次writev把整条链交给内核，只写出一部分时记住写到了哪里，下次从那里接着写；
+   发送缓冲区满时不等待，链留着没写完的部分，连接回到epoll等EPOLLOUT之后再接着写 */
+
+const int BUFCHAIN_MAX_IOV = 64;        //一次writev最多的片段数
+const size_t BUFCHAIN_COPY_BLOCK = 1024; //appendCopy新分配的段的最小大小
+
+struct BufSegment
+{
+    std::atomic<int> refs;
+    size_t len;
+    char *data;                         //紧跟在结构体后面，和它一起分配
+};
+
+// 分配len字节的段，引用计数为1；内容由调用者在交给别人之前填好，之后只读
+BufSegment *seg_alloc(size_t len);
+void seg_ref(BufSegment *seg);
+void seg_unref(BufSegment *seg);
+
+class BufChain
+{
+private:
+    struct Slice
+    {
+        BufSegment *seg;                //NULL表示引用外部内存或者文件
+        const char *data;
+        size_t len;
+        int fd;                         //>=0表示文件片段，从offset开始
+        off_t offset;
+    };
+    std::vector<Slice> slices;
+    std::vector<int> owned_fds;         //retainFiles之后链自己持有的描述符
+    size_t head;                        //slices[head]之前的都已经写完
+    size_t total;                       //还没写出去的字节数
+    BufSegment *tail;                   //appendCopy正在填的段，只有这条链在写
+    size_t tail_used;
+
+    void consume(size_t n);
+
+public:
+    BufChain();
+    ~BufChain();
+    BufChain(const BufChain &) = delete;
+    BufChain &operator=(const BufChain &) = delete;
+
+    // 引用外部内存，调用者保证在写完之前有效
+    void appendRef(std::string_view s);
+    // 拷贝进链自己的段，连续的小片段共用一个段、合并成一个iovec
+    void appendCopy(std::string_view s);
+    // 引用seg的[offset, offset + len)，链持有一个引用直到这部分写完
+    void append(BufSegment *seg, size_t offset, size_t len);
+    // 引用文件fd的[offset, offset + len)，调用者保证写完之前fd有效，或者在返回前调用retainFiles
+    void appendFile(int fd, off_t offset, size_t len);
+    // 没写完的内容要留到以后再发时调用：文件片段改为引用链自己dup的描述符，链清空时关闭
+    bool retainFiles();
+
+    size_t size() const { return total; }
+    bool empty() const { return total == 0; }
+    // 一次writev或者sendfile，返回写出的字节数，出错返回-1；blocked表示发送缓冲区满了
+    ssize_t writeSome(const ConnIO &io, bool &blocked);
+    // 写到链空或者发送缓冲区满为止，出错返回false；返回true而链不空时要等EPOLLOUT再写
+    bool flush(const ConnIO &io);
+    void clear();
+};
+
+#endif
@@ -0,0 +1,101 @@
+#include "bundle.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// 启动时映射好之后只读
+static int bundle_file = -1;
+static const char *bundle_map = NULL;
+static const BundleHeader *header = NULL;
+static const BundleEntry *table = NULL;
+static const char *strings = NULL;
+
+int bundle_open(const char *path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat sbuf;
+    if (fd < 0 || fstat(fd, &sbuf) < 0)
+    {
+        perror("open bundle failed");
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    if ((size_t)sbuf.st_size < sizeof(BundleHeader))
+    {
+        fprintf(stderr, "%s: not a bundle\n", path);
+        close(fd);
+        return -1;
+    }
+    void *map = mmap(NULL, sbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        perror("mmap bundle failed");
+        close(fd);
+        return -1;
+    }
+    const BundleHeader *h = (const BundleHeader*)map;
+    uint64_t table_end = sizeof(BundleHeader) + (uint64_t)h->table_size * sizeof(BundleEntry);
+    if (memcmp(h->magic, BUNDLE_MAGIC, sizeof(BUNDLE_MAGIC)) != 0 || h->version != BUNDLE_VERSION
+        || h->file_size != (uint64_t)sbuf.st_size || h->table_size == 0 || (h->table_size & (h->table_size - 1)) != 0
+        || table_end > h->strings_offset || h->strings_offset + h->strings_size > h->file_size)
+    {
+        fprintf(stderr, "%s: bad bundle header\n", path);
+        munmap(map, sbuf.st_size);
+        close(fd);
+        return -1;
+    }
+    bundle_file = fd;
+    bundle_map = (const char*)map;
+    header = h;
+    table = (const BundleEntry*)(bundle_map + sizeof(BundleHeader));
+    strings = bundle_map + h->strings_offset;
+    printf("bundle %s: %u files, %llu bytes\n", path, h->entry_count, (unsigned long long)h->file_size);
+    return 0;
+}
+
+bool bundle_enabled()
+{
+    return header != NULL;
+}
+
+int bundle_fd()
+{
+    return bundle_file;
+}
+
+const BundleEntry *bundle_find(std::string_view path)
+{
+    if (header == NULL)
+        return NULL;
+    uint64_t hash = bundle_hash(path);
+    uint32_t mask = header->table_size - 1;
+    for (uint32_t i = hash & mask, n = 0; n < header->table_size; i = (i + 1) & mask, ++n)
+    {
+        const BundleEntry *entry = &table[i];
+        if (entry->hash == 0)
+            return NULL;
+        if (entry->hash == hash && entry->path_len == path.size()
+            && memcmp(strings + entry->path_offset, path.data(), path.size()) == 0)
+            return entry;
+    }
+    return NULL;
+}
+
+std::string_view bundle_mime(const BundleEntry *entry)
+{
+    return std::string_view(strings + entry->mime_offset, entry->mime_len);
+}
+
+const void *bundle_base()
+{
+    return bundle_map;
+}
+
+uint64_t bundle_size()
+{
+    return header == NULL ? 0 : header->file_size;
+}
@@ -0,0 +1,80 @@
+#ifndef BUNDLE
+#define BUNDLE
+#include <stdint.h>
+#include <string_view>
+
+/* 静态站点打包文件：tools/bundlePack把整个docroot打成一个文件，服务器启动时整体mmap进来，
+   按路径查找只是一次哈希探测，正文从同一个描述符sendfile出去，不再有per-request的open/stat。
+   文件布局(本机字节序)：
+       BundleHeader
+       BundleEntry[table_size]      开放寻址哈希表，hash为0的是空槽
+       字符串区                      路径(不带开头的'/')和Content-type
+       文件内容                      每个文件(以及每个预压缩版本)都从页边界开始 */
+
+const char BUNDLE_MAGIC[8] = {'S', 'W', 'S', 'B', 'N', 'D', 'L', '1'};
+const uint32_t BUNDLE_VERSION = 1;
+
+// 每个文件最多三种表示：原文、.gz、.br，打包时从同目录下的同名预压缩文件取得
+const int BUNDLE_IDENTITY = 0;
+const int BUNDLE_GZIP = 1;
+const int BUNDLE_BROTLI = 2;
+const int BUNDLE_VARIANTS = 3;
+
+struct BundleHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t entry_count;
+    uint32_t table_size;        //槽位数，2的幂
+    uint32_t page_size;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+    uint64_t data_offset;       //第一个文件内容的偏移
+    uint64_t file_size;
+};
+
+struct BundleVariant
+{
+    uint64_t offset;            //在打包文件里的偏移，length为0表示没有这种表示
+    uint64_t length;
+};
+
+struct BundleEntry
+{
+    uint64_t hash;
+    uint32_t path_offset;       //相对字符串区的偏移
+    uint16_t path_len;
+    uint16_t mime_len;
+    uint32_t mime_offset;
+    uint32_t reserved;
+    int64_t mtime;
+    BundleVariant variants[BUNDLE_VARIANTS];
+};
+
+static_assert(sizeof(BundleHeader) == 56, "bundle header layout");
+static_assert(sizeof(BundleEntry) == 80, "bundle entry layout");
+
+// 路径的FNV-1a哈希，0留给空槽
+inline uint64_t bundle_hash(std::string_view path)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < path.size(); ++i)
+    {
+        h ^= (unsigned char)path[i];
+        h *= 1099511628211ULL;
+    }
+    return h == 0 ? 1 : h;
+}
+
+// 打开并映射打包文件，只检查文件头，成功返回0
+int bundle_open(const char *path);
+bool bundle_enabled();
+int bundle_fd();
+// path不带开头的'/'，找不到返回NULL
+const BundleEntry *bundle_find(std::string_view path);
+std::string_view bundle_mime(const BundleEntry *entry);
+// 整个打包文件的映射，预热时用
+const void *bundle_base();
+uint64_t bundle_size();
+
+#endif
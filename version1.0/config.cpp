@@ -0,0 +1,219 @@
+#include "config.h"
+#include "mime.h"
+#include "proxy.h"
+#include "ratelimit.h"
+#include "bundle.h"
+#include "urlpath.h"
+#include "vhost.h"
+#include "microcache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+using namespace std;
+
+static const ServerConfig default_config;
+std::atomic<const ServerConfig*> current_config(&default_config);
+
+static bool parse_int(const string &s, int min_value, int max_value, int &out)
+{
+    char *end = NULL;
+    long value = strtol(s.c_str(), &end, 10);
+    if (end == s.c_str() || *end != '\0' || value < min_value || value > max_value)
+        return false;
+    out = (int)value;
+    return true;
+}
+
+// 处理一条指令，args[0]是指令名
+static bool apply_directive(const vector<string> &args, ServerConfig &config, bool reloading)
+{
+    if (args[0] == "mime"){
+        if (args.size() != 3)
+            return false;
+        // MIME表启动后是只读的，热加载时忽略
+        return reloading || MimeType::add(args[1], args[2]);
+    }
+    // upstream <名字> <round_robin|least_conn> <地址>...，后端表同样只在启动时建立
+    if (args[0] == "upstream"){
+        if (args.size() < 4)
+            return false;
+        return reloading || proxy_add_upstream(args[1], args[2], vector<string>(args.begin() + 3, args.end()));
+    }
+    if (args[0] == "proxy_pass"){
+        if (args.size() != 3)
+            return false;
+        return reloading || proxy_add_route(args[1], args[2]);
+    }
+    // micro_cache <前缀> <有效期毫秒> [vary首部]...
+    if (args[0] == "micro_cache"){
+        if (args.size() < 3)
+            return false;
+        return reloading || microcache_add_route(vector<string>(args.begin() + 1, args.end()));
+    }
+    // vhost <名字,...> <docroot> [选项=值]...，站点表同样只在启动时建立
+    if (args[0] == "vhost"){
+        if (args.size() < 3)
+            return false;
+        return reloading || vhost_add(vector<string>(args.begin() + 1, args.end()));
+    }
+    if (args.size() != 2)
+        return false;
+    // 用打包文件代替当前目录作为docroot，启动时映射一次
+    if (args[0] == "bundle")
+        return reloading || bundle_open(args[1].c_str()) == 0;
+    if (args[0] == "https_port")
+        return parse_int(args[1], 1024, 65535, config.https_port);
+    if (args[0] == "ssl_certificate"){
+        config.ssl_certificate = args[1];
+        return true;
+    }
+    if (args[0] == "ssl_certificate_key"){
+        config.ssl_certificate_key = args[1];
+        return true;
+    }
+    if (args[0] == "thread_num")
+        return parse_int(args[1], 1, 1024, config.thread_num);
+    if (args[0] == "io_threads")
+        return parse_int(args[1], 0, 256, config.io_threads);
+    if (args[0] == "drain_timeout")
+        return parse_int(args[1], 0, 3600, config.drain_timeout);
+    if (args[0] == "max_connections")
+        return parse_int(args[1], 0, 10000000, config.max_connections);
+    if (args[0] == "docroot")
+        return reloading || docroot_open(args[1].c_str()) == 0;
+    if (args[0] == "path_cache_ms")
+        return parse_int(args[1], 0, 3600000, config.path_cache_ms);
+    if (args[0] == "file_cache_mb")
+        return parse_int(args[1], 0, 65536, config.file_cache_mb);
+    if (args[0] == "file_cache_max_kb")
+        return parse_int(args[1], 1, 1 << 20, config.file_cache_max_kb);
+    if (args[0] == "micro_cache_mb")
+        return parse_int(args[1], 0, 65536, config.micro_cache_mb);
+    if (args[0] == "idle_high_water")
+        return parse_int(args[1], 1, 100, config.idle_high_water);
+    if (args[0] == "first_byte_timeout")
+        return parse_int(args[1], 100, 3600000, config.first_byte_timeout);
+    if (args[0] == "header_timeout")
+        return parse_int(args[1], 100, 3600000, config.header_timeout);
+    if (args[0] == "max_header_size")
+        return parse_int(args[1], 1024, 1 << 20, config.max_header_size);
+    if (args[0] == "body_timeout")
+        return parse_int(args[1], 100, 3600000, config.body_timeout);
+    if (args[0] == "body_min_rate")
+        return parse_int(args[1], 0, 1 << 30, config.body_min_rate);
+    if (args[0] == "max_body_kb")
+        return parse_int(args[1], 1, 1 << 22, config.max_body_kb);
+    if (args[0] == "send_timeout")
+        return parse_int(args[1], 100, 3600000, config.send_timeout);
+    if (args[0] == "keepalive_timeout_max")
+        return parse_int(args[1], 1000, 3600000, config.keepalive_timeout_max);
+    if (args[0] == "keepalive_timeout_min")
+        return parse_int(args[1], 1000, 3600000, config.keepalive_timeout_min);
+    if (args[0] == "keepalive_memory_high")
+        return parse_int(args[1], 0, 1 << 20, config.keepalive_memory_high);
+    if (args[0] == "tcp_nodelay")
+        return parse_int(args[1], 0, 1, config.tcp_nodelay);
+    if (args[0] == "tcp_defer_accept")
+        return parse_int(args[1], 0, 600, config.tcp_defer_accept);
+    if (args[0] == "tcp_fastopen")
+        return parse_int(args[1], 0, 65535, config.tcp_fastopen);
+    if (args[0] == "prewarm"){
+        config.prewarm = args[1];
+        return true;
+    }
+    if (args[0] == "prewarm_max_mb")
+        return parse_int(args[1], 0, 1 << 20, config.prewarm_max_mb);
+    if (args[0] == "prewarm_mlock_mb")
+        return parse_int(args[1], 0, 1 << 20, config.prewarm_mlock_mb);
+    if (args[0] == "trace_file"){
+        config.trace_file = args[1];
+        return true;
+    }
+    if (args[0] == "trace_sample")
+        return parse_int(args[1], 0, 1 << 30, config.trace_sample);
+    if (args[0] == "limit_req_rate")
+        return parse_int(args[1], 0, RATELIMIT_MAX_RATE, config.limit_req_rate);
+    if (args[0] == "limit_req_burst")
+        return parse_int(args[1], 0, RATELIMIT_MAX_BURST, config.limit_req_burst);
+    if (args[0] == "limit_conn_rate")
+        return parse_int(args[1], 0, RATELIMIT_MAX_RATE, config.limit_conn_rate);
+    if (args[0] == "limit_conn_burst")
+        return parse_int(args[1], 0, RATELIMIT_MAX_BURST, config.limit_conn_burst);
+    if (args[0] == "admin_prefix"){
+        if (args[1].size() < 2 || args[1][0] != '/')
+            return false;
+        config.admin_prefix = args[1];
+        if (config.admin_prefix.back() == '/')
+            config.admin_prefix.pop_back();
+        return true;
+    }
+    return false;
+}
+
+int config_load(const char *path, ServerConfig &config, bool reloading)
+{
+    ifstream in(path);
+    if (!in){
+        perror("open config failed");
+        return -1;
+    }
+    string line;
+    int line_no = 0;
+    while (getline(in, line))
+    {
+        ++line_no;
+        size_t comment = line.find('#');
+        if (comment != string::npos)
+            line.erase(comment);
+        istringstream words(line);
+        vector<string> args;
+        string word;
+        while (words >> word)
+            args.push_back(word);
+        if (args.empty())
+            continue;
+        if (!apply_directive(args, config, reloading)){
+            fprintf(stderr, "%s:%d: invalid directive '%s'\n", path, line_no, args[0].c_str());
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void config_publish(ServerConfig *config)
+{
+    current_config.store(config, std::memory_order_release);
+}
+
+void config_apply_reload(const ServerConfig &next)
+{
+    ServerConfig *fresh = new ServerConfig(config_get());
+    ServerConfig &config = *fresh;
+    config.thread_num = next.thread_num;
+    config.drain_timeout = next.drain_timeout;
+    config.max_connections = next.max_connections;
+    config.idle_high_water = next.idle_high_water;
+    config.path_cache_ms = next.path_cache_ms;
+    config.file_cache_mb = next.file_cache_mb;
+    config.file_cache_max_kb = next.file_cache_max_kb;
+    config.micro_cache_mb = next.micro_cache_mb;
+    config.first_byte_timeout = next.first_byte_timeout;
+    config.header_timeout = next.header_timeout;
+    config.max_header_size = next.max_header_size;
+    config.body_timeout = next.body_timeout;
+    config.body_min_rate = next.body_min_rate;
+    config.max_body_kb = next.max_body_kb;
+    config.send_timeout = next.send_timeout;
+    config.keepalive_timeout_max = next.keepalive_timeout_max;
+    config.keepalive_timeout_min = next.keepalive_timeout_min;
+    config.keepalive_memory_high = next.keepalive_memory_high;
+    config.limit_req_rate = next.limit_req_rate;
+    config.limit_req_burst = next.limit_req_burst;
+    config.limit_conn_rate = next.limit_conn_rate;
+    config.limit_conn_burst = next.limit_conn_burst;
+    config.trace_sample = next.trace_sample;
+    config_publish(fresh);
+}
@@ -0,0 +1,108 @@
+#ifndef CONFIG
+#define CONFIG
+#include <atomic>
+#include <string>
+
+/* 配置文件格式：每行一条指令，'#'之后是注释，例如
+       mime .webp image/webp
+       mime default application/octet-stream
+       https_port 8443
+       ssl_certificate cert.pem
+       ssl_certificate_key key.pem
+       thread_num 8
+       io_threads 2
+       docroot /var/www
+       path_cache_ms 1000
+       vhost example.com,www.example.com /var/www/example cache_mb=8 limit_req_rate=200 access_log=example.log
+       file_cache_mb 32
+       file_cache_max_kb 64
+       drain_timeout 30
+       max_connections 10000
+       idle_high_water 90
+       first_byte_timeout 5000
+       header_timeout 10000
+       max_header_size 16384
+       body_timeout 20000
+       body_min_rate 500
+       max_body_kb 1024
+       send_timeout 10000
+       keepalive_timeout_max 5000
+       keepalive_timeout_min 1000
+       keepalive_memory_high 512
+       admin_prefix /__admin
+       tcp_nodelay 1
+       tcp_defer_accept 1
+       tcp_fastopen 256
+       limit_req_rate 100
+       limit_req_burst 200
+       limit_conn_rate 20
+       limit_conn_burst 40
+       upstream app least_conn 127.0.0.1:9000 unix:/run/app.sock
+       proxy_pass /api app
+       micro_cache /api/news 1000 Accept-Language
+       micro_cache_mb 16
+       bundle site.bundle
+       prewarm hot.txt
+       prewarm_max_mb 512
+       prewarm_mlock_mb 64
+       trace_file /tmp/sws.trace
+       trace_sample 100
+   收到SIGHUP时会重新读取配置文件，mime、https、upstream、micro_cache、bundle、docroot、vhost、prewarm、tcp_*和字符串类的指令只在启动时(或者升级时)生效
+*/
+struct ServerConfig
+{
+    int https_port = 0;                 //HTTPS监听端口，0表示不开启
+    std::string ssl_certificate;        //PEM格式的证书链
+    std::string ssl_certificate_key;    //PEM格式的私钥
+    int thread_num = 4;                 //工作线程数目，可以热加载
+    int io_threads = 2;                 //读冷文件的IO线程数，0表示冷文件也在工作线程上读，只在启动时生效
+    int path_cache_ms = 1000;           //路径解析缓存里的stat结果的有效期(毫秒)，0表示每次都stat
+    int file_cache_mb = 32;             //小文件内存缓存的总量上限，0表示关闭
+    int file_cache_max_kb = 64;         //超过这个大小的文件不进缓存，仍然sendfile
+    int micro_cache_mb = 16;            //动态响应微缓存的总量上限
+    int drain_timeout = 30;             //升级时旧进程等待在途请求处理完的最长时间(秒)
+    int max_connections = 0;            //连接数上限，0表示按RLIMIT_NOFILE留出余量后自动计算
+    int idle_high_water = 90;           //连接数超过上限的这个百分比时，开始关闭空闲最久的长连接
+    int first_byte_timeout = 5000;      //新连接等第一个字节的最长时间(毫秒)，不超过当前的长连接超时
+    int header_timeout = 10000;         //从请求的第一个字节到请求头收完的期限(毫秒)
+    int max_header_size = 16384;        //请求行加请求头的最大字节数，边收边检查
+    int body_timeout = 20000;           //收正文的初始期限(毫秒)
+    int body_min_rate = 500;            //正文每收到这么多字节期限延长一秒，0表示只看body_timeout
+    int max_body_kb = 1024;             //请求正文(Content-Length)的上限(KB)，超过返回413，转发给后端的也算
+    int send_timeout = 10000;           //响应写不进去时等客户端收走数据的最长时间(毫秒)，每写出一部分重新计时
+    int keepalive_timeout_max = 5000;   //空闲时长连接的超时(毫秒)
+    int keepalive_timeout_min = 1000;   //满负载时长连接的超时(毫秒)，至少1秒，通告给客户端的值按秒取整
+    int keepalive_memory_high = 0;      //进程常驻内存达到这个值(MB)时按满负载处理，0表示不看内存
+    std::string admin_prefix;           //管理接口的路径前缀，为空表示不开启
+    int tcp_nodelay = 1;                //监听socket上设置TCP_NODELAY，accept出来的连接会继承
+    int tcp_defer_accept = 0;           //TCP_DEFER_ACCEPT的秒数，连接上有数据才accept，0表示不开启
+    int tcp_fastopen = 0;               //TCP Fast Open的队列长度，0表示不开启
+    std::string prewarm;                //启动时预热的目录或者热点路径清单，为空表示不预热
+    int prewarm_max_mb = 512;           //最多预热多少MB
+    int prewarm_mlock_mb = 0;           //清单里最热的多少MB用mlock锁在内存里
+    std::string trace_file;             //请求追踪记录写到这个文件，为空表示不追踪
+    int trace_sample = 100;             //每多少个请求抽一个追踪，0表示暂停，可以热加载
+    int limit_req_rate = 0;             //每个客户端IP每秒的请求数，0表示不限流
+    int limit_req_burst = 0;            //请求令牌桶的容量，0表示和limit_req_rate相同
+    int limit_conn_rate = 0;            //每个客户端IP每秒新建的连接数，0表示不限流
+    int limit_conn_burst = 0;           //连接令牌桶的容量，0表示和limit_conn_rate相同
+};
+
+/* 当前生效的配置。工作线程随时在读，热加载时不改原来的对象，而是复制一份改好后整个换上去，
+   读的一方拿到的总是一份完整的配置；换下来的旧对象不释放，可能还有线程拿着它的引用。
+   一个函数里要读好几项(比如先判断不为0再做除数)时，先取一次引用再读 */
+extern std::atomic<const ServerConfig*> current_config;
+
+inline const ServerConfig &config_get()
+{
+    return *current_config.load(std::memory_order_acquire);
+}
+
+//解析配置文件到config，成功返回0，出错返回-1并打印出错的行；reloading为true时跳过只能在启动时生效的指令
+int config_load(const char *path, ServerConfig &config, bool reloading = false);
+//启动时换上config_load读出的配置，必须在线程池启动之前调用，config之后归current_config所有
+void config_publish(ServerConfig *config);
+//热加载：复制当前配置，把可以在运行中修改的数值配置从next复制过去后换上；只在主线程调用
+void config_apply_reload(const ServerConfig &next);
+
+#endif
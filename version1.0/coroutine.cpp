@@ -0,0 +1,128 @@
+#include "coroutine.h"
+#include "requestData.h"
+#include "config.h"
+#include "diskio.h"
+#include "util.h"
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+CoTask co_read(CoRequest &req, void *buff, size_t n)
+{
+    while (true)
+    {
+        errno = 0;
+        ssize_t nread = req.io.readn(buff, n);
+        const ServerConfig &config = config_get();
+        if (nread > 0 && req.deadline_ms != 0 && config.body_min_rate > 0)
+            req.deadline_ms += (long long)nread * 1000 / config.body_min_rate;
+        if (nread != 0 || errno != EAGAIN)
+            co_return nread;
+        // 和原来的状态机一样，请求读到一半时最多等REQUEST_TIME_OUT，也不超过期限
+        int wait_ms = REQUEST_TIME_OUT;
+        if (req.deadline_ms != 0){
+            long long left = req.deadline_ms - monotonic_ms();
+            if (left <= 0)
+                co_return CO_TIMEOUT;
+            if (left < wait_ms)
+                wait_ms = (int)left;
+        }
+        if (co_await co_wait(req, req.io.fd, EPOLLIN, wait_ms) == CO_TIMEOUT)
+            co_return CO_TIMEOUT;
+    }
+}
+
+CoTask co_write(CoRequest &req, const void *buff, size_t n)
+{
+    const char *ptr = (const char*)buff;
+    size_t done = 0;
+    while (done < n)
+    {
+        errno = 0;
+        ssize_t nwritten = req.io.writen(ptr + done, n - done);
+        if (nwritten < 0)
+            co_return CO_ERROR;
+        done += nwritten;
+        if (done == n)
+            break;
+        if (errno != EAGAIN)
+            co_return CO_ERROR;
+        // 每写出一部分重新计时，和同步响应的send_timeout一致
+        if (co_await co_wait(req, req.io.fd, EPOLLOUT, config_get().send_timeout) == CO_TIMEOUT)
+            co_return CO_TIMEOUT;
+    }
+    co_return done;
+}
+
+CoTask co_connect(CoRequest &req, int fd, const struct sockaddr *addr, socklen_t addr_len, int timeout_ms)
+{
+    int ret;
+    // 被信号(比如采样用的SIGPROF)打断时再调一次，连接已经在进行中会返回EALREADY，和EINPROGRESS一样等待
+    while ((ret = connect(fd, addr, addr_len)) < 0 && errno == EINTR)
+        ;
+    if (ret == 0 || errno == EISCONN)
+        co_return 0;
+    if (errno != EINPROGRESS && errno != EALREADY)
+        co_return CO_ERROR;
+    if (co_await co_wait(req, fd, EPOLLOUT, timeout_ms) == CO_TIMEOUT)
+        co_return CO_TIMEOUT;
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+        co_return CO_ERROR;
+    if (err != 0)
+    {
+        errno = err;
+        co_return CO_ERROR;
+    }
+    co_return 0;
+}
+
+CoTask co_recv(CoRequest &req, int fd, void *buff, size_t n, int timeout_ms)
+{
+    while (true)
+    {
+        ssize_t nread = read(fd, buff, n);
+        if (nread >= 0)
+            co_return nread;
+        if (errno == EINTR)
+            continue;
+        if (errno != EAGAIN)
+            co_return CO_ERROR;
+        if (co_await co_wait(req, fd, EPOLLIN, timeout_ms) == CO_TIMEOUT)
+            co_return CO_TIMEOUT;
+    }
+}
+
+CoTask co_send(CoRequest &req, int fd, const void *buff, size_t n, int timeout_ms)
+{
+    const char *ptr = (const char*)buff;
+    size_t done = 0;
+    while (done < n)
+    {
+        ssize_t nwritten = send(fd, ptr + done, n - done, MSG_NOSIGNAL);
+        if (nwritten >= 0)
+        {
+            done += nwritten;
+            continue;
+        }
+        if (errno == EINTR)
+            continue;
+        if (errno != EAGAIN)
+            co_return CO_ERROR;
+        if (co_await co_wait(req, fd, EPOLLOUT, timeout_ms) == CO_TIMEOUT)
+            co_return CO_TIMEOUT;
+    }
+    co_return done;
+}
+
+bool co_unpark(CoRequest &req)
+{
+    return req.owner->unparkCoroutine();
+}
+
+void co_resume(CoRequest &req)
+{
+    diskio_resume(req.owner);
+}
@@ -0,0 +1,179 @@
+#ifndef COROUTINE
+#define COROUTINE
+
+/* 协程处理函数：动态请求的处理函数写成C++20协程，读写socket、等定时器、和后端通信时co_await，
+   不用再手写收正文那样的状态机。
+   处理函数挂起时只把"等哪个描述符的什么事件、最多等多久"记在CoRequest里，由requestData
+   交给主循环的epoll和定时器队列，然后工作线程直接返回；事件到了或者超时后请求照常分发给
+   某个工作线程，从挂起的地方接着执行。挂起的请求不占线程，一个主循环可以同时挂着成千上万个慢请求。
+   POST请求和反向代理都跑在协程上，所以需要用-std=c++20编译 */
+
+#if !defined(__cpp_impl_coroutine) || !__has_include(<coroutine>)
+#error "coroutine handlers need -std=c++20"
+#endif
+#include <coroutine>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include "tls.h"
+#include "response.h"
+#include "header.h"
+
+const ssize_t CO_ERROR = -1;
+const ssize_t CO_TIMEOUT = -2;      //等待超过了给定的时间
+
+struct requestData;
+
+/* 协程的返回类型，返回值统一是ssize_t：处理函数返回负数表示出错，连接会被关闭。
+   协程创建后先挂起，第一次resume才开始执行；在一个协程里co_await另一个CoTask时
+   直接切换过去，被调用的协程结束后再切回来 */
+class CoTask
+{
+public:
+    struct promise_type
+    {
+        ssize_t value = CO_ERROR;
+        std::coroutine_handle<> continuation;   //co_await这个任务的上一层协程
+
+        struct FinalAwaiter
+        {
+            bool await_ready() noexcept { return false; }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+            {
+                std::coroutine_handle<> next = h.promise().continuation;
+                return next ? next : std::noop_coroutine();
+            }
+            void await_resume() noexcept {}
+        };
+
+        CoTask get_return_object() { return CoTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        FinalAwaiter final_suspend() noexcept { return {}; }
+        void return_value(ssize_t v) { value = v; }
+        // 处理函数里抛出的异常(比如stoi解析失败)当作出错处理
+        void unhandled_exception() { value = CO_ERROR; }
+    };
+
+    CoTask(): handle(nullptr) {}
+    CoTask(CoTask &&other) noexcept: handle(other.handle) { other.handle = nullptr; }
+    CoTask &operator=(CoTask &&other) noexcept
+    {
+        if (this != &other)
+        {
+            if (handle)
+                handle.destroy();
+            handle = other.handle;
+            other.handle = nullptr;
+        }
+        return *this;
+    }
+    CoTask(const CoTask &) = delete;
+    CoTask &operator=(const CoTask &) = delete;
+    ~CoTask() { if (handle) handle.destroy(); }
+
+    std::coroutine_handle<> start() const { return handle; }
+    bool done() const { return !handle || handle.done(); }
+    ssize_t result() const { return handle ? handle.promise().value : CO_ERROR; }
+
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept
+    {
+        handle.promise().continuation = caller;
+        return handle;
+    }
+    ssize_t await_resume() const noexcept { return handle.promise().value; }
+
+private:
+    explicit CoTask(std::coroutine_handle<promise_type> h): handle(h) {}
+    std::coroutine_handle<promise_type> handle;
+};
+
+// 一个请求上正在运行的协程处理函数，以及它当前挂起在什么上面
+struct CoRequest
+{
+    requestData *owner;
+    ConnIO io;                  //和客户端之间的读写
+    std::string_view uri;
+    const RequestHeaders *headers;
+    std::string *content;       //首部之后已经从客户端读到的内容
+    CoTask task;                //处理函数本身
+
+    // 挂起点，由co_wait填写，requestData据此注册epoll事件和定时器
+    std::coroutine_handle<> waiter;
+    int wait_fd;                //-1表示只等定时器
+    __uint32_t wait_events;
+    int wait_ms;
+    bool timed_out;             //这次是被定时器唤醒的
+    // co_read的期限(monotonic_ms)，每读到body_min_rate字节延长一秒，0表示只有每次等待的超时
+    long long deadline_ms;
+    // co_park/co_unpark的状态，parked和unparked都在qlock里读写
+    bool wait_unpark;           //这次挂起可以被co_unpark提前唤醒
+    bool parked;                //挂在co_park上，定时器已经注册
+    bool unparked;              //还没挂起就被co_unpark唤醒了，下一次co_park立即返回
+
+    CoRequest(requestData *_owner, const ConnIO &_io):
+        owner(_owner), io(_io), headers(NULL), content(NULL),
+        waiter(nullptr), wait_fd(-1), wait_events(0), wait_ms(0), timed_out(false), deadline_ms(0),
+        wait_unpark(false), parked(false), unparked(false) {}
+};
+
+typedef CoTask (*CoHandler)(CoRequest &req);
+
+// 挂起直到fd上出现events中的事件(EPOLLIN/EPOLLOUT)或者过了timeout_ms毫秒，超时返回CO_TIMEOUT，否则返回0
+struct CoWait
+{
+    CoRequest &req;
+    int fd;
+    __uint32_t events;
+    int timeout_ms;
+    bool unpark = false;
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> h) noexcept
+    {
+        req.waiter = h;
+        req.wait_fd = fd;
+        req.wait_events = events;
+        req.wait_ms = timeout_ms > 0 ? timeout_ms : 1;
+        req.timed_out = false;
+        req.wait_unpark = unpark;
+    }
+    ssize_t await_resume() const noexcept { return req.timed_out ? CO_TIMEOUT : 0; }
+};
+
+inline CoWait co_wait(CoRequest &req, int fd, __uint32_t events, int timeout_ms)
+{
+    return CoWait{req, fd, events, timeout_ms};
+}
+
+inline CoWait co_sleep(CoRequest &req, int ms)
+{
+    return CoWait{req, -1, 0, ms};
+}
+
+// 挂起直到别的线程调用co_unpark，或者过了timeout_ms毫秒(返回CO_TIMEOUT)；醒来后自己确认等的东西到了没有
+inline CoWait co_park(CoRequest &req, int timeout_ms)
+{
+    return CoWait{req, -1, 0, timeout_ms, true};
+}
+
+// 在别的线程上唤醒挂在co_park上的协程，可以持有调用者自己的锁，这里不会恢复执行。
+// 返回true时调用者要在放掉锁之后调用co_resume把请求交回工作线程；
+// 协程还没挂起时返回false，它接下来的co_park会立即返回
+bool co_unpark(CoRequest &req);
+void co_resume(CoRequest &req);
+
+// 从客户端读最多n个字节，没有数据时挂起等待；返回读到的字节数，对端关闭返回0，过了deadline_ms返回CO_TIMEOUT
+CoTask co_read(CoRequest &req, void *buff, size_t n);
+// 把n个字节全部写给客户端，发送缓冲区满时挂起等待，客户端send_timeout毫秒不收数据返回CO_TIMEOUT
+CoTask co_write(CoRequest &req, const void *buff, size_t n);
+
+// 下面三个用于协程里和后端通信，fd必须是非阻塞的，超时返回CO_TIMEOUT
+// 发起连接，连接建立返回0，失败时errno是失败的原因
+CoTask co_connect(CoRequest &req, int fd, const struct sockaddr *addr, socklen_t addr_len, int timeout_ms);
+CoTask co_recv(CoRequest &req, int fd, void *buff, size_t n, int timeout_ms);
+CoTask co_send(CoRequest &req, int fd, const void *buff, size_t n, int timeout_ms);
+
+#endif
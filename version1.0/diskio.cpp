@@ -0,0 +1,125 @@
+#include "diskio.h"
+#include "metrics.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <atomic>
+
+#ifndef __NR_cachestat
+#define __NR_cachestat 451
+#endif
+
+// glibc还没有cachestat的封装，结构体按内核uapi定义
+struct cachestat_range_arg
+{
+    uint64_t off;
+    uint64_t len;
+};
+
+struct cachestat_result
+{
+    uint64_t nr_cache;
+    uint64_t nr_dirty;
+    uint64_t nr_writeback;
+    uint64_t nr_evicted;
+    uint64_t nr_recently_evicted;
+};
+
+static threadpool_t *io_pool = NULL;
+static threadpool_t *worker_pool = NULL;
+static void (*resume_handler)(void *) = NULL;
+static std::atomic<bool> no_cachestat(false);
+
+int diskio_init(int threads, threadpool_t *workers, void (*resume)(void *))
+{
+    worker_pool = workers;
+    resume_handler = resume;
+    if (threads <= 0)
+        return 0;
+    io_pool = threadpool_create(threads, DISKIO_QUEUE_SIZE, 0);
+    if (io_pool == NULL)
+        return -1;
+    threadpool_set_name(io_pool, "sws-io");
+    return 0;
+}
+
+bool diskio_enabled()
+{
+    return io_pool != NULL;
+}
+
+bool diskio_cached(int fd, off_t offset, off_t len)
+{
+    if (len > DISKIO_PROBE_MAX)
+        len = DISKIO_PROBE_MAX;
+    if (len <= 0)
+        return true;
+    if (!no_cachestat)
+    {
+        struct cachestat_range_arg range = {(uint64_t)offset, (uint64_t)len};
+        struct cachestat_result cs;
+        if (syscall(__NR_cachestat, fd, &range, &cs, 0) == 0)
+        {
+            long page = sysconf(_SC_PAGESIZE);
+            uint64_t pages = (offset + len + page - 1) / page - offset / page;
+            return cs.nr_cache >= pages;
+        }
+        if (errno != ENOSYS)
+            return true;    //探测失败时当作已缓存，照常发送
+        no_cachestat = true;
+    }
+    // 老内核：首尾两处各读一个字节，不在页缓存里RWF_NOWAIT会返回EAGAIN
+    char c;
+    struct iovec iov;
+    iov.iov_base = &c;
+    iov.iov_len = 1;
+    off_t points[2] = {offset, offset + len - 1};
+    for (int i = 0; i < 2; ++i)
+        if (preadv2(fd, &iov, 1, points[i], RWF_NOWAIT) < 0 && errno == EAGAIN)
+            return false;
+    return true;
+}
+
+static void fetch_task(void *args)
+{
+    ((requestData*)args)->fetchDeferred();
+}
+
+bool diskio_submit(requestData *req)
+{
+    if (io_pool == NULL || threadpool_add(io_pool, fetch_task, req, 0) != 0)
+        return false;
+    ++server_metrics.diskio_deferred;
+    return true;
+}
+
+void diskio_fetch(int fd, off_t offset, off_t len)
+{
+    static thread_local char buff[DISKIO_FETCH_CHUNK];
+    off_t sync_len = len < DISKIO_FETCH_MAX ? len : DISKIO_FETCH_MAX;
+    off_t done = 0;
+    while (done < sync_len)
+    {
+        size_t want = sync_len - done < DISKIO_FETCH_CHUNK ? sync_len - done : DISKIO_FETCH_CHUNK;
+        ssize_t n = pread(fd, buff, want, offset + done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        done += n;
+    }
+    if (len > done)
+        readahead(fd, offset + done, len - done);
+    server_metrics.diskio_fetched_bytes += done;
+}
+
+void diskio_resume(requestData *req)
+{
+    // 工作线程队列满了就直接在IO线程上接着处理，数据已经在页缓存里了
+    if (threadpool_add(worker_pool, resume_handler, req, 0) != 0)
+        resume_handler(req);
+}
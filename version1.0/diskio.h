@@ -0,0 +1,30 @@
+#ifndef DISKIO
+#define DISKIO
+#include <sys/types.h>
+#include "threadpool.h"
+
+/* 冷文件的磁盘IO不在工作线程上做：发送之前先探测要发的内容是不是都在页缓存里，
+   在的话照常由工作线程sendfile；不在的话把请求交给专门的IO线程池，IO线程把内容读进页缓存后
+   再把请求交回工作线程继续处理，慢磁盘只会占住IO线程，不会拖住排在后面的热请求。
+   探测用cachestat(2)，老内核上退回到preadv2(RWF_NOWAIT) */
+
+const off_t DISKIO_PROBE_MAX = 1 << 20;     //只探测前1MB，更大的文件剩下的部分靠内核预读
+const off_t DISKIO_FETCH_MAX = 16 << 20;    //IO线程最多同步读这么多，剩下的只发readahead
+const int DISKIO_FETCH_CHUNK = 128 << 10;
+const int DISKIO_QUEUE_SIZE = 4096;
+
+struct requestData;
+
+// 创建IO线程池，resume是把请求交回工作线程时执行的函数；threads为0时不推迟，冷文件也在工作线程上读
+int diskio_init(int threads, threadpool_t *workers, void (*resume)(void *));
+bool diskio_enabled();
+// [offset, offset + len)是否都在页缓存里
+bool diskio_cached(int fd, off_t offset, off_t len);
+// 把请求交给IO线程，IO线程调用req->fetchDeferred()
+bool diskio_submit(requestData *req);
+// IO线程里：同步把内容读进页缓存
+void diskio_fetch(int fd, off_t offset, off_t len);
+// IO线程里：读完之后把请求交回工作线程；唤醒挂起的协程(co_resume)时也用它
+void diskio_resume(requestData *req);
+
+#endif
@@ -62,7 +62,7 @@ int epoll_del(int epoll_fd, int fd, void *request, __uint32_t events)
 int my_epoll_wait(int epoll_fd, struct epoll_event* events, int max_events, int timeout)//epoll_fd存放epoll事件表描述符events存放就绪的套接字的事件结构体(可以从里面判断就绪的事件和获取传过来的数据)
 {
     int ret_count = epoll_wait(epoll_fd, events, max_events, timeout);
-    if (ret_count < 0)
+    if (ret_count < 0 && errno != EINTR)   //采样剖析的SIGPROF会打断epoll_wait
     {
         perror("epoll wait error");
     }
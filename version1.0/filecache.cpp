@@ -0,0 +1,139 @@
+#include "filecache.h"
+#include "config.h"
+#include "metrics.h"
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <list>
+#include <unordered_map>
+using namespace std;
+
+struct CachedFile
+{
+    BufSegment *seg;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    list<string>::iterator lru;         //在lru_list里的位置
+};
+
+struct FileCache
+{
+    pthread_mutex_t lock;
+    unordered_map<string, CachedFile> files;
+    list<string> lru_list;              //表头是最近用过的
+    size_t bytes;
+    int capacity_mb;                    //-1表示跟随file_cache_mb
+
+    explicit FileCache(int _capacity_mb): bytes(0), capacity_mb(_capacity_mb)
+    {
+        pthread_mutex_init(&lock, NULL);
+    }
+};
+
+static FileCache default_cache(-1);
+
+FileCache *filecache_create(int capacity_mb)
+{
+    return new FileCache(capacity_mb);
+}
+
+static size_t capacity_of(const FileCache *cache)
+{
+    int mb = cache->capacity_mb < 0 ? config_get().file_cache_mb : cache->capacity_mb;
+    return (size_t)mb << 20;
+}
+
+static bool same_file(const CachedFile &file, const struct stat &sbuf)
+{
+    return file.ino == sbuf.st_ino && file.size == sbuf.st_size &&
+           file.mtime.tv_sec == sbuf.st_mtim.tv_sec && file.mtime.tv_nsec == sbuf.st_mtim.tv_nsec;
+}
+
+// 调用者持有cache->lock
+static void drop(FileCache *cache, unordered_map<string, CachedFile>::iterator it)
+{
+    cache->bytes -= it->second.size;
+    server_metrics.filecache_bytes -= it->second.size;
+    seg_unref(it->second.seg);
+    cache->lru_list.erase(it->second.lru);
+    cache->files.erase(it);
+}
+
+BufSegment *filecache_find(const string &path, const struct stat &sbuf, FileCache *cache)
+{
+    if (cache == NULL)
+        cache = &default_cache;
+    // 不会进缓存的大文件不算未命中
+    if (capacity_of(cache) == 0 || sbuf.st_size > ((off_t)config_get().file_cache_max_kb << 10))
+        return NULL;
+    pthread_mutex_lock(&cache->lock);
+    unordered_map<string, CachedFile>::iterator it = cache->files.find(path);
+    if (it == cache->files.end())
+    {
+        pthread_mutex_unlock(&cache->lock);
+        ++server_metrics.filecache_misses;
+        return NULL;
+    }
+    if (!same_file(it->second, sbuf))
+    {
+        drop(cache, it);
+        pthread_mutex_unlock(&cache->lock);
+        ++server_metrics.filecache_misses;
+        return NULL;
+    }
+    cache->lru_list.splice(cache->lru_list.begin(), cache->lru_list, it->second.lru);
+    BufSegment *seg = it->second.seg;
+    seg_ref(seg);
+    pthread_mutex_unlock(&cache->lock);
+    ++server_metrics.filecache_hits;
+    return seg;
+}
+
+BufSegment *filecache_load(const string &path, int fd, const struct stat &sbuf, FileCache *cache)
+{
+    if (cache == NULL)
+        cache = &default_cache;
+    size_t capacity = capacity_of(cache);
+    size_t max_file = (size_t)config_get().file_cache_max_kb << 10;
+    if (capacity == 0 || sbuf.st_size <= 0 || (size_t)sbuf.st_size > max_file || (size_t)sbuf.st_size > capacity)
+        return NULL;
+
+    // 在锁外面读文件，几个线程同时读同一个文件时后放进去的覆盖先放进去的
+    BufSegment *seg = seg_alloc(sbuf.st_size);
+    size_t done = 0;
+    while (done < seg->len)
+    {
+        ssize_t nread = pread(fd, seg->data + done, seg->len - done, done);
+        if (nread < 0 && errno == EINTR)
+            continue;
+        if (nread <= 0)
+        {
+            seg_unref(seg);
+            return NULL;
+        }
+        done += nread;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    unordered_map<string, CachedFile>::iterator it = cache->files.find(path);
+    if (it != cache->files.end())
+        drop(cache, it);
+    while (cache->bytes + seg->len > capacity && !cache->lru_list.empty())
+    {
+        drop(cache, cache->files.find(cache->lru_list.back()));
+        ++server_metrics.filecache_evictions;
+    }
+    cache->lru_list.push_front(path);
+    CachedFile &file = cache->files[path];
+    file.seg = seg;
+    file.ino = sbuf.st_ino;
+    file.size = sbuf.st_size;
+    file.mtime = sbuf.st_mtim;
+    file.lru = cache->lru_list.begin();
+    cache->bytes += seg->len;
+    server_metrics.filecache_bytes += seg->len;
+    seg_ref(seg);   //一个引用留在缓存里，一个给调用者
+    pthread_mutex_unlock(&cache->lock);
+    return seg;
+}
@@ -0,0 +1,23 @@
+#ifndef FILECACHE
+#define FILECACHE
+#include <string>
+#include <sys/stat.h>
+#include "bufchain.h"
+
+/* 小静态文件的内存缓存：文件内容读进一个BufSegment，之后所有请求这个文件的连接都引用同一段，
+   响应头和正文一次writev发出去，不再每个请求sendfile一次。
+   按路径查找，inode、大小或者修改时间对不上就当作没有；总量超过file_cache_mb时按最近最少使用淘汰，
+   淘汰只是放掉缓存自己的引用，正在发送它的连接发完才释放。
+   每个虚拟主机可以有自己的分区，各自淘汰，一个站点的热点不会把别的站点挤出去 */
+
+struct FileCache;
+
+// 新建一个分区，capacity_mb为-1时跟随file_cache_mb；只在启动时调用，分区不会释放
+FileCache *filecache_create(int capacity_mb);
+
+// 命中时返回加了一个引用的段，用完调用seg_unref；没有或者已经过期返回NULL。cache为NULL时用默认分区
+BufSegment *filecache_find(const std::string &path, const struct stat &sbuf, FileCache *cache = NULL);
+// 把fd的内容读进新的段并放进缓存，返回加了一个引用的段；文件太大、缓存关闭或者读失败时返回NULL
+BufSegment *filecache_load(const std::string &path, int fd, const struct stat &sbuf, FileCache *cache = NULL);
+
+#endif
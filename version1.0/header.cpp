@@ -0,0 +1,209 @@
+#include "header.h"
+#include <strings.h>
+#include <climits>
+
+namespace {
+
+constexpr std::string_view known_names[HEADER_COUNT] = {
+    "Host",
+    "Connection",
+    "Content-Length",
+    "Transfer-Encoding",
+    "Accept-Encoding",
+    "If-None-Match",
+    "If-Modified-Since",
+    "Range",
+    "If-Range",
+    "Expect",
+    "Keep-Alive",
+    "Proxy-Connection",
+    "TE",
+    "Upgrade",
+    "X-Forwarded-For",
+    "X-Forwarded-Proto",
+    "User-Agent",
+    "Accept",
+    "Accept-Language",
+    "Cookie",
+    "Referer",
+};
+
+constexpr int TABLE_BITS = 6;
+constexpr int TABLE_SIZE = 1 << TABLE_BITS;
+static_assert(HEADER_COUNT < TABLE_SIZE, "header table too small");
+static_assert(HEADER_COUNT <= 32, "present is a 32-bit mask");
+
+constexpr char fold(char c)
+{
+    return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+}
+
+// 大小写无关的FNV-1a，和mime.cpp里的一样
+constexpr uint64_t fold_hash(std::string_view s)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < s.size(); ++i){
+        h ^= (unsigned char)fold(s[i]);
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+constexpr int slot_of(uint64_t h, uint64_t seed)
+{
+    return (int)((h * seed) >> (64 - TABLE_BITS));
+}
+
+// 编译期找一个让所有常用首部互不冲突的乘数
+constexpr uint64_t find_seed()
+{
+    for (uint64_t seed = 0x9E3779B97F4A7C15ULL; ; seed += 2){
+        bool used[TABLE_SIZE] = {};
+        bool ok = true;
+        for (int i = 0; i < HEADER_COUNT && ok; ++i){
+            int slot = slot_of(fold_hash(known_names[i]), seed);
+            ok = !used[slot];
+            used[slot] = true;
+        }
+        if (ok)
+            return seed;
+    }
+}
+constexpr uint64_t SEED = find_seed();
+
+struct SlotTable
+{
+    signed char index[TABLE_SIZE];
+};
+
+constexpr SlotTable build_table()
+{
+    SlotTable t = {};
+    for (int i = 0; i < TABLE_SIZE; ++i)
+        t.index[i] = -1;
+    for (int i = 0; i < HEADER_COUNT; ++i)
+        t.index[slot_of(fold_hash(known_names[i]), SEED)] = (signed char)i;
+    return t;
+}
+constexpr SlotTable table = build_table();
+
+bool equal_fold(std::string_view a, std::string_view b)
+{
+    if (a.size() != b.size())
+        return false;
+    for (size_t i = 0; i < a.size(); ++i)
+        if (fold(a[i]) != fold(b[i]))
+            return false;
+    return true;
+}
+
+}
+
+int header_id(std::string_view name)
+{
+    int idx = table.index[slot_of(fold_hash(name), SEED)];
+    if (idx >= 0 && equal_fold(known_names[idx], name))
+        return idx;
+    return HEADER_UNKNOWN;
+}
+
+std::string_view header_name(int id)
+{
+    if (id < 0 || id >= HEADER_COUNT)
+        return std::string_view();
+    return known_names[id];
+}
+
+static std::string_view trim_ows(std::string_view s)
+{
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t'))
+        s.remove_prefix(1);
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t'))
+        s.remove_suffix(1);
+    return s;
+}
+
+// "0"、"0.5"、"1.000"这样的q值换成千分之一，格式不对返回-1
+static int parse_qvalue(std::string_view s)
+{
+    if (s.empty() || (s[0] != '0' && s[0] != '1'))
+        return -1;
+    int q = (s[0] - '0') * 1000;
+    if (s.size() == 1)
+        return q;
+    if (s[1] != '.' || s.size() > 5)
+        return -1;
+    int scale = 100;
+    for (size_t i = 2; i < s.size(); ++i, scale /= 10)
+    {
+        if (s[i] < '0' || s[i] > '9')
+            return -1;
+        q += (s[i] - '0') * scale;
+    }
+    return q <= 1000 ? q : -1;
+}
+
+static bool coding_equals(std::string_view name, std::string_view coding)
+{
+    if (name.size() == coding.size() + 2 && (name[0] == 'x' || name[0] == 'X') && name[1] == '-')
+        name.remove_prefix(2);
+    return name.size() == coding.size() && strncasecmp(name.data(), coding.data(), name.size()) == 0;
+}
+
+long header_content_length(std::string_view value)
+{
+    value = trim_ows(value);
+    if (value.empty())
+        return -1;
+    long length = 0;
+    for (char c : value)
+    {
+        if (c < '0' || c > '9' || length > (LONG_MAX - (c - '0')) / 10)
+            return -1;
+        length = length * 10 + (c - '0');
+    }
+    return length;
+}
+
+int header_coding_q(std::string_view list, std::string_view coding)
+{
+    int star = -1;
+    while (!list.empty())
+    {
+        size_t comma = list.find(',');
+        std::string_view item = list.substr(0, comma);
+        list = comma == std::string_view::npos ? std::string_view() : list.substr(comma + 1);
+        size_t semi = item.find(';');
+        std::string_view name = trim_ows(item.substr(0, semi));
+        if (name.empty())
+            continue;
+        int q = 1000;
+        while (semi != std::string_view::npos)
+        {
+            item = item.substr(semi + 1);
+            semi = item.find(';');
+            std::string_view param = trim_ows(item.substr(0, semi));
+            if (param.size() >= 2 && (param[0] == 'q' || param[0] == 'Q') && param[1] == '=')
+                q = parse_qvalue(param.substr(2));
+        }
+        // q值写错的按拒绝处理，不能把客户端不要的编码发过去
+        if (q < 0)
+            q = 0;
+        if (name == "*")
+            star = q;
+        else if (coding_equals(name, coding))
+            return q;
+    }
+    return star;
+}
+
+void RequestHeaders::set(std::string_view name, std::string_view value)
+{
+    int id = header_id(name);
+    if (id == HEADER_UNKNOWN){
+        other[std::string(name)].assign(value.data(), value.size());
+        return;
+    }
+    known[id].assign(value.data(), value.size());
+    present |= 1u << id;
+}
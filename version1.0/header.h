@@ -0,0 +1,69 @@
+#ifndef HEADER
+#define HEADER
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+/* 请求首部：常用的首部在解析时就通过编译期生成的大小写无关完美哈希换成编号，
+   值放在按编号排列的固定数组里，处理函数按编号直接取，不用再拼字符串、算哈希；
+   客户端发"content-length"还是"Content-Length"都一样。不认识的首部名字保持原样放在other里 */
+
+enum HeaderId
+{
+    HEADER_UNKNOWN = -1,
+    HEADER_HOST = 0,
+    HEADER_CONNECTION,
+    HEADER_CONTENT_LENGTH,
+    HEADER_TRANSFER_ENCODING,
+    HEADER_ACCEPT_ENCODING,
+    HEADER_IF_NONE_MATCH,
+    HEADER_IF_MODIFIED_SINCE,
+    HEADER_RANGE,
+    HEADER_IF_RANGE,
+    HEADER_EXPECT,
+    HEADER_KEEP_ALIVE,
+    HEADER_PROXY_CONNECTION,
+    HEADER_TE,
+    HEADER_UPGRADE,
+    HEADER_X_FORWARDED_FOR,
+    HEADER_X_FORWARDED_PROTO,
+    HEADER_USER_AGENT,
+    HEADER_ACCEPT,
+    HEADER_ACCEPT_LANGUAGE,
+    HEADER_COOKIE,
+    HEADER_REFERER,
+    HEADER_COUNT
+};
+
+// 大小写无关地查首部名，不是常用首部时返回HEADER_UNKNOWN
+int header_id(std::string_view name);
+// 首部的规范写法，例如"Content-Length"
+std::string_view header_name(int id);
+// Accept-Encoding这类带q值的列表里coding的q值(千分之一，0表示明确拒绝)：按整个词大小写无关地比较，
+// 没有列出时用"*"的q值，"*"也没有时返回-1；"gzip"也匹配旧写法"x-gzip"
+int header_coding_q(std::string_view list, std::string_view coding);
+// 解析Content-Length的值：去掉两边的空白后只接受十进制数字(不带符号)，格式不对或者超过LONG_MAX时返回-1
+long header_content_length(std::string_view value);
+
+struct RequestHeaders
+{
+    uint32_t present;                   //第id位表示known[id]有值
+    std::string known[HEADER_COUNT];    //清空时不释放，下一个请求直接复用
+    std::unordered_map<std::string, std::string> other;
+
+    RequestHeaders(): present(0) {}
+    // 同一个首部出现多次时保留最后一个
+    void set(std::string_view name, std::string_view value);
+    bool has(int id) const { return (present >> id) & 1; }
+    // 没有这个首部时返回空串；clear不清known，上一个请求留下的值不能漏给这个请求
+    const std::string &get(int id) const
+    {
+        static const std::string none;
+        return has(id) ? known[id] : none;
+    }
+    bool empty() const { return present == 0 && other.empty(); }
+    void clear() { present = 0; other.clear(); }
+};
+
+#endif
@@ -0,0 +1,87 @@
+#include "keepalive.h"
+#include "config.h"
+#include "metrics.h"
+#include "util.h"
+#include <stdio.h>
+#include <unistd.h>
+#include <atomic>
+
+const int PRESSURE_SCALE = 1000;
+const int PRESSURE_START = 50;   //用量超过上限的50%才开始收紧
+
+static std::atomic<int> current_timeout(-1);
+static long sampled_rss = -1;           //只在主循环里读写
+static long long rss_sampled_at = 0;
+
+// 进程常驻内存(字节)，读不到返回-1
+static long resident_bytes()
+{
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (fp == NULL)
+        return -1;
+    long size = 0, resident = 0;
+    int n = fscanf(fp, "%ld %ld", &size, &resident);
+    fclose(fp);
+    if (n != 2)
+        return -1;
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+// 把used/limit映射到[0, PRESSURE_SCALE]：低于PRESSURE_START%为0，达到high%为满
+static int pressure_of(double used, double limit, int high)
+{
+    if (limit <= 0)
+        return 0;
+    double ratio = used * 100 / limit;
+    if (ratio <= PRESSURE_START)
+        return 0;
+    if (ratio >= high || high <= PRESSURE_START)
+        return PRESSURE_SCALE;
+    return (int)((ratio - PRESSURE_START) * PRESSURE_SCALE / (high - PRESSURE_START));
+}
+
+void keepalive_update(int live, int limit)
+{
+    const ServerConfig &config = config_get();
+    int pressure = pressure_of(live, limit, config.idle_high_water);
+    if (config.keepalive_memory_high > 0)
+    {
+        // 主循环每次醒来都会调用，内存不会在几百毫秒里有多大变化
+        long long now = monotonic_ms();
+        if (rss_sampled_at == 0 || now - rss_sampled_at >= KEEPALIVE_RSS_SAMPLE_MS)
+        {
+            sampled_rss = resident_bytes();
+            rss_sampled_at = now;
+        }
+        long rss = sampled_rss;
+        int mem = pressure_of(rss, (double)config.keepalive_memory_high * 1024 * 1024, 100);
+        if (rss >= 0 && mem > pressure)
+            pressure = mem;
+    }
+
+    int max_ms = config.keepalive_timeout_max;
+    int min_ms = config.keepalive_timeout_min;
+    if (min_ms > max_ms)
+        min_ms = max_ms;
+    int timeout = max_ms - (int)((long long)(max_ms - min_ms) * pressure / PRESSURE_SCALE);
+    // 按秒取整，保证通告给客户端的值和实际使用的值一致
+    timeout = timeout / 1000 * 1000;
+    if (timeout < min_ms)
+        timeout = min_ms;
+
+    int old = current_timeout.exchange(timeout);
+    server_metrics.keepalive_pressure = pressure;
+    server_metrics.keepalive_timeout_ms = timeout;
+    if (old != timeout && old >= 0)
+    {
+        ++server_metrics.keepalive_adjustments;
+        if (timeout < old)
+            ++server_metrics.keepalive_shrinks;
+    }
+}
+
+int keepalive_timeout_ms()
+{
+    int timeout = current_timeout;
+    return timeout >= 0 ? timeout : config_get().keepalive_timeout_max;
+}
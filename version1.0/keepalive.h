@@ -0,0 +1,14 @@
+#ifndef KEEPALIVE
+#define KEEPALIVE
+
+/* 长连接空闲超时随负载变化：连接数占上限的比例和进程内存占配置上限的比例取较大者作为压力，
+   压力为0时用keepalive_timeout_max，压力为1时用keepalive_timeout_min，中间线性插值。
+   主循环每一轮调用keepalive_update()重新计算，其他线程只读取结果。
+   常驻内存要读/proc，最多每KEEPALIVE_RSS_SAMPLE_MS读一次，中间用上次的结果 */
+
+const int KEEPALIVE_RSS_SAMPLE_MS = 500;
+
+void keepalive_update(int live, int limit);
+int keepalive_timeout_ms();
+
+#endif
@@ -2,22 +2,34 @@
 #include "epoll.h"
 #include "threadpool.h"
 #include "util.h"
+#include "config.h"
+#include "tls.h"
+#include "upgrade.h"
+#include "keepalive.h"
+#include "ratelimit.h"
+#include "prewarm.h"
+#include "diskio.h"
+#include "trace.h"
+#include "probes.h"
 
 #include <sys/epoll.h>
 #include <queue>
 #include <sys/time.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <stdio.h>
 #include <string.h>
 #include <cstdlib>
 #include <iostream>
 #include <vector>
 #include <unistd.h>
+#include <signal.h>
+#include <limits.h>
+#include <sys/resource.h>
 
 using namespace std;
 
-const int THREADPOOL_THREAD_NUM = 4;
 const int QUEUE_SIZE = 65535;
 
 const int PORT = 8888;
@@ -26,12 +38,31 @@ const int ASK_IMAGE_STITCH = 2;
 
 const string PATH = "/";
 
-const int TIMER_TIME_OUT = 500;
+const int RESERVED_FDS = 64;       //给监听socket、epoll、正在发送的文件等留出的描述符
+const int IDLE_EVICT_BATCH = 16;   //描述符耗尽时一次至少淘汰的空闲连接数
+const int ACCEPT_BATCH = 64;       //一次accept循环里攒多少个新连接的定时器再统一入队
 
 
+int listen_fd = -1;        //HTTP监听描述符
+int https_listen_fd = -1;  //HTTPS监听描述符，没开HTTPS时为-1
+int signal_fd = -1;        //SIGUSR2(升级)和SIGHUP(重新加载配置)都从这里读
+requestData *listen_req = NULL;
+requestData *https_listen_req = NULL;
+requestData *upgrade_req = NULL;   //升级时等新进程回复的socket，没有在升级时fd为-1
+
+static char **server_argv = NULL;
+static char server_exe[PATH_MAX];        //启动时解析出的可执行文件绝对路径，升级时exec它
+static const char *config_path = NULL;
+static time_t drain_deadline = 0;        //旧进程最晚在这个时间退出，0表示没有在升级
+static pid_t upgrade_pid = 0;            //正在启动的新进程
+static long long upgrade_ready_deadline = 0;  //最晚在这个时间(monotonic_ms)收到新进程的回复，0表示没有在等
+static int connection_limit = 0;         //实际生效的连接数上限
+static bool accept_starved = false;      //accept因为描述符耗尽失败过，淘汰空闲连接后要重试
+
 extern pthread_mutex_t qlock;
 extern struct epoll_event* events;
-void acceptConnection(int listen_fd, int epoll_fd, const string &path);
+void acceptConnection(int listen_fd, int epoll_fd, const string &path, bool use_tls);
+void apply_listen_options(int fd);
 
 extern priority_queue<mytimer*, deque<mytimer*>, timerCmp> myTimerQueue;
 
@@ -43,7 +74,7 @@ int socket_bind_listen(int port)
 
     // 创建socket(IPv4 + TCP)，返回监听描述符
     int listen_fd = 0;
-    if((listen_fd = socket(AF_INET, SOCK_STREAM, 0)) == -1)
+    if((listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1)
         return -1;
 
     // 消除bind时"Address already in use"错误
@@ -60,6 +91,8 @@ int socket_bind_listen(int port)
     if(bind(listen_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) == -1)
         return -1;
 
+    apply_listen_options(listen_fd);
+
     // 开始监听，最大等待队列长为LISTENQ
     if(listen(listen_fd, LISTENQ) == -1)
         return -1;
@@ -77,68 +110,271 @@ int socket_bind_listen(int port)
 void myHandler(void *args)
 {
     requestData *req_data = (requestData*)args; //因为在mian函数一开始epoll事件结构体的event.data.ptr 项就是用requestData转换过去的 所以这里可以转换回来
+    SWS_PROBE2(dequeue, req_data->getFd(), req_data);
     req_data->handleRequest();
 }
 
-void acceptConnection(int listen_fd, int epoll_fd, const string &path)
+// 一批新连接的定时器攒起来一次性放进定时器队列，整批只拿一次qlock
+static void flush_accepted_timers(mytimer *timers[], int &timer_num)
+{
+    if (timer_num == 0)
+        return;
+    pthread_mutex_lock(&qlock);
+    for (int i = 0; i < timer_num; ++i)
+        myTimerQueue.push(timers[i]);
+    pthread_mutex_unlock(&qlock);
+    timer_num = 0;
+}
+
+void acceptConnection(int listen_fd, int epoll_fd, const string &path, bool use_tls)
 {
     struct sockaddr_in client_addr;
     memset(&client_addr, 0, sizeof(struct sockaddr_in));
-    socklen_t client_addr_len = 0;
+    socklen_t client_addr_len = sizeof(client_addr);
     int accept_fd = 0;
-    while((accept_fd = accept(listen_fd, (struct sockaddr*)&client_addr, &client_addr_len)) > 0)
-    {
-        /*
-        // TCP的保活机制默认是关闭的
-        int optval = 0;
-        socklen_t len_optval = 4;
-        getsockopt(accept_fd, SOL_SOCKET,  SO_KEEPALIVE, &optval, &len_optval);
-        cout << "optval ==" << optval << endl;
-        */
-        
-        // 设为非阻塞模式
-        int ret = setSocketNonBlocking(accept_fd);
-        if (ret < 0)
+    mytimer *timers[ACCEPT_BATCH];
+    int timer_num = 0;
+    // 新连接等第一个字节的时间取first_byte_timeout和当前长连接超时中较小的，负载高时一起缩短
+    int first_byte_ms = keepalive_timeout_ms();
+    int first_byte_timeout = config_get().first_byte_timeout;
+    if (first_byte_timeout < first_byte_ms)
+        first_byte_ms = first_byte_timeout;
+    // accept4直接拿到非阻塞、exec时关闭的描述符，不用再为每个连接调两次fcntl；
+    // TCP_NODELAY已经设置在监听socket上，新连接会继承
+    while((accept_fd = accept4(listen_fd, (struct sockaddr*)&client_addr, &client_addr_len, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+    {
+        client_addr_len = sizeof(client_addr);
+        // 新建连接太快的IP直接回429关掉，不创建任何连接状态；HTTPS连接还没握手，只能直接关闭
+        if (!ratelimit_allow_connection(ratelimit_key((struct sockaddr*)&client_addr)))
+        {
+            if (!use_tls)
+                send(accept_fd, RATELIMIT_RESPONSE, sizeof(RATELIMIT_RESPONSE) - 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+            close(accept_fd);
+            continue;
+        }
+
+        // HTTPS连接的握手放到工作线程里做，这里只创建OpenSSL对象
+        ssl_st *ssl = NULL;
+        if (use_tls && (ssl = tls_new(accept_fd)) == NULL)
         {
-            perror("Set non block failed!");
-            return;
+            close(accept_fd);
+            continue;
         }
+        SWS_PROBE3(accept, accept_fd, ntohl(client_addr.sin_addr.s_addr), use_tls);
+        requestData *req_info = new requestData(epoll_fd, accept_fd, path, ssl);
+        req_info->setClientAddr(client_addr);
 
-        requestData *req_info = new requestData(epoll_fd, accept_fd, path);
+        // 事件只会在主线程下一次epoll_wait时分发给工作线程，所以定时器可以在这一批处理完后再统一入队
+        // 新连接等第一个请求和空闲长连接一样，用当前负载下的超时
+        mytimer *mtimer = new mytimer(req_info, first_byte_ms);
+        req_info->addTimer(mtimer);
+        timers[timer_num++] = mtimer;
 
         // 文件描述符可以读，边缘触发(Edge Triggered)模式，保证一个socket连接在任一时刻只被一个线程处理
         __uint32_t _epo_event = EPOLLIN | EPOLLET | EPOLLONESHOT;
         epoll_add(epoll_fd, accept_fd, static_cast<void*>(req_info), _epo_event);
-        // 新增时间信息
-        mytimer *mtimer = new mytimer(req_info, TIMER_TIME_OUT);
-        req_info->addTimer(mtimer);
-        pthread_mutex_lock(&qlock);
-        myTimerQueue.push(mtimer);
-        pthread_mutex_unlock(&qlock);
+        if (timer_num == ACCEPT_BATCH)
+            flush_accepted_timers(timers, timer_num);
+    }
+    flush_accepted_timers(timers, timer_num);
+    if (accept_fd < 0 && (errno == EMFILE || errno == ENFILE))
+        accept_starved = true;
+}
+
+// 监听socket上的TCP选项，升级时从旧进程继承来的监听socket也要按新配置重新设置
+void apply_listen_options(int fd)
+{
+    const ServerConfig &config = config_get();
+    int optval = config.tcp_nodelay;
+    if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval)) < 0)
+        perror("set TCP_NODELAY failed");
+    // 连接上有数据到达之后才让accept返回，握手完还没发请求的连接不会占用连接对象和定时器
+    optval = config.tcp_defer_accept;
+    if (setsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &optval, sizeof(optval)) < 0)
+        perror("set TCP_DEFER_ACCEPT failed");
+    // 允许客户端在SYN里带上请求，省掉一个RTT
+    optval = config.tcp_fastopen;
+    if (optval > 0 && setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN, &optval, sizeof(optval)) < 0)
+        perror("set TCP_FASTOPEN failed");
+}
+
+void update_connection_limit()
+{
+    connection_limit = config_get().max_connections;
+    if (connection_limit == 0)
+    {
+        struct rlimit rl;
+        if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY)
+            connection_limit = (int)rl.rlim_cur - RESERVED_FDS;
+        else
+            connection_limit = LISTENQ;
+        if (connection_limit < RESERVED_FDS)
+            connection_limit = RESERVED_FDS;
+    }
+}
+
+/* 连接数超过高水位(或者accept已经拿不到描述符)时，主动关闭空闲最久的长连接，
+   让活跃的客户端和新来的连接不会因为描述符被空闲连接占着而饿死。
+   必须在一批事件处理完之后调用，被淘汰的连接不会再出现在这一批events里 */
+void balance_connections(int epoll_fd, const string &path)
+{
+    int high_water = (long long)connection_limit * config_get().idle_high_water / 100;
+    int live = live_connections;
+    if (live < high_water && !accept_starved)
+        return;
+    // 降到高水位以下一点(上限的1%)，避免每来一个连接都淘汰一次
+    int want = live - high_water + 1 + connection_limit / 100;
+    if (accept_starved && want < IDLE_EVICT_BATCH)
+        want = IDLE_EVICT_BATCH;
+    int evicted = evict_idle_connections(want);
+    if (evicted > 0)
+        printf("evicted %d idle connections (live %d, limit %d)\n", evicted, live, connection_limit);
+    if (accept_starved)
+    {
+        // 监听socket是边沿触发，积压的连接不会再通知，这里主动再accept一次
+        accept_starved = false;
+        if (listen_fd >= 0)
+            acceptConnection(listen_fd, epoll_fd, path, false);
+        if (https_listen_fd >= 0)
+            acceptConnection(https_listen_fd, epoll_fd, path, true);
+    }
+}
+
+// SIGHUP：重新读取配置文件，调整线程池大小
+void reload_config(threadpool_t *tp)
+{
+    if (config_path == NULL)
+        return;
+    const ServerConfig &current = config_get();
+    ServerConfig next = current;
+    if (config_load(config_path, next, true) < 0)
+    {
+        fprintf(stderr, "reload failed, keep the old config\n");
+        return;
+    }
+    if (next.thread_num != current.thread_num && threadpool_resize(tp, next.thread_num) != 0)
+    {
+        fprintf(stderr, "resize threadpool to %d failed\n", next.thread_num);
+        next.thread_num = current.thread_num;
+    }
+    config_apply_reload(next);
+    update_connection_limit();
+    printf("config reloaded\n");
+}
+
+// SIGUSR2：启动新进程并交出监听描述符，新进程的回复由主循环的epoll等，旧进程在此期间照常服务
+void start_upgrade(int epoll_fd)
+{
+    if (drain_deadline != 0 || upgrade_ready_deadline != 0)
+        return;
+    int fds[MAX_LISTEN_FDS];
+    int fd_num = 0;
+    fds[fd_num++] = listen_fd;
+    if (https_listen_fd >= 0)
+        fds[fd_num++] = https_listen_fd;
+    int sock = upgrade_spawn(server_exe, server_argv, fds, fd_num, upgrade_pid);
+    if (sock < 0)
+        return;
+    if (upgrade_req == NULL)
+        upgrade_req = new requestData();
+    upgrade_req->setFd(sock);
+    epoll_add(epoll_fd, sock, static_cast<void*>(upgrade_req), EPOLLIN);
+    upgrade_ready_deadline = monotonic_ms() + UPGRADE_READY_TIMEOUT;
+}
+
+// 新进程回复了(或者等超时了)：就绪的话停止accept，进入排空状态；否则继续服务
+void finish_upgrade(int epoll_fd)
+{
+    int sock = upgrade_req->getFd();
+    epoll_del(epoll_fd, sock, NULL, 0);
+    upgrade_req->setFd(-1);
+    upgrade_ready_deadline = 0;
+    if (upgrade_finish(sock, upgrade_pid) < 0)
+        return;
+
+    // 新进程已经在accept了，旧进程不再接新连接
+    int fds[MAX_LISTEN_FDS];
+    int fd_num = 0;
+    fds[fd_num++] = listen_fd;
+    if (https_listen_fd >= 0)
+        fds[fd_num++] = https_listen_fd;
+    for (int i = 0; i < fd_num; ++i)
+    {
+        epoll_del(epoll_fd, fds[i], NULL, 0);
+        close(fds[i]);
+    }
+    // 同一批就绪事件里可能还有监听描述符的事件，把它们标记成无效
+    listen_req->setFd(-1);
+    if (https_listen_req != NULL)
+        https_listen_req->setFd(-1);
+    listen_fd = https_listen_fd = -1;
+    server_draining = true;
+    drain_deadline = time(NULL) + config_get().drain_timeout;
+    printf("upgrade started, draining %d connections\n", live_connections.load());
+}
+
+void handle_signal(int epoll_fd, threadpool_t *tp)
+{
+    int signo;
+    while ((signo = upgrade_read_signal(signal_fd)) > 0)
+    {
+        if (signo == SIGHUP)
+            reload_config(tp);
+        else if (signo == SIGUSR2)
+            start_upgrade(epoll_fd);
+    }
+}
+
+// 离最近的定时器到期还有多久(毫秒)，最多EPOLL_WAIT_TIME；协程的短定时器靠这个按时唤醒
+int next_timer_timeout()
+{
+    int timeout = EPOLL_WAIT_TIME;
+    pthread_mutex_lock(&qlock);
+    if (!myTimerQueue.empty())
+    {
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        size_t now_ms = (now.tv_sec * 1000) + (now.tv_usec / 1000);
+        size_t expired_time = myTimerQueue.top()->getExpTime();
+        if (expired_time <= now_ms)
+            timeout = 0;
+        else if (expired_time - now_ms < (size_t)timeout)
+            timeout = expired_time - now_ms;
     }
-    //if(accept_fd == -1)
-     //   perror("accept");
+    pthread_mutex_unlock(&qlock);
+    return timeout;
 }
+
 // 分发处理函数
-void handle_events(int epoll_fd, int listen_fd, struct epoll_event* events, int events_num, const string &path, threadpool_t* tp)
+void handle_events(int epoll_fd, struct epoll_event* events, int events_num, const string &path, threadpool_t* tp)
 {
     for(int i = 0; i < events_num; i++)
     {
         // 获取有事件产生的描述符
         requestData* request = (requestData*)(events[i].data.ptr);
         int fd = request->getFd();
+        if (fd < 0)
+            continue;
 
         // 有事件发生的描述符为监听描述符
-        if(fd == listen_fd)
+        if(fd == signal_fd)
+        {
+            handle_signal(epoll_fd, tp);
+        }
+        else if(request == upgrade_req)
+        {
+            finish_upgrade(epoll_fd);
+        }
+        else if(fd == listen_fd || fd == https_listen_fd)
         {
             //cout << "This is listen_fd" << endl;
-            acceptConnection(listen_fd, epoll_fd, path);
+            acceptConnection(fd, epoll_fd, path, fd == https_listen_fd);
         }
         else
         {
-            // 排除错误事件
-            if ((events[i].events & EPOLLERR) || (events[i].events & EPOLLHUP)
-                || (!(events[i].events & EPOLLIN)))
+            // 排除错误事件，挂起的协程自己处理读写时遇到的错误
+            if (((events[i].events & EPOLLERR) || (events[i].events & EPOLLHUP)
+                || (!(events[i].events & (EPOLLIN | EPOLLOUT)))) && !request->coroutineWaiting())
             {
                 printf("error event\n");
                 delete request;
@@ -149,6 +385,9 @@ void handle_events(int epoll_fd, int listen_fd, struct epoll_event* events, int
             // 加入线程池之前将mytimer和request分离(自己的理解就是对request里面的timer成员进行初始化)
             //timer里面有request指针成员  requsetData类里面有mytimer类成员)
             request->seperateTimer();
+            request->leaveIdle();
+            request->traceDispatch();
+            SWS_PROBE2(enqueue, fd, request);
             int rc = threadpool_add(tp, myHandler, events[i].data.ptr, 0);//myHandler是对任务的处理函数   events[i].data.ptr是用户传过来的数据(报文) 作为任务处理函数的参数
         }
     }
@@ -158,14 +397,14 @@ void handle_events(int epoll_fd, int listen_fd, struct epoll_event* events, int
 因为(1) 优先队列不支持随机访问
 (2) 即使支持，随机删除某节点后破坏了堆的结构，需要重新更新堆结构。
 所以对于被置为deleted的时间节点，会延迟到它(1)超时 或 (2)它前面的节点都被删除时，它才会被删除。
-一个点被置为deleted,它最迟会在TIMER_TIME_OUT时间后被删除。
+一个点被置为deleted,它最迟会在它自己的超时时间后被删除。
 这样做有两个好处：
 (1) 第一个好处是不需要遍历优先队列，省时。
 (2) 第二个好处是给超时时间一个容忍的时间，就是设定的超时时间是删除的下限(并不是一到超时时间就立即删除)，如果监听的请求在超时后的下一次请求中又一次出现了，
 就不用再重新申请requestData节点了，这样可以继续重复利用前面的requestData，减少了一次delete和一次new的时间。
 */
 
-void handle_expired_event()
+void handle_expired_event(threadpool_t *tp)
 {
     pthread_mutex_lock(&qlock);
     while (!myTimerQueue.empty())
@@ -178,6 +417,14 @@ void handle_expired_event()
         }
         else if (ptimer_now->isvalid() == false)
         {
+            // 协程的等待超时：不关闭连接，把请求交给工作线程，协程从co_await处拿到CO_TIMEOUT
+            requestData *request = ptimer_now->wake ? ptimer_now->request_data : NULL;
+            if (request != NULL)
+            {
+                request->seperateTimer();
+                request->wakeCoroutine();
+                threadpool_add(tp, myHandler, request, 0);
+            }
             myTimerQueue.pop();
             delete ptimer_now;
         }
@@ -191,14 +438,35 @@ void handle_expired_event()
 
 
 
-int main()
+int main(int argc, char *argv[])
 {
+    /******读取配置文件(可选)，必须在线程池启动之前完成*******/
+    if (argc > 1)
+    {
+        config_path = argv[1];
+        ServerConfig *loaded = new ServerConfig;
+        if (config_load(config_path, *loaded) < 0)
+            return 1;
+        config_publish(loaded);
+    }
+    server_argv = argv;
+    update_connection_limit();
+    if (realpath("/proc/self/exe", server_exe) == NULL)
+        strncpy(server_exe, argv[0], sizeof(server_exe) - 1);
+
         /******设置信号SIGPIPE的处理操作*******/
         //默认读写一个关闭的socket会触发sigpipe信号 该信号的默认操作是关闭进程 这明显是我们不想要的
         //所以我们需要重新设置sigpipe的信号回调操作函数   比如忽略操作等  使得我们可以防止调用它的默认操作 
         //信号的处理是异步操作  也就是说 在这一条语句以后继续往下执行中如果碰到信号依旧会调用信号的回调处理函数
     handle_for_sigpipe(); 
 
+    /******SIGUSR2/SIGHUP改为通过signalfd在主循环里处理，要在创建线程之前屏蔽*******/
+    signal_fd = upgrade_signal_fd();
+    if (signal_fd < 0)
+    {
+        perror("signalfd failed");
+        return 1;
+    }
 
     /******初始化epoll事件表*******/
  
@@ -210,44 +478,115 @@ int main()
     }
 
     /******初始化线程池*******/
-    threadpool_t *threadpool = threadpool_create(THREADPOOL_THREAD_NUM, QUEUE_SIZE, 0);//创建一个4线程 65535工作队列长度的线程池
-
-    /******创建监听套接字*******/
-    int listen_fd = socket_bind_listen(PORT);
-    if (listen_fd < 0) 
+    threadpool_t *threadpool = threadpool_create(config_get().thread_num, QUEUE_SIZE, 0);//创建一个4线程 65535工作队列长度的线程池
+    threadpool_set_name(threadpool, "sws-worker");
+    // 冷文件的磁盘读放到单独的IO线程池，读完再交回上面的工作线程
+    if (diskio_init(config_get().io_threads, threadpool, myHandler) < 0)
     {
-        perror("socket bind failed");
+        perror("create io threadpool failed");
         return 1;
     }
-    if (setSocketNonBlocking(listen_fd) < 0)
+
+    if (!config_get().trace_file.empty() && trace_start(config_get().trace_file.c_str()) < 0)
+        return 1;
+
+    /******创建监听套接字，升级启动时直接用旧进程交过来的*******/
+    int inherited_fds[MAX_LISTEN_FDS];
+    int inherited_num = upgrade_receive_listen_fds(inherited_fds, MAX_LISTEN_FDS);
+    if (inherited_num < 0)
     {
-        perror("set socket non block failed");
+        fprintf(stderr, "receive listen fds from old process failed\n");
         return 1;
     }
+    if (inherited_num > 0)
+    {
+        listen_fd = inherited_fds[0];
+        if (inherited_num > 1)
+            https_listen_fd = inherited_fds[1];
+    }
+    else
+    {
+        listen_fd = socket_bind_listen(PORT);
+        if (listen_fd < 0) 
+        {
+            perror("socket bind failed");
+            return 1;
+        }
+    }
+    for (int i = 0; i < inherited_num; ++i)
+        apply_listen_options(inherited_fds[i]);
     
     /******将监听套接字纳入epoll的监管*******/
     __uint32_t event = EPOLLIN | EPOLLET;
-    requestData *req = new requestData(); //req会存放用户传过来的数据同时里面也放了监听套接字描述符
-    req->setFd(listen_fd);
-    epoll_add(epoll_fd, listen_fd, static_cast<void*>(req), event);
-    
+    listen_req = new requestData(); //listen_req会存放用户传过来的数据同时里面也放了监听套接字描述符
+    listen_req->setFd(listen_fd);
+    epoll_add(epoll_fd, listen_fd, static_cast<void*>(listen_req), event);
+
+    /******配置了证书时再开一个HTTPS监听端口*******/
+    if (config_get().https_port > 0)
+    {
+        if (tls_init(config_get().ssl_certificate.c_str(), config_get().ssl_certificate_key.c_str()) < 0)
+            return 1;
+        if (https_listen_fd < 0)
+            https_listen_fd = socket_bind_listen(config_get().https_port);
+        if (https_listen_fd < 0)
+        {
+            perror("https socket bind failed");
+            return 1;
+        }
+        https_listen_req = new requestData();
+        https_listen_req->setFd(https_listen_fd);
+        epoll_add(epoll_fd, https_listen_fd, static_cast<void*>(https_listen_req), event);
+    }
+    else if (https_listen_fd >= 0)
+    {
+        close(https_listen_fd);
+        https_listen_fd = -1;
+    }
+
+    requestData *sig_req = new requestData();
+    sig_req->setFd(signal_fd);
+    epoll_add(epoll_fd, signal_fd, static_cast<void*>(sig_req), EPOLLIN);
+
+    /******开始处理请求之前把热点文件读进页缓存，升级时旧进程在这段时间里继续服务，但只等UPGRADE_READY_TIMEOUT*******/
+    prewarm_run(inherited_num > 0 ? monotonic_ms() + UPGRADE_PREWARM_MAX : 0);
+
+    // 新进程已经可以accept了，旧进程可以停止监听
+    upgrade_notify_ready();
 
     /******进入监听循环*******/
     while (true)
     {
 
        /******就绪的事件放入events事件结构体数组*******/
-        int events_num = my_epoll_wait(epoll_fd, events, MAXEVENTS, -1);
+        // 定时器和排空状态都要靠超时唤醒来检查，不能无限等待
+        int events_num = my_epoll_wait(epoll_fd, events, MAXEVENTS, next_timer_timeout());
 
-        if (events_num == 0)
-            continue;
-        printf("%d\n", events_num);
+        if (events_num > 0)
+        {
+            printf("%d\n", events_num);
+
+            /******处理外部io事件*******/
+            handle_events(epoll_fd, events, events_num, PATH, threadpool);//epoll_fd表示epoll事件表的套接字  events_num表示就绪io套接字的数组 
+        }
 
-        /******处理外部io事件*******/
-        handle_events(epoll_fd, listen_fd, events, events_num, PATH, threadpool);//epoll_fd表示epoll事件表的套接字  listenfd表示监听套接字的描述符  events_num表示就绪io套接字的数组 
+        /******连接数过多时淘汰空闲长连接，并按负载重新计算长连接超时*******/
+        balance_connections(epoll_fd, PATH);
+        keepalive_update(live_connections, connection_limit);
 
            /******处理超时事件*******/
-          handle_expired_event();
+          handle_expired_event(threadpool);
+
+        /******新进程迟迟没有回复，放弃这次升级*******/
+        if (upgrade_ready_deadline != 0 && monotonic_ms() >= upgrade_ready_deadline)
+            finish_upgrade(epoll_fd);
+
+        /******升级中：在途请求处理完(或者超时)后退出*******/
+        if (drain_deadline != 0 && (live_connections == 0 || time(NULL) >= drain_deadline))
+        {
+            printf("drained, %d connections left, exit\n", live_connections.load());
+            break;
+        }
     }
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,57 @@
+#include "metrics.h"
+#include "requestData.h"
+
+ServerMetrics server_metrics;
+
+static void append_metric(std::string &out, const char *name, long value)
+{
+    out += name;
+    out += ' ';
+    out += std::to_string(value);
+    out += '\n';
+}
+
+void metrics_dump(std::string &out)
+{
+    append_metric(out, "live_connections", live_connections);
+    append_metric(out, "idle_connections", idle_connections);
+    append_metric(out, "requests", server_metrics.requests);
+    append_metric(out, "timer_expired", server_metrics.timer_expired);
+    append_metric(out, "idle_evicted", server_metrics.idle_evicted);
+    append_metric(out, "header_timeouts", server_metrics.header_timeouts);
+    append_metric(out, "body_timeouts", server_metrics.body_timeouts);
+    append_metric(out, "send_timeouts", server_metrics.send_timeouts);
+    append_metric(out, "header_too_large", server_metrics.header_too_large);
+    append_metric(out, "keepalive_timeout_ms", server_metrics.keepalive_timeout_ms);
+    append_metric(out, "keepalive_pressure_permille", server_metrics.keepalive_pressure);
+    append_metric(out, "keepalive_adjustments", server_metrics.keepalive_adjustments);
+    append_metric(out, "keepalive_shrinks", server_metrics.keepalive_shrinks);
+    append_metric(out, "proxy_requests", server_metrics.proxy_requests);
+    append_metric(out, "proxy_errors", server_metrics.proxy_errors);
+    append_metric(out, "proxy_pool_reused", server_metrics.proxy_pool_reused);
+    append_metric(out, "proxy_ejections", server_metrics.proxy_ejections);
+    append_metric(out, "ratelimit_requests", server_metrics.ratelimit_requests);
+    append_metric(out, "ratelimit_connections", server_metrics.ratelimit_connections);
+    append_metric(out, "path_cache_hits", server_metrics.path_cache_hits);
+    append_metric(out, "path_cache_misses", server_metrics.path_cache_misses);
+    append_metric(out, "vhost_unknown", server_metrics.vhost_unknown);
+    append_metric(out, "vhost_limited", server_metrics.vhost_limited);
+    append_metric(out, "filecache_hits", server_metrics.filecache_hits);
+    append_metric(out, "filecache_misses", server_metrics.filecache_misses);
+    append_metric(out, "filecache_evictions", server_metrics.filecache_evictions);
+    append_metric(out, "filecache_bytes", server_metrics.filecache_bytes);
+    append_metric(out, "microcache_hits", server_metrics.microcache_hits);
+    append_metric(out, "microcache_misses", server_metrics.microcache_misses);
+    append_metric(out, "microcache_coalesced", server_metrics.microcache_coalesced);
+    append_metric(out, "microcache_bypass", server_metrics.microcache_bypass);
+    append_metric(out, "microcache_bytes", server_metrics.microcache_bytes);
+    append_metric(out, "microcache_evictions", server_metrics.microcache_evictions);
+    append_metric(out, "diskio_deferred", server_metrics.diskio_deferred);
+    append_metric(out, "diskio_fetched_bytes", server_metrics.diskio_fetched_bytes);
+    append_metric(out, "trace_recorded", server_metrics.trace_recorded);
+    append_metric(out, "trace_dropped", server_metrics.trace_dropped);
+    append_metric(out, "prewarm_files", server_metrics.prewarm_files);
+    append_metric(out, "prewarm_bytes", server_metrics.prewarm_bytes);
+    append_metric(out, "prewarm_locked_bytes", server_metrics.prewarm_locked_bytes);
+    append_metric(out, "prewarm_ms", server_metrics.prewarm_ms);
+}
@@ -0,0 +1,55 @@
+#ifndef METRICS
+#define METRICS
+#include <atomic>
+#include <string>
+
+// 运行时指标，各个模块直接对原子变量计数，由管理接口统一输出
+struct ServerMetrics
+{
+    std::atomic<long> requests{0};                 //处理完成的请求数
+    std::atomic<long> timer_expired{0};            //被定时器关闭的连接数
+    std::atomic<long> idle_evicted{0};             //因为描述符压力被淘汰的空闲长连接数
+    std::atomic<long> header_timeouts{0};          //请求头没有在期限内收完而关闭的连接数
+    std::atomic<long> body_timeouts{0};            //正文收得太慢而关闭的连接数
+    std::atomic<long> send_timeouts{0};            //客户端太久不收响应而关闭的连接数
+    std::atomic<long> header_too_large{0};         //请求头超过max_header_size的请求数
+    std::atomic<long> keepalive_timeout_ms{0};     //当前的长连接空闲超时
+    std::atomic<long> keepalive_pressure{0};       //当前负载压力，千分比
+    std::atomic<long> keepalive_adjustments{0};    //超时时间调整的次数
+    std::atomic<long> keepalive_shrinks{0};        //其中调小的次数
+    std::atomic<long> proxy_requests{0};           //转发给后端的请求数
+    std::atomic<long> proxy_errors{0};             //转发失败的请求数
+    std::atomic<long> proxy_pool_reused{0};        //复用连接池里后端连接的次数
+    std::atomic<long> proxy_ejections{0};          //后端因为连续失败被摘掉的次数
+    std::atomic<long> ratelimit_requests{0};       //因为请求限流回送429的次数
+    std::atomic<long> ratelimit_connections{0};    //因为连接限流拒绝的连接数
+    std::atomic<long> path_cache_hits{0};          //路径解析缓存命中次数，命中时不用再解码
+    std::atomic<long> path_cache_misses{0};
+    std::atomic<long> vhost_unknown{0};            //配置了虚拟主机但Host不匹配、交给默认站点的请求数
+    std::atomic<long> vhost_limited{0};            //因为站点限流回送429的次数
+    std::atomic<long> filecache_hits{0};           //小文件缓存命中次数
+    std::atomic<long> filecache_misses{0};         //没有命中(包括文件已经改过)的次数
+    std::atomic<long> filecache_evictions{0};      //因为总量超限被淘汰的文件数
+    std::atomic<long> filecache_bytes{0};          //缓存里的字节数
+    std::atomic<long> microcache_hits{0};          //动态响应微缓存命中次数
+    std::atomic<long> microcache_misses{0};        //没有命中、由这个请求去找后端的次数
+    std::atomic<long> microcache_coalesced{0};     //等别的请求算出结果后直接用的次数
+    std::atomic<long> microcache_bypass{0};        //不能走缓存或者等待超时、自己找后端的次数
+    std::atomic<long> microcache_bytes{0};         //微缓存里的字节数
+    std::atomic<long> microcache_evictions{0};     //为了放新结果清掉的旧结果数
+    std::atomic<long> diskio_deferred{0};          //因为文件不在页缓存里交给IO线程的请求数
+    std::atomic<long> diskio_fetched_bytes{0};     //IO线程读进页缓存的字节数
+    std::atomic<long> trace_recorded{0};           //写进追踪缓冲的请求数
+    std::atomic<long> trace_dropped{0};            //缓冲写满丢掉的追踪记录数
+    std::atomic<long> prewarm_files{0};            //启动时预热的文件数
+    std::atomic<long> prewarm_bytes{0};            //预热的字节数
+    std::atomic<long> prewarm_locked_bytes{0};     //其中mlock锁住的字节数
+    std::atomic<long> prewarm_ms{0};               //预热耗时
+};
+
+extern ServerMetrics server_metrics;
+
+// 以"name value"每行一条的文本格式输出所有指标
+void metrics_dump(std::string &out);
+
+#endif
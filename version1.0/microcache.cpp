@@ -0,0 +1,321 @@
+#include "microcache.h"
+#include "config.h"
+#include "metrics.h"
+#include "util.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <algorithm>
+#include <list>
+#include <unordered_map>
+using namespace std;
+
+struct MicroEntry
+{
+    BufSegment *seg;                    //NULL表示还没有结果
+    size_t head_len;
+    long long expires;                  //monotonic_ms
+    bool filling;                       //有一个请求正在算
+    unsigned gen;                       //每次算完(不管成没成功)加一，等待的请求靠它知道结果出来了
+    vector<MicroWaiter*> waiters;       //挂起等这次结果的协程
+    list<const string*>::iterator lru;  //seg不为NULL时在分片的lru里的位置
+};
+
+struct MicroShard
+{
+    pthread_mutex_t lock;
+    unordered_map<string, MicroEntry> entries;
+    list<const string*> lru;            //有结果的条目的键(指向entries里的键)，最近放入或者命中的在后面
+    long bytes;                         //这一片里结果的字节数
+
+    MicroShard(): bytes(0)
+    {
+        pthread_mutex_init(&lock, NULL);
+    }
+};
+
+static MicroShard shards[MICROCACHE_SHARDS];
+static vector<MicroRoute> routes;       //按前缀从长到短排列，和proxy_pass一样先匹配最长的
+
+static MicroShard &shard_of(const string &key)
+{
+    return shards[hash<string>()(key) % MICROCACHE_SHARDS];
+}
+
+bool microcache_add_route(const vector<string> &args)
+{
+    if (args.size() < 2 || args[0].empty() || args[0][0] != '/')
+        return false;
+    MicroRoute route;
+    route.prefix = args[0];
+    if (route.prefix.size() > 1 && route.prefix.back() == '/')
+        route.prefix.pop_back();
+    char *end = NULL;
+    long ttl = strtol(args[1].c_str(), &end, 10);
+    if (*end != '\0' || ttl <= 0 || ttl > 3600000)
+        return false;
+    route.ttl_ms = (int)ttl;
+    route.vary_cookie = false;
+    for (size_t i = 2; i < args.size(); ++i)
+    {
+        int id = header_id(args[i]);
+        if (id == HEADER_COOKIE || strcasecmp(args[i].c_str(), "Authorization") == 0)
+            route.vary_cookie = true;
+        if (id != HEADER_UNKNOWN)
+            route.vary_ids.push_back(id);
+        else
+            route.vary.push_back(args[i]);
+    }
+    vector<MicroRoute>::iterator it = routes.begin();
+    while (it != routes.end() && it->prefix.size() >= route.prefix.size())
+        ++it;
+    routes.insert(it, route);
+    return true;
+}
+
+const MicroRoute *microcache_match(string_view path)
+{
+    for (size_t i = 0; i < routes.size(); ++i)
+    {
+        const string &prefix = routes[i].prefix;
+        if (path.compare(0, prefix.size(), prefix) != 0)
+            continue;
+        if (prefix.size() == 1 || path.size() == prefix.size() || path[prefix.size()] == '/' || path[prefix.size()] == '?')
+            return &routes[i];
+    }
+    return NULL;
+}
+
+// 不常用首部的名字保持客户端的写法，只能逐个比较
+static const string *find_other(const RequestHeaders &headers, const string &name)
+{
+    for (unordered_map<string, string>::const_iterator it = headers.other.begin(); it != headers.other.end(); ++it)
+        if (strcasecmp(it->first.c_str(), name.c_str()) == 0)
+            return &it->second;
+    return NULL;
+}
+
+bool microcache_key(const MicroRoute *route, string_view method, string_view uri,
+                    const RequestHeaders &headers, string &key)
+{
+    // 带身份的请求，响应多半是因人而异的
+    if (!route->vary_cookie && (headers.has(HEADER_COOKIE) || find_other(headers, "Authorization") != NULL))
+    {
+        ++server_metrics.microcache_bypass;
+        return false;
+    }
+    key.assign(method.data(), method.size());
+    key += ' ';
+    key += headers.get(HEADER_HOST);
+    key += ' ';
+    key.append(uri.data(), uri.size());
+    // 首部的值里不会有'\n'，用它分隔不会产生歧义
+    for (size_t i = 0; i < route->vary_ids.size(); ++i)
+    {
+        key += '\n';
+        key += headers.get(route->vary_ids[i]);
+    }
+    for (size_t i = 0; i < route->vary.size(); ++i)
+    {
+        const string *value = find_other(headers, route->vary[i]);
+        key += '\n';
+        if (value != NULL)
+            key += *value;
+    }
+    return true;
+}
+
+bool microcache_varies_on(const MicroRoute *route, string_view name)
+{
+    int id = header_id(name);
+    if (id != HEADER_UNKNOWN)
+        return std::find(route->vary_ids.begin(), route->vary_ids.end(), id) != route->vary_ids.end();
+    for (size_t i = 0; i < route->vary.size(); ++i)
+        if (route->vary[i].size() == name.size() && strncasecmp(route->vary[i].data(), name.data(), name.size()) == 0)
+            return true;
+    return false;
+}
+
+// 调用者持有分片的锁
+static void drop_result(MicroShard &shard, MicroEntry &entry)
+{
+    if (entry.seg == NULL)
+        return;
+    shard.lru.erase(entry.lru);
+    shard.bytes -= entry.seg->len;
+    server_metrics.microcache_bytes -= entry.seg->len;
+    seg_unref(entry.seg);
+    entry.seg = NULL;
+}
+
+int microcache_lookup(const string &key, MicroHit &hit, MicroWaiter &waiter)
+{
+    MicroShard &shard = shard_of(key);
+    pthread_mutex_lock(&shard.lock);
+    MicroEntry &entry = shard.entries[key];     //新建的是全0
+    if (entry.seg != NULL && monotonic_ms() < entry.expires)
+    {
+        shard.lru.splice(shard.lru.end(), shard.lru, entry.lru);
+        seg_ref(entry.seg);
+        hit.seg = entry.seg;
+        hit.head_len = entry.head_len;
+        pthread_mutex_unlock(&shard.lock);
+        ++server_metrics.microcache_hits;
+        return MICRO_HIT;
+    }
+    if (!entry.filling)
+    {
+        entry.filling = true;
+        pthread_mutex_unlock(&shard.lock);
+        ++server_metrics.microcache_misses;
+        return MICRO_FILL;
+    }
+
+    // 已经有请求在算，挂在条目上等它的结果
+    waiter.key = key;
+    waiter.gen = entry.gen;
+    waiter.linked = true;
+    entry.waiters.push_back(&waiter);
+    pthread_mutex_unlock(&shard.lock);
+    return MICRO_WAIT;
+}
+
+// 调用者持有分片的锁
+static void unlink_waiter(MicroShard &shard, MicroWaiter &waiter)
+{
+    waiter.linked = false;
+    unordered_map<string, MicroEntry>::iterator it = shard.entries.find(waiter.key);
+    if (it == shard.entries.end())
+        return;
+    vector<MicroWaiter*> &waiters = it->second.waiters;
+    waiters.erase(std::remove(waiters.begin(), waiters.end(), &waiter), waiters.end());
+}
+
+int microcache_collect(MicroWaiter &waiter, MicroHit &hit)
+{
+    MicroShard &shard = shard_of(waiter.key);
+    pthread_mutex_lock(&shard.lock);
+    // 还挂着说明是等超时了；醒来后重新查一遍，条目在等待期间可能被清掉
+    if (waiter.linked)
+        unlink_waiter(shard, waiter);
+    unordered_map<string, MicroEntry>::iterator it = shard.entries.find(waiter.key);
+    if (it != shard.entries.end() && it->second.gen != waiter.gen && it->second.seg != NULL
+        && monotonic_ms() < it->second.expires)
+    {
+        seg_ref(it->second.seg);
+        hit.seg = it->second.seg;
+        hit.head_len = it->second.head_len;
+        pthread_mutex_unlock(&shard.lock);
+        ++server_metrics.microcache_coalesced;
+        return MICRO_HIT;
+    }
+    pthread_mutex_unlock(&shard.lock);
+    ++server_metrics.microcache_bypass;
+    return MICRO_BYPASS;
+}
+
+MicroWaiter::~MicroWaiter()
+{
+    if (key.empty())
+        return;
+    MicroShard &shard = shard_of(key);
+    pthread_mutex_lock(&shard.lock);
+    if (linked)
+        unlink_waiter(shard, *this);
+    pthread_mutex_unlock(&shard.lock);
+}
+
+// 调用者持有分片的锁：摘下等这个条目的协程，已经挂起的放进wake，放掉锁之后再交回工作线程
+static void release_waiters(MicroEntry &entry, vector<CoRequest*> &wake)
+{
+    for (size_t i = 0; i < entry.waiters.size(); ++i)
+    {
+        MicroWaiter *waiter = entry.waiters[i];
+        waiter->linked = false;
+        if (co_unpark(*waiter->co))
+            wake.push_back(waiter->co);
+    }
+    entry.waiters.clear();
+}
+
+static void resume_waiters(const vector<CoRequest*> &wake)
+{
+    for (size_t i = 0; i < wake.size(); ++i)
+        co_resume(*wake[i]);
+}
+
+// 调用者持有分片的锁：按lru从最久没用的开始清掉结果，直到这一片再放得下need字节；
+// 正在算的条目只丢掉旧结果，条目留着，等待的请求还要找它。清掉的都是真的被删除的，摊下来每次放入是常数时间
+static void evict_for(MicroShard &shard, long need, long capacity)
+{
+    while (shard.bytes + need > capacity && !shard.lru.empty())
+    {
+        unordered_map<string, MicroEntry>::iterator it = shard.entries.find(*shard.lru.front());
+        drop_result(shard, it->second);
+        if (!it->second.filling)
+            shard.entries.erase(it);
+        ++server_metrics.microcache_evictions;
+    }
+}
+
+void MicroFill::commit(int ttl_ms, string_view head, string_view body)
+{
+    if (!active)
+        return;
+    active = false;
+    BufSegment *seg = seg_alloc(head.size() + body.size());
+    memcpy(seg->data, head.data(), head.size());
+    memcpy(seg->data + head.size(), body.data(), body.size());
+
+    // 每片各管总量的1/MICROCACHE_SHARDS，只在自己这一片里腾地方，不用去拿别的分片的锁
+    long capacity = ((long)config_get().micro_cache_mb << 20) / MICROCACHE_SHARDS;
+    MicroShard &shard = shard_of(key);
+    vector<CoRequest*> wake;
+    pthread_mutex_lock(&shard.lock);
+    unordered_map<string, MicroEntry>::iterator it = shard.entries.try_emplace(key).first;
+    MicroEntry &entry = it->second;
+    drop_result(shard, entry);
+    if ((long)seg->len <= capacity)
+    {
+        evict_for(shard, seg->len, capacity);
+        entry.seg = seg;
+        entry.head_len = head.size();
+        entry.expires = monotonic_ms() + ttl_ms;
+        entry.lru = shard.lru.insert(shard.lru.end(), &it->first);
+        shard.bytes += seg->len;
+        server_metrics.microcache_bytes += seg->len;
+        seg = NULL;
+    }
+    entry.filling = false;
+    ++entry.gen;
+    release_waiters(entry, wake);
+    // 没有放进去的条目是空的，等待的请求都已经摘下，留着只会占地方
+    if (entry.seg == NULL)
+        shard.entries.erase(it);
+    pthread_mutex_unlock(&shard.lock);
+    resume_waiters(wake);
+    if (seg != NULL)
+        seg_unref(seg);
+}
+
+MicroFill::~MicroFill()
+{
+    if (!active)
+        return;
+    // 出错或者响应不能缓存：让等待的请求各自去算
+    MicroShard &shard = shard_of(key);
+    vector<CoRequest*> wake;
+    pthread_mutex_lock(&shard.lock);
+    unordered_map<string, MicroEntry>::iterator it = shard.entries.find(key);
+    if (it != shard.entries.end())
+    {
+        it->second.filling = false;
+        ++it->second.gen;
+        release_waiters(it->second, wake);
+        if (it->second.seg == NULL)
+            shard.entries.erase(it);
+    }
+    pthread_mutex_unlock(&shard.lock);
+    resume_waiters(wake);
+}
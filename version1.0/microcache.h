@@ -0,0 +1,96 @@
+#ifndef MICROCACHE
+#define MICROCACHE
+#include <string>
+#include <string_view>
+#include <vector>
+#include "bufchain.h"
+#include "header.h"
+#include "coroutine.h"
+
+/* 动态响应的微缓存：按路径前缀给转发到后端的GET请求配置一个很短的有效期，例如
+       micro_cache /api/news 1000 Accept-Language
+   有效期内同样的请求直接用缓存的响应，不再找后端。键由方法、Host、路径和查询串，
+   以及配置里列出的vary首部的值组成。
+   同一个键没有命中时只让第一个请求去算(single-flight)，其余的请求挂在条目上等它算完直接用结果，
+   突发流量下后端对一个键同时只看到一个请求；等待的请求是挂起的协程，不占工作线程。
+   等了MICROCACHE_LOCK_TIMEOUT还没算完，或者算出来的响应不能缓存，等待的请求各自去找后端。
+   只缓存带Content-Length的200响应，带Set-Cookie或者Cache-Control: private/no-store/no-cache的不缓存；
+   后端的Vary是*，或者列出了不在配置的vary里的首部时也不缓存，键里没有这些首部，结果不能给别的客户端用；
+   请求带Cookie或者Authorization、而这两个首部又不在vary里时不走缓存。
+   缓存按键分成MICROCACHE_SHARDS片，每片一把锁，各占micro_cache_mb的1/MICROCACHE_SHARDS；
+   放不下时只在这一片里按最久没用的顺序清掉旧结果，比一片还大的响应不缓存 */
+
+const int MICROCACHE_SHARDS = 16;
+const int MICROCACHE_LOCK_TIMEOUT = 5000;       //等别的请求算出结果的最长时间(毫秒)
+const size_t MICROCACHE_MAX_BODY = 1 << 20;     //超过这个大小的响应不缓存
+
+const int MICRO_HIT = 0;        //命中，结果在MicroHit里
+const int MICRO_FILL = 1;       //没有命中，由调用者去算，算完调用MicroFill::commit
+const int MICRO_BYPASS = 2;     //等待超时或者算出来的不能缓存，调用者自己去算，不写回
+const int MICRO_WAIT = 3;       //别的请求正在算，调用者co_park等它，醒来后调用microcache_collect
+
+struct MicroRoute
+{
+    std::string prefix;
+    int ttl_ms;
+    std::vector<std::string> vary;      //不是常用首部的vary名字
+    std::vector<int> vary_ids;          //常用首部按编号取
+    bool vary_cookie;                   //Cookie或者Authorization在vary里
+};
+
+// 命中的响应：seg的前head_len字节是状态行和首部(都以\r\n结尾，不含空行)，后面是正文
+struct MicroHit
+{
+    BufSegment *seg;
+    size_t head_len;
+};
+
+// 配置文件里的micro_cache <前缀> <有效期毫秒> [vary首部]...，只能在启动时调用
+bool microcache_add_route(const std::vector<std::string> &args);
+// 按路径前缀找配置，不缓存时返回NULL
+const MicroRoute *microcache_match(std::string_view path);
+// 首部name在route配置的vary里(也就是在缓存键里)，大小写无关
+bool microcache_varies_on(const MicroRoute *route, std::string_view name);
+// 组织缓存键，请求不能走缓存时返回false
+bool microcache_key(const MicroRoute *route, std::string_view method, std::string_view uri,
+                    const RequestHeaders &headers, std::string &key);
+// 等别的请求算结果的一个协程，挂在条目上直到结果出来；放在协程栈上，析构时还挂着就摘下来
+struct MicroWaiter
+{
+    std::string key;
+    CoRequest *co;
+    unsigned gen;
+    bool linked;                        //在条目的等待列表里，由分片的锁保护
+
+    explicit MicroWaiter(CoRequest *_co): co(_co), gen(0), linked(false) {}
+    ~MicroWaiter();
+    MicroWaiter(const MicroWaiter &) = delete;
+    MicroWaiter &operator=(const MicroWaiter &) = delete;
+};
+
+// 查缓存，返回MICRO_*；返回MICRO_HIT时hit.seg加了一个引用，用完调用seg_unref；
+// 返回MICRO_WAIT时waiter已经挂上，结果出来时co_unpark它
+int microcache_lookup(const std::string &key, MicroHit &hit, MicroWaiter &waiter);
+// 等待结束(被唤醒或者超时)之后取结果，返回MICRO_HIT或者MICRO_BYPASS
+int microcache_collect(MicroWaiter &waiter, MicroHit &hit);
+
+// 一次填充：begin之后不管是commit还是出错返回，析构时都会唤醒等这个键的请求
+class MicroFill
+{
+private:
+    std::string key;
+    bool active;
+
+public:
+    MicroFill(): active(false) {}
+    ~MicroFill();
+    MicroFill(const MicroFill &) = delete;
+    MicroFill &operator=(const MicroFill &) = delete;
+
+    void begin(const std::string &_key) { key = _key; active = true; }
+    bool filling() const { return active; }
+    // 放入算出来的响应：head是状态行和首部，body是正文
+    void commit(int ttl_ms, std::string_view head, std::string_view body);
+};
+
+#endif
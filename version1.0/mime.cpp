@@ -0,0 +1,164 @@
+#include "mime.h"
+#include <stdint.h>
+#include <string.h>
+#include <string>
+
+namespace {
+
+struct MimeEntry
+{
+    std::string_view suffix;
+    std::string_view type;
+};
+
+constexpr MimeEntry builtin_mime[] = {
+    {".html", "text/html"},
+    {".avi", "video/x-msvideo"},
+    {".bmp", "image/bmp"},
+    {".c", "text/plain"},
+    {".doc", "application/msword"},
+    {".gif", "image/gif"},
+    {".gz", "application/x-gzip"},
+    {".htm", "text/html"},
+    {".ico", "application/x-ico"},
+    {".jpg", "image/jpeg"},
+    {".png", "image/png"},
+    {".txt", "text/plain"},
+    {".mp3", "audio/mp3"},
+};
+constexpr int BUILTIN_NUM = sizeof(builtin_mime) / sizeof(builtin_mime[0]);
+
+constexpr int TABLE_BITS = 5;
+constexpr int TABLE_SIZE = 1 << TABLE_BITS;
+static_assert(BUILTIN_NUM < TABLE_SIZE, "mime table too small");
+
+constexpr char fold(char c)
+{
+    return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+}
+
+// 大小写无关的FNV-1a
+constexpr uint64_t fold_hash(std::string_view s)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < s.size(); ++i){
+        h ^= (unsigned char)fold(s[i]);
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+constexpr int slot_of(uint64_t h, uint64_t seed)
+{
+    return (int)((h * seed) >> (64 - TABLE_BITS));
+}
+
+// 编译期找一个让所有内置扩展名互不冲突的乘数，得到完美哈希
+constexpr uint64_t find_seed()
+{
+    for (uint64_t seed = 0x9E3779B97F4A7C15ULL; ; seed += 2){
+        bool used[TABLE_SIZE] = {};
+        bool ok = true;
+        for (int i = 0; i < BUILTIN_NUM && ok; ++i){
+            int slot = slot_of(fold_hash(builtin_mime[i].suffix), seed);
+            ok = !used[slot];
+            used[slot] = true;
+        }
+        if (ok)
+            return seed;
+    }
+}
+constexpr uint64_t SEED = find_seed();
+
+struct SlotTable
+{
+    signed char index[TABLE_SIZE];
+};
+
+constexpr SlotTable build_table()
+{
+    SlotTable t = {};
+    for (int i = 0; i < TABLE_SIZE; ++i)
+        t.index[i] = -1;
+    for (int i = 0; i < BUILTIN_NUM; ++i)
+        t.index[slot_of(fold_hash(builtin_mime[i].suffix), SEED)] = (signed char)i;
+    return t;
+}
+constexpr SlotTable builtin_table = build_table();
+
+bool equal_fold(std::string_view a, std::string_view b)
+{
+    if (a.size() != b.size())
+        return false;
+    for (size_t i = 0; i < a.size(); ++i)
+        if (fold(a[i]) != fold(b[i]))
+            return false;
+    return true;
+}
+
+// 配置文件追加的扩展名放在一张开放寻址表里，启动之后不再修改
+struct ExtraEntry
+{
+    uint64_t hash;
+    std::string suffix;
+    std::string type;
+};
+const int EXTRA_SIZE = MAX_EXTRA_MIME * 2;
+ExtraEntry extra_mime[EXTRA_SIZE];
+int extra_num = 0;
+std::string default_type = "text/html";
+
+}
+
+bool MimeType::add(std::string_view suffix, std::string_view type)
+{
+    if (suffix == "default"){
+        default_type.assign(type.data(), type.size());
+        return true;
+    }
+    if (suffix.empty() || suffix[0] != '.' || type.empty())
+        return false;
+    uint64_t h = fold_hash(suffix);
+    for (int i = 0; i < EXTRA_SIZE; ++i){
+        ExtraEntry &e = extra_mime[(h + i) & (EXTRA_SIZE - 1)];
+        if (e.suffix.empty() || (e.hash == h && equal_fold(e.suffix, suffix))){
+            if (e.suffix.empty()){
+                if (extra_num >= MAX_EXTRA_MIME)
+                    return false;
+                ++extra_num;
+            }
+            e.hash = h;
+            e.suffix.assign(suffix.data(), suffix.size());
+            e.type.assign(type.data(), type.size());
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string_view MimeType::getMime(std::string_view suffix)
+{
+    uint64_t h = fold_hash(suffix);
+    // 配置里的条目可以覆盖内置的条目
+    if (extra_num > 0){
+        for (int i = 0; i < EXTRA_SIZE; ++i){
+            const ExtraEntry &e = extra_mime[(h + i) & (EXTRA_SIZE - 1)];
+            if (e.suffix.empty())
+                break;
+            if (e.hash == h && equal_fold(e.suffix, suffix))
+                return e.type;
+        }
+    }
+    int idx = builtin_table.index[slot_of(h, SEED)];
+    if (idx >= 0 && equal_fold(builtin_mime[idx].suffix, suffix))
+        return builtin_mime[idx].type;
+    return default_type;
+}
+
+std::string_view MimeType::fromFileName(std::string_view file_name)
+{
+    size_t dot_pos = file_name.rfind('.');
+    if (dot_pos == std::string_view::npos || file_name.find('/', dot_pos) != std::string_view::npos)
+        return default_type;
+    return getMime(file_name.substr(dot_pos));
+}
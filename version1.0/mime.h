@@ -0,0 +1,23 @@
+#ifndef MIME
+#define MIME
+#include <string_view>
+
+const int MAX_EXTRA_MIME = 64;   //配置文件里最多能追加的扩展名数量
+
+// 内置的扩展名表在编译期生成完美哈希，查找不加锁也不分配内存，
+// 返回的string_view指向静态存储，整个进程生命期内有效并且以'\0'结尾
+class MimeType
+{
+private:
+    MimeType();
+    MimeType(const MimeType &m);
+public:
+    // 只能在启动阶段(工作线程开始处理请求之前)调用，之后表是只读的
+    // suffix带点，例如".webp"；传"default"可以修改找不到时的默认类型
+    static bool add(std::string_view suffix, std::string_view type);
+    static std::string_view getMime(std::string_view suffix);
+    // 取文件名最后一个'.'之后的扩展名再查表，不产生临时字符串
+    static std::string_view fromFileName(std::string_view file_name);
+};
+
+#endif
@@ -0,0 +1,220 @@
+#include "prewarm.h"
+#include "config.h"
+#include "metrics.h"
+#include "bundle.h"
+#include "urlpath.h"
+#include "util.h"
+#include "vhost.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fstream>
+#include <string>
+#include <vector>
+using namespace std;
+
+const int PREWARM_MAX_DEPTH = 64;   //目录遍历的最大深度，每一层占一个描述符
+
+static long long warm_budget = 0;   //还能预热的字节数
+static long long lock_budget = 0;   //还能锁住的字节数，只对清单里的路径生效
+static long warm_files = 0;
+static long long warm_bytes = 0;
+static long long locked_bytes = 0;
+static long long warm_deadline = 0; //monotonic_ms，0表示不限时
+
+// 锁住映射里的一段，锁住的页一直留在内存里直到进程退出
+static void lock_range(const void *addr, size_t len)
+{
+    if (lock_budget <= 0 || len == 0)
+        return;
+    if ((long long)len > lock_budget)
+        len = lock_budget;
+    if (mlock(addr, len) < 0)
+    {
+        perror("prewarm mlock failed");
+        lock_budget = 0;
+        return;
+    }
+    lock_budget -= len;
+    locked_bytes += len;
+}
+
+static void warm_bundle_range(uint64_t offset, uint64_t length, bool hot)
+{
+    if (length == 0 || warm_budget <= 0)
+        return;
+    if ((long long)length > warm_budget)
+        length = warm_budget;
+    // 打包文件里每段内容都是页对齐的，可以直接madvise
+    const char *addr = (const char*)bundle_base() + offset;
+    readahead(bundle_fd(), offset, length);
+    madvise((void*)addr, length, MADV_WILLNEED);
+    if (hot)
+        lock_range(addr, length);
+    warm_budget -= length;
+    warm_bytes += length;
+}
+
+// 预热用完了总量，或者升级时到了期限
+static bool warm_stopped()
+{
+    return warm_budget <= 0 || (warm_deadline != 0 && monotonic_ms() >= warm_deadline);
+}
+
+// 预热一个已经打开的文件，fd由调用者关闭
+static void warm_fd(int fd, bool hot)
+{
+    struct stat sbuf;
+    if (fstat(fd, &sbuf) < 0 || !S_ISREG(sbuf.st_mode) || sbuf.st_size <= 0)
+        return;
+    long long len = sbuf.st_size < warm_budget ? sbuf.st_size : warm_budget;
+    readahead(fd, 0, len);
+    if (hot && lock_budget > 0)
+    {
+        // 只为了锁页建一个映射，之后不解除；文件被替换后锁住的是旧内容，下次启动时才会更新
+        void *addr = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+        if (addr != MAP_FAILED)
+            lock_range(addr, len);
+    }
+    warm_budget -= len;
+    warm_bytes += len;
+    ++warm_files;
+}
+
+// 清单里的一个文件名(已经规范化，相对docroot)，在每个站点的docroot下各预热一次
+static void warm_name(const vector<int> &roots, const string &name, bool hot)
+{
+    if (bundle_enabled())
+    {
+        const BundleEntry *entry = bundle_find(name);
+        if (entry != NULL)
+        {
+            for (int v = 0; v < BUNDLE_VARIANTS; ++v)
+                warm_bundle_range(entry->variants[v].offset, entry->variants[v].length, hot);
+            ++warm_files;
+        }
+    }
+    for (size_t i = 0; i < roots.size() && !warm_stopped(); ++i)
+    {
+        int fd = openat(roots[i], name.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        if (fd < 0)
+            continue;
+        warm_fd(fd, hot);
+        close(fd);
+    }
+}
+
+// 遍历dir_fd下的所有普通文件，不跟随符号链接；dir_fd在这里关闭
+static void warm_dir(int dir_fd, int depth)
+{
+    DIR *dir = fdopendir(dir_fd);
+    if (dir == NULL)
+    {
+        close(dir_fd);
+        return;
+    }
+    struct dirent *ent;
+    while (!warm_stopped() && (ent = readdir(dir)) != NULL)
+    {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+            continue;
+        struct stat sbuf;
+        if (fstatat(dirfd(dir), ent->d_name, &sbuf, AT_SYMLINK_NOFOLLOW) < 0)
+            continue;
+        if (S_ISDIR(sbuf.st_mode) && depth < PREWARM_MAX_DEPTH)
+        {
+            int sub = openat(dirfd(dir), ent->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            if (sub >= 0)
+                warm_dir(sub, depth + 1);
+        }
+        else if (S_ISREG(sbuf.st_mode))
+        {
+            int fd = openat(dirfd(dir), ent->d_name, O_RDONLY | O_NONBLOCK | O_NOFOLLOW | O_CLOEXEC);
+            if (fd < 0)
+                continue;
+            warm_fd(fd, false);
+            close(fd);
+        }
+    }
+    closedir(dir);
+}
+
+void prewarm_run(long long deadline_ms)
+{
+    const ServerConfig &config = config_get();
+    const string &target = config.prewarm;
+    if (target.empty())
+        return;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    warm_budget = (long long)config.prewarm_max_mb << 20;
+    lock_budget = (long long)config.prewarm_mlock_mb << 20;
+    warm_deadline = deadline_ms;
+
+    // 打包文件代替了默认站点的docroot，只有虚拟主机的目录要openat
+    vector<int> roots;
+    if (!bundle_enabled())
+        roots.push_back(docroot_fd());
+    vhost_roots(roots);
+
+    // 清单和其他配置文件一样按当前目录找；不是普通文件就当作目录
+    struct stat sbuf;
+    if (stat(target.c_str(), &sbuf) == 0 && S_ISREG(sbuf.st_mode))
+    {
+        ifstream manifest(target.c_str());
+        string line, name;
+        while (!warm_stopped() && getline(manifest, line))
+        {
+            size_t begin = line.find_first_not_of(" \t");
+            size_t last = line.find_last_not_of(" \t\r");
+            if (begin == string::npos || line[begin] == '#')
+                continue;
+            string raw = line.substr(begin, last - begin + 1);
+            if (raw[0] != '/')
+                raw.insert(0, 1, '/');
+            if (url_normalize(raw, name))
+                warm_name(roots, name, true);
+        }
+    }
+    else
+    {
+        if (bundle_enabled())
+        {
+            // 目录模式下打包文件整体预热，它本身就是整个docroot
+            warm_bundle_range(0, bundle_size(), false);
+            warm_files = 1;
+        }
+        if (target[0] != '/')
+        {
+            for (size_t i = 0; i < roots.size() && !warm_stopped(); ++i)
+            {
+                int fd = openat(roots[i], target.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                if (fd >= 0)
+                    warm_dir(fd, 0);
+            }
+        }
+        else if (!bundle_enabled())
+        {
+            int fd = open(target.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (fd < 0)
+                perror("prewarm open failed");
+            else
+                warm_dir(fd, 0);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    long elapsed_ms = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
+    server_metrics.prewarm_files = warm_files;
+    server_metrics.prewarm_bytes = warm_bytes;
+    server_metrics.prewarm_locked_bytes = locked_bytes;
+    server_metrics.prewarm_ms = elapsed_ms;
+    printf("prewarm %s: %ld files, %lld bytes (%lld locked) in %ld ms%s\n",
+           target.c_str(), warm_files, warm_bytes, locked_bytes, elapsed_ms,
+           warm_deadline != 0 && monotonic_ms() >= warm_deadline ? ", stopped at the upgrade deadline" : "");
+}
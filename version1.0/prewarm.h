@@ -0,0 +1,18 @@
+#ifndef PREWARM
+#define PREWARM
+
+/* 启动预热：重启或者升级之后页缓存是冷的，前几分钟的请求都要在工作线程里等磁盘。
+   开始accept之前按配置把文件读进页缓存：
+       prewarm <目录>      遍历目录，stat每个文件(填充dentry/inode缓存)并readahead内容；
+                           相对路径在docroot和每个虚拟主机的docroot下各找一次，"."就是整个站点
+       prewarm <清单文件>   每行一个热点的请求路径，按从热到冷的顺序排列，和请求一样规范化后
+                           在docroot和每个虚拟主机的docroot下用openat打开，不受当前目录影响
+   配置了bundle时默认站点的路径在打包文件里查找，对映射做MADV_WILLNEED。
+   prewarm_max_mb限制预热的总量，prewarm_mlock_mb把清单里最热的那部分锁在内存里(需要RLIMIT_MEMLOCK允许)。
+   升级时新进程先预热再通知旧进程，旧进程在epoll里等通知，预热期间继续服务；
+   这时预热最多用UPGRADE_PREWARM_MAX毫秒，没做完的留给页缓存按需加载，免得旧进程等不及把新进程杀掉 */
+
+// 执行预热并打印耗时和字节数，没有配置prewarm时什么都不做；deadline_ms(monotonic_ms)不为0时到点就停
+void prewarm_run(long long deadline_ms);
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef PROBES
+#define PROBES
+
+/* USDT静态探针：编译环境有<sys/sdt.h>(systemtap-sdt-dev)时每个探针只是一条nop加一段ELF note，
+   没有挂载的时候几乎不占开销；perf/bpftrace可以直接按名字挂上去，不用猜函数符号，也不用重新编译。
+   provider是sws，探针和参数：
+       accept(fd, 客户端IPv4地址(主机字节序), 是否HTTPS)
+       enqueue(fd, 请求对象)         事件交给线程池
+       dequeue(fd, 请求对象)         工作线程开始处理
+       parse_done(fd, method, uri)   请求头解析完，method 1是POST 2是GET
+       response_start(fd, status, bytes)
+       response_end(fd, status, bytes)   一个请求结束，出错时status可能为0
+       timer_expire(fd, 到期时间(毫秒))  连接被定时器关闭
+       conn_close(fd, state)
+   例如统计每个状态码的响应字节数：
+       bpftrace -e 'usdt:./simpleServerWeb:sws:response_end { @[arg1] = sum(arg2); }'
+   没有<sys/sdt.h>或者定义了NO_USDT时探针全部展开为空 */
+
+#if !defined(NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define SWS_PROBE1(name, a) DTRACE_PROBE1(sws, name, a)
+#define SWS_PROBE2(name, a, b) DTRACE_PROBE2(sws, name, a, b)
+#define SWS_PROBE3(name, a, b, c) DTRACE_PROBE3(sws, name, a, b, c)
+#endif
+#endif
+
+#ifndef SWS_PROBE1
+#define SWS_PROBE1(name, a) do {} while (0)
+#define SWS_PROBE2(name, a, b) do {} while (0)
+#define SWS_PROBE3(name, a, b, c) do {} while (0)
+#endif
+
+#endif
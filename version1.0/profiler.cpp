@@ -0,0 +1,158 @@
+#include "profiler.h"
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <execinfo.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/time.h>
+#include <atomic>
+#include <map>
+#include <vector>
+using namespace std;
+
+// 前两帧是信号处理函数自己和内核安排的信号返回跳板
+const int PROFILE_SKIP_FRAMES = 2;
+
+struct ProfileSample
+{
+    char thread[16];
+    int depth;
+    void *frames[PROFILE_MAX_DEPTH];
+};
+
+static std::atomic<bool> running(false);    //有一次剖析在进行，同时只允许一次
+static std::atomic<bool> sampling(false);   //信号处理函数只在这个为true时记录
+static std::atomic<int> sample_count(0);
+static ProfileSample *samples = NULL;       //第一次剖析时分配，之后一直保留，迟到的信号不会写到释放掉的内存
+
+// 只调用异步信号安全的函数；backtrace在第一次调用时会加载libgcc，初始化时已经预先调用过
+static void on_sigprof(int, siginfo_t *, void *)
+{
+    if (!sampling.load(std::memory_order_relaxed))
+        return;
+    int saved_errno = errno;
+    int index = sample_count.fetch_add(1, std::memory_order_relaxed);
+    if (index < PROFILE_MAX_SAMPLES)
+    {
+        ProfileSample &sample = samples[index];
+        prctl(PR_GET_NAME, sample.thread, 0, 0, 0);
+        sample.depth = backtrace(sample.frames, PROFILE_MAX_DEPTH);
+    }
+    errno = saved_errno;
+}
+
+static bool profiler_init()
+{
+    samples = (ProfileSample*)calloc(PROFILE_MAX_SAMPLES, sizeof(ProfileSample));
+    if (samples == NULL)
+        return false;
+    void *warm[1];
+    backtrace(warm, 1);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = on_sigprof;
+    sa.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    return sigaction(SIGPROF, &sa, NULL) == 0;
+}
+
+// 返回地址指向call的下一条指令，减一之后才落在调用点所在的函数里
+static const string &symbolize(void *addr, bool leaf, map<void*, string> &cache)
+{
+    map<void*, string>::iterator it = cache.find(addr);
+    if (it != cache.end())
+        return it->second;
+    void *lookup = leaf ? addr : (void*)((char*)addr - 1);
+    string name;
+    Dl_info info;
+    memset(&info, 0, sizeof(info));
+    if (dladdr(lookup, &info) && info.dli_sname != NULL)
+    {
+        int status = 0;
+        char *demangled = abi::__cxa_demangle(info.dli_sname, NULL, NULL, &status);
+        name = status == 0 && demangled != NULL ? demangled : info.dli_sname;
+        free(demangled);
+    }
+    else if (info.dli_fname != NULL)
+    {
+        const char *base = strrchr(info.dli_fname, '/');
+        char offset[32];
+        snprintf(offset, sizeof(offset), "+0x%lx", (unsigned long)((char*)lookup - (char*)info.dli_fbase));
+        name = string(base != NULL ? base + 1 : info.dli_fname) + offset;
+    }
+    else
+    {
+        char raw[32];
+        snprintf(raw, sizeof(raw), "%p", addr);
+        name = raw;
+    }
+    return cache[addr] = name;
+}
+
+bool profiler_run(int seconds, string &out)
+{
+    bool expected = false;
+    if (!running.compare_exchange_strong(expected, true))
+        return false;
+    if (samples == NULL && !profiler_init())
+    {
+        running = false;
+        return false;
+    }
+    if (seconds <= 0)
+        seconds = PROFILE_DEFAULT_SECONDS;
+    if (seconds > PROFILE_MAX_SECONDS)
+        seconds = PROFILE_MAX_SECONDS;
+
+    sample_count = 0;
+    sampling = true;
+    struct itimerval timer;
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = 1000000 / PROFILE_HZ;
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_PROF, &timer, NULL);
+
+    // 这个工作线程只是睡着等，自己不会出现在采样里
+    struct timespec left = {seconds, 0};
+    while (nanosleep(&left, &left) < 0 && errno == EINTR)
+        ;
+
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, NULL);
+    sampling = false;
+    usleep(10000);  //等已经进入处理函数的信号写完
+
+    int total = sample_count.load();
+    int kept = total < PROFILE_MAX_SAMPLES ? total : PROFILE_MAX_SAMPLES;
+    map<string, long> folded;
+    map<void*, string> symbols;
+    string stack;
+    for (int i = 0; i < kept; ++i)
+    {
+        const ProfileSample &sample = samples[i];
+        stack = sample.thread[0] != '\0' ? sample.thread : "unknown";
+        for (int f = sample.depth - 1; f >= PROFILE_SKIP_FRAMES; --f)
+        {
+            stack += ';';
+            stack += symbolize(sample.frames[f], f == PROFILE_SKIP_FRAMES, symbols);
+        }
+        ++folded[stack];
+    }
+    for (map<string, long>::iterator it = folded.begin(); it != folded.end(); ++it)
+    {
+        out += it->first;
+        out += ' ';
+        out += to_string(it->second);
+        out += '\n';
+    }
+    if (total > kept)
+        out += "# dropped " + to_string(total - kept) + " samples\n";
+    running = false;
+    return true;
+}
@@ -0,0 +1,20 @@
+#ifndef PROFILER
+#define PROFILER
+#include <string>
+
+/* 按需的CPU采样剖析：GET <admin_prefix>/profile/<秒数> 在这段时间里用ITIMER_PROF按进程消耗的CPU时间
+   每PROFILE_HZ分之一秒打断一次正在跑的线程(主循环、工作线程、IO线程都算)，在信号处理函数里记下调用栈，
+   结束后按"线程名;外层函数;...;内层函数 次数"的折叠格式返回，可以直接交给flamegraph.pl。
+   没有在剖析时不设定时器，不产生任何开销；采样数超过PROFILE_MAX_SAMPLES后丢弃。
+   要看到函数名需要链接时加-rdynamic，否则只能显示模块和偏移 */
+
+const int PROFILE_HZ = 99;
+const int PROFILE_DEFAULT_SECONDS = 5;
+const int PROFILE_MAX_SECONDS = 60;
+const int PROFILE_MAX_DEPTH = 32;
+const int PROFILE_MAX_SAMPLES = 32768;
+
+// 采样seconds秒，把折叠后的调用栈写到out；已经有一次剖析在进行时返回false
+bool profiler_run(int seconds, std::string &out);
+
+#endif
@@ -0,0 +1,794 @@
+#include "proxy.h"
+#include "config.h"
+#include "metrics.h"
+#include "microcache.h"
+#include "requestData.h"
+#include "util.h"
+#include <errno.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <atomic>
+using namespace std;
+
+struct UpstreamServer
+{
+    string addr;                    //配置里写的地址，用于日志和管理接口
+    struct sockaddr_storage sa;
+    socklen_t sa_len;
+    atomic<int> active{0};          //正在转发的请求数，least_conn按它选
+    atomic<int> fails{0};           //连续失败的次数
+    atomic<long> retry_at{0};       //被摘掉之后下一次可以试探的时间(毫秒)
+    pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+    vector<int> idle_fds;           //连接池里的空闲连接
+};
+
+struct UpstreamGroup
+{
+    string name;
+    int policy;
+    vector<UpstreamServer*> servers;
+    atomic<unsigned> next{0};       //轮询的起点
+};
+
+struct ProxyRoute
+{
+    string prefix;
+    UpstreamGroup *group;
+};
+
+// 启动时建好之后只读，不需要加锁
+static vector<UpstreamGroup*> upstream_groups;
+static vector<ProxyRoute> proxy_routes;     //按前缀从长到短排列，先匹配最长的
+
+static long now_ms()
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return now.tv_sec * 1000 + now.tv_usec / 1000;
+}
+
+static bool parse_server_addr(const string &addr, UpstreamServer *server)
+{
+    memset(&server->sa, 0, sizeof(server->sa));
+    if (addr.compare(0, 5, "unix:") == 0)
+    {
+        string path = addr.substr(5);
+        struct sockaddr_un *un = (struct sockaddr_un*)&server->sa;
+        if (path.empty() || path.size() >= sizeof(un->sun_path))
+            return false;
+        un->sun_family = AF_UNIX;
+        memcpy(un->sun_path, path.c_str(), path.size() + 1);
+        server->sa_len = offsetof(struct sockaddr_un, sun_path) + path.size() + 1;
+        return true;
+    }
+    size_t colon = addr.rfind(':');
+    if (colon == string::npos || colon == 0 || colon + 1 == addr.size())
+        return false;
+    string host = addr.substr(0, colon);
+    string port = addr.substr(colon + 1);
+    if (host.size() > 2 && host[0] == '[' && host.back() == ']')
+        host = host.substr(1, host.size() - 2);
+    struct addrinfo hints, *res = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICSERV;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0 || res == NULL)
+        return false;
+    memcpy(&server->sa, res->ai_addr, res->ai_addrlen);
+    server->sa_len = res->ai_addrlen;
+    freeaddrinfo(res);
+    return true;
+}
+
+bool proxy_add_upstream(const string &name, const string &policy, const vector<string> &servers)
+{
+    int balance;
+    if (policy == "round_robin")
+        balance = PROXY_BALANCE_ROUND_ROBIN;
+    else if (policy == "least_conn")
+        balance = PROXY_BALANCE_LEAST_CONN;
+    else
+        return false;
+    if (servers.empty())
+        return false;
+    for (size_t i = 0; i < upstream_groups.size(); ++i)
+        if (upstream_groups[i]->name == name)
+            return false;
+
+    UpstreamGroup *group = new UpstreamGroup;
+    group->name = name;
+    group->policy = balance;
+    for (size_t i = 0; i < servers.size(); ++i)
+    {
+        UpstreamServer *server = new UpstreamServer;
+        server->addr = servers[i];
+        if (!parse_server_addr(servers[i], server))
+        {
+            fprintf(stderr, "invalid upstream address '%s'\n", servers[i].c_str());
+            return false;
+        }
+        group->servers.push_back(server);
+    }
+    upstream_groups.push_back(group);
+    return true;
+}
+
+bool proxy_add_route(const string &prefix, const string &name)
+{
+    if (prefix.empty() || prefix[0] != '/')
+        return false;
+    UpstreamGroup *group = NULL;
+    for (size_t i = 0; i < upstream_groups.size(); ++i)
+        if (upstream_groups[i]->name == name)
+            group = upstream_groups[i];
+    if (group == NULL)
+        return false;
+    ProxyRoute route;
+    route.prefix = prefix;
+    if (route.prefix.size() > 1 && route.prefix.back() == '/')
+        route.prefix.pop_back();
+    route.group = group;
+    vector<ProxyRoute>::iterator it = proxy_routes.begin();
+    while (it != proxy_routes.end() && it->prefix.size() >= route.prefix.size())
+        ++it;
+    proxy_routes.insert(it, route);
+    return true;
+}
+
+UpstreamGroup *proxy_match(string_view path)
+{
+    for (size_t i = 0; i < proxy_routes.size(); ++i)
+    {
+        const string &prefix = proxy_routes[i].prefix;
+        if (path.compare(0, prefix.size(), prefix) != 0)
+            continue;
+        // 前缀要落在路径分段的边界上，/api不匹配/apix
+        if (prefix.size() == 1 || path.size() == prefix.size() || path[prefix.size()] == '/' || path[prefix.size()] == '?')
+            return proxy_routes[i].group;
+    }
+    return NULL;
+}
+
+void proxy_dump(string &out)
+{
+    long now = now_ms();
+    for (size_t i = 0; i < upstream_groups.size(); ++i)
+    {
+        UpstreamGroup *group = upstream_groups[i];
+        for (size_t j = 0; j < group->servers.size(); ++j)
+        {
+            UpstreamServer *server = group->servers[j];
+            pthread_mutex_lock(&server->pool_lock);
+            size_t idle = server->idle_fds.size();
+            pthread_mutex_unlock(&server->pool_lock);
+            bool down = server->fails >= PROXY_MAX_FAILS && now < server->retry_at;
+            out += group->name + ' ' + server->addr + " active=" + to_string(server->active)
+                 + " idle=" + to_string(idle) + " fails=" + to_string(server->fails)
+                 + (down ? " down\n" : " up\n");
+        }
+    }
+}
+
+// 连续失败达到上限后摘掉，之后每次试探失败都会再往后推迟
+static void server_failed(UpstreamServer *server)
+{
+    int fails = ++server->fails;
+    if (fails >= PROXY_MAX_FAILS)
+    {
+        server->retry_at = now_ms() + PROXY_FAIL_TIMEOUT;
+        if (fails == PROXY_MAX_FAILS)
+        {
+            ++server_metrics.proxy_ejections;
+            fprintf(stderr, "upstream %s ejected after %d failures\n", server->addr.c_str(), fails);
+        }
+    }
+}
+
+// 选一个后端，tried里的是这次请求已经失败过的；被摘掉的后端到了试探时间只放一个请求过去
+static UpstreamServer *pick_server(UpstreamGroup *group, const vector<UpstreamServer*> &tried)
+{
+    long now = now_ms();
+    size_t n = group->servers.size();
+    unsigned start = group->next++;
+    UpstreamServer *best = NULL;
+    for (size_t i = 0; i < n; ++i)
+    {
+        UpstreamServer *server = group->servers[(start + i) % n];
+        bool skip = false;
+        for (size_t j = 0; j < tried.size(); ++j)
+            if (tried[j] == server)
+                skip = true;
+        if (skip)
+            continue;
+        if (server->fails >= PROXY_MAX_FAILS)
+        {
+            long retry_at = server->retry_at;
+            if (now >= retry_at && server->retry_at.compare_exchange_strong(retry_at, now + PROXY_FAIL_TIMEOUT))
+                return server;
+            continue;
+        }
+        if (group->policy == PROXY_BALANCE_ROUND_ROBIN)
+            return server;
+        if (best == NULL || server->active < best->active)
+            best = server;
+    }
+    return best;
+}
+
+// 后端在请求还没发完时就有了响应(或者关闭了连接)
+static bool upstream_readable(int fd)
+{
+    char c;
+    return !(recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) < 0 && errno == EAGAIN);
+}
+
+// 从连接池里取一个空闲连接，空闲期间被后端关掉的直接丢弃
+static int pool_take(UpstreamServer *server)
+{
+    while (true)
+    {
+        pthread_mutex_lock(&server->pool_lock);
+        if (server->idle_fds.empty())
+        {
+            pthread_mutex_unlock(&server->pool_lock);
+            return -1;
+        }
+        int fd = server->idle_fds.back();
+        server->idle_fds.pop_back();
+        pthread_mutex_unlock(&server->pool_lock);
+        char c;
+        if (recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) < 0 && errno == EAGAIN)
+            return fd;
+        close(fd);
+    }
+}
+
+static void pool_put(UpstreamServer *server, int fd)
+{
+    pthread_mutex_lock(&server->pool_lock);
+    if (server->idle_fds.size() < (size_t)PROXY_MAX_IDLE)
+    {
+        server->idle_fds.push_back(fd);
+        fd = -1;
+    }
+    pthread_mutex_unlock(&server->pool_lock);
+    if (fd >= 0)
+        close(fd);
+}
+
+// 连接一个后端，结果是连好的描述符，失败时是CO_ERROR或者CO_TIMEOUT
+static CoTask connect_server(CoRequest &req, UpstreamServer *server)
+{
+    int fd = socket(server->sa.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        co_return CO_ERROR;
+    if (server->sa.ss_family != AF_UNIX)
+    {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    ssize_t ret = co_await co_connect(req, fd, (struct sockaddr*)&server->sa, server->sa_len, PROXY_CONNECT_TIMEOUT);
+    if (ret < 0)
+    {
+        int err = ret == CO_TIMEOUT ? ETIMEDOUT : errno;
+        close(fd);
+        errno = err;
+        co_return ret;
+    }
+    co_return fd;
+}
+
+// 把n个字节写给后端，成功返回0；后端在请求还没写完时就开始回响应(比如直接拒绝了正文)返回1
+static CoTask upstream_write(CoRequest &req, int fd, const char *buff, size_t n)
+{
+    while (n > 0)
+    {
+        ssize_t nwritten = send(fd, buff, n, MSG_NOSIGNAL);
+        if (nwritten > 0)
+        {
+            buff += nwritten;
+            n -= nwritten;
+            continue;
+        }
+        if (nwritten < 0 && errno == EINTR)
+            continue;
+        if (nwritten < 0 && errno == EAGAIN)
+        {
+            if (co_await co_wait(req, fd, EPOLLOUT | EPOLLIN, PROXY_IO_TIMEOUT) == CO_TIMEOUT)
+                co_return -1;
+            if (upstream_readable(fd))
+                co_return 1;
+            continue;
+        }
+        co_return -1;
+    }
+    co_return 0;
+}
+
+// chunked编码只用来判断正文在哪里结束，内容本身原样转发给客户端
+enum ChunkState
+{
+    chunk_size = 0,
+    chunk_ext,
+    chunk_size_LF,
+    chunk_data,
+    chunk_data_CR,
+    chunk_data_LF,
+    chunk_trailer_start,
+    chunk_trailer,
+    chunk_end_LF
+};
+
+struct ChunkTracker
+{
+    int state = chunk_size;
+    long size = 0;
+    int digits = 0;
+    bool done = false;
+    bool error = false;
+
+    // 返回属于这个响应的字节数，done之后的字节不属于这个响应
+    size_t feed(const char *p, size_t n)
+    {
+        size_t i = 0;
+        while (i < n && !done && !error)
+        {
+            char c = p[i];
+            switch (state)
+            {
+                case chunk_size:{
+                    int value = -1;
+                    if (c >= '0' && c <= '9')
+                        value = c - '0';
+                    else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+                        value = (c | 0x20) - 'a' + 10;
+                    if (value >= 0 && digits < 15)
+                    {
+                        size = size * 16 + value;
+                        ++digits;
+                    }
+                    else if (digits > 0 && (c == ';' || c == ' ' || c == '\t'))
+                        state = chunk_ext;
+                    else if (digits > 0 && c == '\r')
+                        state = chunk_size_LF;
+                    else
+                        error = true;
+                    ++i;
+                    break;
+                }
+                case chunk_ext:{
+                    if (c == '\r')
+                        state = chunk_size_LF;
+                    ++i;
+                    break;
+                }
+                case chunk_size_LF:{
+                    if (c != '\n')
+                        error = true;
+                    state = size == 0 ? chunk_trailer_start : chunk_data;
+                    ++i;
+                    break;
+                }
+                case chunk_data:{
+                    size_t take = n - i < (size_t)size ? n - i : (size_t)size;
+                    i += take;
+                    size -= take;
+                    if (size == 0)
+                        state = chunk_data_CR;
+                    break;
+                }
+                case chunk_data_CR:{
+                    if (c != '\r')
+                        error = true;
+                    state = chunk_data_LF;
+                    ++i;
+                    break;
+                }
+                case chunk_data_LF:{
+                    if (c != '\n')
+                        error = true;
+                    state = chunk_size;
+                    digits = 0;
+                    ++i;
+                    break;
+                }
+                case chunk_trailer_start:{
+                    state = c == '\r' ? chunk_end_LF : chunk_trailer;
+                    ++i;
+                    break;
+                }
+                case chunk_trailer:{
+                    if (c == '\n')
+                        state = chunk_trailer_start;
+                    ++i;
+                    break;
+                }
+                case chunk_end_LF:{
+                    if (c != '\n')
+                        error = true;
+                    done = true;
+                    ++i;
+                    break;
+                }
+            }
+        }
+        return i;
+    }
+};
+
+static bool name_equals(string_view a, const char *b)
+{
+    return a.size() == strlen(b) && strncasecmp(a.data(), b, a.size()) == 0;
+}
+
+static bool value_contains(string_view value, const char *token)
+{
+    size_t len = strlen(token);
+    for (size_t i = 0; i + len <= value.size(); ++i)
+        if (strncasecmp(value.data() + i, token, len) == 0)
+            return true;
+    return false;
+}
+
+ProxyExchange::ProxyExchange(UpstreamGroup *_group):
+    group(_group), server(NULL), upstream_fd(-1), reused(false), reusable(false),
+    request_complete(false), head_len(0), status(0), chunked(false), content_length(-1)
+{
+}
+
+ProxyExchange::~ProxyExchange()
+{
+    dropUpstream(false);
+}
+
+// 交还后端连接：响应完整结束而且后端同意保持连接时放回连接池，否则关闭
+void ProxyExchange::dropUpstream(bool failed)
+{
+    if (upstream_fd < 0)
+        return;
+    if (failed)
+        server_failed(server);
+    if (!failed && reusable && request_complete)
+        pool_put(server, upstream_fd);
+    else
+        close(upstream_fd);
+    --server->active;
+    upstream_fd = -1;
+    reusable = false;
+}
+
+CoTask ProxyExchange::connectUpstream(CoRequest &req)
+{
+    vector<UpstreamServer*> tried;
+    for (size_t attempt = 0; attempt < group->servers.size(); ++attempt)
+    {
+        UpstreamServer *next = pick_server(group, tried);
+        if (next == NULL)
+            break;
+        tried.push_back(next);
+        ++next->active;
+        int fd = pool_take(next);
+        reused = fd >= 0;
+        if (fd < 0)
+            fd = (int)co_await connect_server(req, next);
+        if (fd >= 0)
+        {
+            server = next;
+            upstream_fd = fd;
+            if (reused)
+                ++server_metrics.proxy_pool_reused;
+            co_return 1;
+        }
+        perror(("connect upstream " + next->addr).c_str());
+        --next->active;
+        server_failed(next);
+    }
+    co_return 0;
+}
+
+CoTask ProxyExchange::sendRequest(CoRequest &req, const string &request_head,
+                                  string_view body_prefix, long body_remaining, bool &consumed)
+{
+    // 请求头和已经读到的正文一起发
+    string first(request_head);
+    first.append(body_prefix.data(), body_prefix.size());
+    ssize_t ret = co_await upstream_write(req, upstream_fd, first.data(), first.size());
+    if (ret < 0)
+        co_return PROXY_BAD_GATEWAY;
+
+    if (req.deadline_ms == 0)
+        req.deadline_ms = monotonic_ms() + config_get().body_timeout;
+    char buff[PROXY_BUFF];
+    while (ret == 0 && body_remaining > 0)
+    {
+        consumed = true;
+        size_t want = body_remaining < PROXY_BUFF ? body_remaining : PROXY_BUFF;
+        errno = 0;
+        ssize_t nread = req.io.readn(buff, want);
+        if (nread > 0)
+        {
+            const ServerConfig &config = config_get();
+            if (config.body_min_rate > 0)
+                req.deadline_ms += (long long)nread * 1000 / config.body_min_rate;
+            body_remaining -= nread;
+            ret = co_await upstream_write(req, upstream_fd, buff, nread);
+            if (ret < 0)
+                co_return PROXY_BAD_GATEWAY;
+            continue;
+        }
+        if (nread < 0 || errno != EAGAIN)
+            co_return PROXY_CLIENT_ERROR;
+        // 客户端的数据还没到：后端已经提前回了响应就不再发正文，否则挂起等客户端，
+        // 每隔一会儿醒来再看一次后端
+        if (upstream_readable(upstream_fd))
+            break;
+        long long left = req.deadline_ms - monotonic_ms();
+        if (left <= 0)
+        {
+            ++server_metrics.body_timeouts;
+            co_return PROXY_CLIENT_ERROR;
+        }
+        co_await co_wait(req, req.io.fd, EPOLLIN, left < REQUEST_TIME_OUT ? (int)left : REQUEST_TIME_OUT);
+    }
+    request_complete = body_remaining == 0;
+    co_return PROXY_OK;
+}
+
+CoTask ProxyExchange::readResponseHead(CoRequest &req)
+{
+    char buff[PROXY_BUFF];
+    head.clear();
+    while (true)
+    {
+        size_t end = head.find("\r\n\r\n");
+        if (end == string::npos)
+        {
+            if (head.size() > (size_t)PROXY_MAX_HEADER)
+                co_return PROXY_BAD_GATEWAY;
+            ssize_t nread = co_await co_recv(req, upstream_fd, buff, sizeof(buff), PROXY_IO_TIMEOUT);
+            if (nread > 0)
+            {
+                head.append(buff, nread);
+                continue;
+            }
+            co_return nread == CO_TIMEOUT ? PROXY_GATEWAY_TIMEOUT : PROXY_BAD_GATEWAY;
+        }
+        head_len = end + 4;
+
+        // 状态行，例如 HTTP/1.1 200 OK
+        size_t line_end = head.find("\r\n");
+        if (head.compare(0, 5, "HTTP/") != 0 || line_end < 12 || head[8] != ' ')
+            co_return PROXY_BAD_GATEWAY;
+        status = atoi(head.c_str() + 9);
+        if (status < 100 || status > 999)
+            co_return PROXY_BAD_GATEWAY;
+        if (status < 200)
+        {
+            // 100 Continue之类的临时响应直接丢掉，101需要协议升级，不支持
+            if (status == 101)
+                co_return PROXY_BAD_GATEWAY;
+            head.erase(0, head_len);
+            continue;
+        }
+        bool upstream_keep_alive = head.compare(5, 3, "1.0") != 0;
+        status_line.assign(head, 0, line_end + 2);
+
+        pass_headers.clear();
+        chunked = false;
+        content_length = -1;
+        size_t pos = line_end + 2;
+        while (pos < head_len - 2)
+        {
+            size_t eol = head.find("\r\n", pos);
+            string_view line(head.data() + pos, eol - pos);
+            pos = eol + 2;
+            size_t colon = line.find(':');
+            if (colon == string_view::npos || colon == 0)
+                co_return PROXY_BAD_GATEWAY;
+            string_view name = line.substr(0, colon);
+            string_view value = line.substr(colon + 1);
+            // 逐跳首部不转发，客户端连接的Connection由我们自己决定
+            if (name_equals(name, "Connection"))
+            {
+                if (value_contains(value, "close"))
+                    upstream_keep_alive = false;
+                else if (value_contains(value, "keep-alive"))
+                    upstream_keep_alive = true;
+                continue;
+            }
+            if (name_equals(name, "Keep-Alive") || name_equals(name, "Proxy-Connection"))
+                continue;
+            if (name_equals(name, "Transfer-Encoding"))
+            {
+                if (!value_contains(value, "chunked"))
+                    co_return PROXY_BAD_GATEWAY;
+                chunked = true;
+            }
+            else if (name_equals(name, "Content-Length"))
+            {
+                while (!value.empty() && (value[0] == ' ' || value[0] == '\t'))
+                    value.remove_prefix(1);
+                char *num_end = NULL;
+                long length = strtol(string(value).c_str(), &num_end, 10);
+                if (value.empty() || length < 0 || (*num_end != '\0' && *num_end != ' ' && *num_end != '\t')
+                    || (content_length >= 0 && content_length != length))
+                    co_return PROXY_BAD_GATEWAY;
+                content_length = length;
+            }
+            pass_headers.append(line.data(), line.size());
+            pass_headers.append("\r\n");
+        }
+        // 两种长度同时出现时无法确定正文边界，按错误处理，避免请求走私
+        if (chunked && content_length >= 0)
+            co_return PROXY_BAD_GATEWAY;
+        reusable = upstream_keep_alive;
+        co_return PROXY_OK;
+    }
+}
+
+CoTask ProxyExchange::forward(CoRequest &req, const string &request_head,
+                              string_view body_prefix, long body_remaining)
+{
+    ++server_metrics.proxy_requests;
+    ssize_t ret = PROXY_BAD_GATEWAY;
+    // 从连接池取出来的连接可能刚好被后端关掉了，正文还没从客户端读走时换一个新连接重试一次
+    for (int attempt = 0; attempt < 2; ++attempt)
+    {
+        if (!co_await connectUpstream(req))
+        {
+            ret = PROXY_BAD_GATEWAY;
+            break;
+        }
+        bool consumed = false;
+        ret = co_await sendRequest(req, request_head, body_prefix, body_remaining, consumed);
+        if (ret == PROXY_OK)
+            ret = co_await readResponseHead(req);
+        if (ret == PROXY_OK)
+        {
+            server->fails = 0;
+            co_return PROXY_OK;
+        }
+        if (ret == PROXY_CLIENT_ERROR)
+        {
+            dropUpstream(false);
+            co_return ret;
+        }
+        bool stale = reused && head.empty() && ret == PROXY_BAD_GATEWAY;
+        dropUpstream(!stale);
+        if (!stale || consumed)
+            break;
+    }
+    ++server_metrics.proxy_errors;
+    co_return ret;
+}
+
+bool ProxyExchange::framed() const
+{
+    return status == 204 || status == 304 || chunked || content_length >= 0;
+}
+
+// Vary列出的首部都在缓存键里，"*"表示响应还取决于首部以外的东西
+static bool vary_covered(string_view value, const MicroRoute *route)
+{
+    while (!value.empty())
+    {
+        size_t comma = value.find(',');
+        string_view name = value.substr(0, comma);
+        value = comma == string_view::npos ? string_view() : value.substr(comma + 1);
+        while (!name.empty() && (name.front() == ' ' || name.front() == '\t'))
+            name.remove_prefix(1);
+        while (!name.empty() && (name.back() == ' ' || name.back() == '\t'))
+            name.remove_suffix(1);
+        if (name.empty())
+            continue;
+        if (name == "*" || !microcache_varies_on(route, name))
+            return false;
+    }
+    return true;
+}
+
+bool ProxyExchange::cacheable(size_t max_body, const MicroRoute *route) const
+{
+    if (status != 200 || chunked || content_length < 0 || (size_t)content_length > max_body)
+        return false;
+    size_t pos = 0;
+    while (pos < pass_headers.size())
+    {
+        size_t eol = pass_headers.find("\r\n", pos);
+        string_view line(pass_headers.data() + pos, eol - pos);
+        pos = eol + 2;
+        size_t colon = line.find(':');
+        string_view name = line.substr(0, colon);
+        string_view value = line.substr(colon + 1);
+        if (name_equals(name, "Set-Cookie"))
+            return false;
+        if (name_equals(name, "Cache-Control") &&
+            (value_contains(value, "private") || value_contains(value, "no-store") || value_contains(value, "no-cache")))
+            return false;
+        if (name_equals(name, "Vary") && !vary_covered(value, route))
+            return false;
+    }
+    return true;
+}
+
+CoTask ProxyExchange::relayBody(CoRequest &req, string *capture)
+{
+    string_view pending(head.data() + head_len, head.size() - head_len);
+    if (status == 204 || status == 304 || (!chunked && content_length == 0))
+    {
+        if (!pending.empty())
+            reusable = false;
+        co_return PROXY_OK;
+    }
+    // 没有长度信息的响应以后端关闭连接为结束
+    bool until_close = !framed();
+    if (until_close)
+        reusable = false;
+
+    ChunkTracker tracker;
+    long remaining = content_length;
+    char buff[PROXY_BUFF];
+    while (true)
+    {
+        if (!pending.empty())
+        {
+            size_t take = pending.size();
+            bool done = false;
+            if (chunked)
+            {
+                take = tracker.feed(pending.data(), pending.size());
+                if (tracker.error)
+                {
+                    dropUpstream(true);
+                    co_return PROXY_ABORTED;
+                }
+                done = tracker.done;
+            }
+            else if (!until_close)
+            {
+                if ((long)take > remaining)
+                    take = remaining;
+                remaining -= take;
+                done = remaining == 0;
+            }
+            if (co_await co_write(req, pending.data(), take) != (ssize_t)take)
+            {
+                dropUpstream(false);
+                co_return PROXY_CLIENT_ERROR;
+            }
+            if (capture != NULL)
+                capture->append(pending.data(), take);
+            if (done)
+            {
+                // 后端在响应之后多发了数据，连接的状态已经不可信
+                if (take < pending.size())
+                    reusable = false;
+                co_return PROXY_OK;
+            }
+            pending = string_view();
+        }
+
+        ssize_t nread = co_await co_recv(req, upstream_fd, buff, sizeof(buff), PROXY_IO_TIMEOUT);
+        if (nread > 0)
+        {
+            pending = string_view(buff, nread);
+            continue;
+        }
+        if (nread == 0 && until_close)
+            co_return PROXY_OK;
+        dropUpstream(true);
+        ++server_metrics.proxy_errors;
+        co_return PROXY_ABORTED;
+    }
+}
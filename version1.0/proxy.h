@@ -0,0 +1,91 @@
+#ifndef PROXY
+#define PROXY
+#include <string>
+#include <string_view>
+#include <vector>
+#include "coroutine.h"
+
+/* 反向代理：配置里用upstream定义一组后端(TCP地址或者unix:开头的Unix域socket)，
+   用proxy_pass把一个路径前缀转发给它，例如
+       upstream app least_conn 127.0.0.1:9000 unix:/run/app.sock
+       proxy_pass /api app
+   和后端之间的连接用完放回连接池，下一个请求直接复用；
+   连续失败PROXY_MAX_FAILS次的后端会被摘掉PROXY_FAIL_TIMEOUT毫秒，之后再放一个请求去试探。
+   请求正文和响应正文都是边收边转发，不会整个缓存在内存里。
+   转发跑在请求的协程处理函数里，等后端连接、后端响应或者客户端收发时挂起，不占工作线程 */
+
+const int PROXY_BALANCE_ROUND_ROBIN = 0;
+const int PROXY_BALANCE_LEAST_CONN = 1;
+
+const int PROXY_MAX_FAILS = 3;              //连续失败这么多次后把后端摘掉
+const int PROXY_FAIL_TIMEOUT = 10000;       //摘掉的后端过多久(毫秒)再重新试探
+const int PROXY_CONNECT_TIMEOUT = 3000;     //连接后端的超时(毫秒)
+const int PROXY_IO_TIMEOUT = 60000;         //和后端之间一次读写等待的最长时间(毫秒)
+const int PROXY_MAX_IDLE = 32;              //每个后端最多保留的空闲连接数
+const int PROXY_MAX_HEADER = 8192;          //后端响应头的最大长度
+const int PROXY_BUFF = 16384;
+
+const int PROXY_OK = 0;
+const int PROXY_CLIENT_ERROR = -1;          //客户端出错或者断开
+const int PROXY_BAD_GATEWAY = -2;           //后端连不上或者返回了无法解析的响应，还没有向客户端发送任何内容
+const int PROXY_GATEWAY_TIMEOUT = -3;       //后端超时没有响应，还没有向客户端发送任何内容
+const int PROXY_ABORTED = -4;               //转发正文的途中后端出错，只能断开客户端
+
+struct UpstreamGroup;
+struct UpstreamServer;
+struct MicroRoute;
+
+// 配置文件里的upstream/proxy_pass，只能在启动时调用
+bool proxy_add_upstream(const std::string &name, const std::string &policy, const std::vector<std::string> &servers);
+bool proxy_add_route(const std::string &prefix, const std::string &name);
+// 按路径前缀找转发的后端组，path是请求行里带'/'的原始路径，不转发时返回NULL
+UpstreamGroup *proxy_match(std::string_view path);
+// 每个后端当前的状态，给管理接口用
+void proxy_dump(std::string &out);
+
+// 一次转发：选后端、发请求、收响应头、转发响应正文，析构时把后端连接放回连接池或者关闭
+class ProxyExchange
+{
+private:
+    UpstreamGroup *group;
+    UpstreamServer *server;
+    int upstream_fd;
+    bool reused;                //后端连接是从连接池里取的
+    bool reusable;              //响应结束后后端连接还能放回连接池
+    bool request_complete;      //客户端的请求正文已经全部读完
+    std::string head;           //后端响应头，以及头后面已经读到的正文
+    size_t head_len;
+    std::string status_line;
+    std::string pass_headers;   //去掉逐跳首部后原样转发给客户端的首部
+    int status;
+    bool chunked;
+    long content_length;        //-1表示没有Content-Length
+
+    CoTask connectUpstream(CoRequest &req);
+    void dropUpstream(bool failed);
+    CoTask sendRequest(CoRequest &req, const std::string &request_head,
+                       std::string_view body_prefix, long body_remaining, bool &consumed);
+    CoTask readResponseHead(CoRequest &req);
+
+public:
+    explicit ProxyExchange(UpstreamGroup *_group);
+    ~ProxyExchange();
+    // 下面两个都要在req的协程里co_await，结果是PROXY_OK或者错误码
+    // 把请求头和正文发给后端并读出响应头；body_prefix是已经从客户端读到的正文，
+    // 还有body_remaining字节要从客户端继续读
+    CoTask forward(CoRequest &req, const std::string &request_head,
+                   std::string_view body_prefix, long body_remaining);
+    // 响应的状态行和可以原样转发的首部(都以\r\n结尾)，在对象析构前有效
+    std::string_view statusLine() const { return status_line; }
+    std::string_view headers() const { return pass_headers; }
+    // 响应正文有明确的结束位置，客户端连接可以继续保持
+    bool framed() const;
+    bool requestComplete() const { return request_complete; }
+    // 响应可以放进route的微缓存：带Content-Length的200，没有Set-Cookie，Cache-Control不是private/no-store/no-cache，
+    // Vary不是*，列出的首部都在route的vary里
+    bool cacheable(size_t max_body, const MicroRoute *route) const;
+    // capture不为NULL时转发出去的正文同时追加到它后面
+    CoTask relayBody(CoRequest &req, std::string *capture = NULL);
+};
+
+#endif
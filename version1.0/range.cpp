@@ -0,0 +1,99 @@
+#include "range.h"
+#include <algorithm>
+#include <cctype>
+
+// 解析一个非负十进制数，成功返回读到的位数
+static int parse_off(const std::string &s, size_t pos, size_t end, off_t &out)
+{
+    int digits = 0;
+    out = 0;
+    while (pos < end && isdigit((unsigned char)s[pos])){
+        if (out > (off_t)(0x7fffffffffffffffLL / 10 - 10))//防止溢出
+            return -1;
+        out = out * 10 + (s[pos] - '0');
+        ++pos;
+        ++digits;
+    }
+    return digits;
+}
+
+int parse_range(const std::string &value, off_t file_size, std::vector<ByteRange> &ranges)
+{
+    ranges.clear();
+    size_t pos = value.find_first_not_of(' ');
+    if (pos == std::string::npos || value.compare(pos, 6, "bytes=") != 0)
+        return RANGE_NONE;
+    pos += 6;
+
+    bool any_valid_syntax = false;
+    while (pos < value.size())
+    {
+        size_t comma = value.find(',', pos);
+        if (comma == std::string::npos)
+            comma = value.size();
+        // 去掉区间两边的空格
+        size_t b = pos, e = comma;
+        while (b < e && value[b] == ' ') ++b;
+        while (e > b && value[e - 1] == ' ') --e;
+        pos = comma + 1;
+        if (b == e)
+            continue;
+
+        size_t dash = value.find('-', b);
+        if (dash == std::string::npos || dash >= e)
+            return RANGE_NONE;
+
+        off_t first = 0, last = 0;
+        int first_digits = parse_off(value, b, dash, first);
+        int last_digits = parse_off(value, dash + 1, e, last);
+        if (first_digits < 0 || last_digits < 0
+            || b + first_digits != dash || dash + 1 + last_digits != e)
+            return RANGE_NONE;
+
+        ByteRange r;
+        if (first_digits == 0){
+            // "-500" 表示最后500个字节
+            if (last_digits == 0)
+                return RANGE_NONE;
+            any_valid_syntax = true;
+            if (last == 0 || file_size == 0)
+                continue;
+            r.start = last >= file_size ? 0 : file_size - last;
+            r.end = file_size - 1;
+        }
+        else{
+            if (last_digits > 0 && last < first)
+                return RANGE_NONE;
+            any_valid_syntax = true;
+            if (first >= file_size)
+                continue;
+            r.start = first;
+            r.end = (last_digits == 0 || last >= file_size) ? file_size - 1 : last;
+        }
+        ranges.push_back(r);
+        if (ranges.size() > (size_t)MAX_RANGES){
+            ranges.clear();
+            return RANGE_NONE;
+        }
+    }
+
+    if (!any_valid_syntax)
+        return RANGE_NONE;
+    if (ranges.empty())
+        return RANGE_UNSATISFIABLE;
+
+    // 排序后合并重叠或相邻的区间
+    std::sort(ranges.begin(), ranges.end(),
+              [](const ByteRange &a, const ByteRange &b){ return a.start < b.start; });
+    size_t n = 0;
+    for (size_t i = 1; i < ranges.size(); ++i){
+        if (ranges[i].start <= ranges[n].end + 1){
+            if (ranges[i].end > ranges[n].end)
+                ranges[n].end = ranges[i].end;
+        }
+        else
+            ranges[++n] = ranges[i];
+    }
+    ranges.resize(n + 1);
+    return RANGE_SATISFIABLE;
+}
@@ -0,0 +1,23 @@
+#ifndef RANGE
+#define RANGE
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+const int RANGE_NONE = 0;            //没有Range或者Range语法无效，按完整文件返回(RFC 7233)
+const int RANGE_SATISFIABLE = 1;     //至少有一个区间可以满足，返回206
+const int RANGE_UNSATISFIABLE = -1;  //所有区间都超出文件大小，返回416
+
+const int MAX_RANGES = 16;           //一个请求里最多接受的区间数，防止用大量小区间放大响应
+
+// 闭区间 [start, end]
+struct ByteRange
+{
+    off_t start;
+    off_t end;
+};
+
+// 解析 "bytes=0-99,200-,-500" 形式的Range首部，重叠/相邻的区间会被合并并按起点排序
+int parse_range(const std::string &value, off_t file_size, std::vector<ByteRange> &ranges);
+
+#endif
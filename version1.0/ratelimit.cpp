@@ -0,0 +1,145 @@
+#include "ratelimit.h"
+#include "config.h"
+#include "metrics.h"
+#include <string.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <atomic>
+using namespace std;
+
+// 一个槽位正好半条缓存行，key为0表示空
+struct alignas(32) RateEntry
+{
+    atomic<uint64_t> key;
+    atomic<uint64_t> requests;      //高40位是上次补充令牌的时间(毫秒)，低24位是剩余令牌(千分之一个)
+    atomic<uint64_t> connections;
+};
+
+static RateEntry rate_table[RATELIMIT_SHARDS][RATELIMIT_WAYS];
+
+const int TOKEN_BITS = 24;
+const uint64_t TOKEN_MASK = (1ULL << TOKEN_BITS) - 1;
+const uint64_t TOKEN_UNIT = 1000;
+
+static uint64_t now_ms()
+{
+    // 加1保证时间戳不为0，桶的值为0表示还没用过
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000 + 1;
+}
+
+uint64_t ratelimit_key(const struct sockaddr *addr)
+{
+    if (addr->sa_family == AF_INET)
+        return (1ULL << 32) | ((const struct sockaddr_in*)addr)->sin_addr.s_addr;
+    if (addr->sa_family == AF_INET6)
+    {
+        const struct sockaddr_in6 *addr6 = (const struct sockaddr_in6*)addr;
+        if (IN6_IS_ADDR_V4MAPPED(&addr6->sin6_addr))
+        {
+            uint32_t v4;
+            memcpy(&v4, addr6->sin6_addr.s6_addr + 12, sizeof(v4));
+            return (1ULL << 32) | v4;
+        }
+        uint64_t prefix;
+        memcpy(&prefix, addr6->sin6_addr.s6_addr, sizeof(prefix));
+        return prefix | (1ULL << 63);
+    }
+    return 1;
+}
+
+static uint64_t last_seen(RateEntry &entry)
+{
+    uint64_t a = entry.requests.load(memory_order_relaxed) >> TOKEN_BITS;
+    uint64_t b = entry.connections.load(memory_order_relaxed) >> TOKEN_BITS;
+    return a > b ? a : b;
+}
+
+// 找到key所在的槽位，没有就占用一个空槽或者替换分片里最久没出现的那个
+static RateEntry &lookup(uint64_t key)
+{
+    RateEntry *shard = rate_table[(key * 0x9E3779B97F4A7C15ULL) >> (64 - RATELIMIT_SHARD_BITS)];
+    for (int i = 0; i < RATELIMIT_WAYS; ++i)
+        if (shard[i].key.load(memory_order_acquire) == key)
+            return shard[i];
+
+    int victim = 0;
+    uint64_t oldest = UINT64_MAX;
+    for (int i = 0; i < RATELIMIT_WAYS; ++i)
+    {
+        uint64_t seen = shard[i].key.load(memory_order_relaxed) == 0 ? 0 : last_seen(shard[i]);
+        if (seen < oldest)
+        {
+            oldest = seen;
+            victim = i;
+        }
+    }
+    RateEntry &entry = shard[victim];
+    uint64_t old_key = entry.key.load(memory_order_relaxed);
+    // 两个线程抢同一个槽位时只有一个能换成功，输的一方直接用赢家的槽位，只是多算了一个IP的令牌
+    if (old_key != key && entry.key.compare_exchange_strong(old_key, key, memory_order_acq_rel))
+    {
+        entry.requests.store(0, memory_order_relaxed);
+        entry.connections.store(0, memory_order_relaxed);
+    }
+    return entry;
+}
+
+// 按流逝的时间补充令牌，再扣掉一个
+bool ratelimit_take(atomic<uint64_t> &bucket, int rate, int burst)
+{
+    // 没有配置容量时取rate，但不能超过令牌字段放得下的RATELIMIT_MAX_BURST，否则会溢出到时间戳里
+    if (burst <= 0)
+        burst = rate;
+    if (burst > RATELIMIT_MAX_BURST)
+        burst = RATELIMIT_MAX_BURST;
+    uint64_t capacity = (uint64_t)burst * TOKEN_UNIT;
+    uint64_t now = now_ms();
+    uint64_t old = bucket.load(memory_order_relaxed);
+    while (true)
+    {
+        uint64_t last = old >> TOKEN_BITS;
+        uint64_t tokens = old & TOKEN_MASK;
+        if (old == 0)
+        {
+            last = now;
+            tokens = capacity;
+        }
+        // rate个/秒正好是每毫秒rate个千分之一令牌
+        if (now > last)
+            tokens += (now - last) * rate;
+        if (tokens > capacity)
+            tokens = capacity;
+        bool allowed = tokens >= TOKEN_UNIT;
+        if (allowed)
+            tokens -= TOKEN_UNIT;
+        uint64_t next = (now << TOKEN_BITS) | tokens;
+        if (bucket.compare_exchange_weak(old, next, memory_order_relaxed))
+            return allowed;
+    }
+}
+
+bool ratelimit_allow_request(uint64_t key)
+{
+    const ServerConfig &config = config_get();
+    int rate = config.limit_req_rate;
+    if (rate <= 0)
+        return true;
+    if (ratelimit_take(lookup(key).requests, rate, config.limit_req_burst))
+        return true;
+    ++server_metrics.ratelimit_requests;
+    return false;
+}
+
+bool ratelimit_allow_connection(uint64_t key)
+{
+    const ServerConfig &config = config_get();
+    int rate = config.limit_conn_rate;
+    if (rate <= 0)
+        return true;
+    if (ratelimit_take(lookup(key).connections, rate, config.limit_conn_burst))
+        return true;
+    ++server_metrics.ratelimit_connections;
+    return false;
+}
@@ -0,0 +1,33 @@
+#ifndef RATELIMIT
+#define RATELIMIT
+#include <stdint.h>
+#include <atomic>
+#include <sys/socket.h>
+
+/* 按客户端IP限流：每个IP有一个请求令牌桶和一个新建连接令牌桶。
+   桶放在固定大小的表里，表分成RATELIMIT_SHARDS个分片，每个分片RATELIMIT_WAYS个槽位，
+   IP哈希到一个分片，分片满了就替换其中最久没出现的IP(近似LRU)，内存占用不随客户端数增长。
+   令牌数和上次补充的时间打包在一个64位原子变量里，用CAS更新，不加锁。
+   槽位被替换的瞬间可能有别的线程还在更新旧IP的桶，只会让个别请求的计数有偏差 */
+
+const int RATELIMIT_SHARD_BITS = 13;
+const int RATELIMIT_SHARDS = 1 << RATELIMIT_SHARD_BITS;
+const int RATELIMIT_WAYS = 4;
+const int RATELIMIT_MAX_BURST = 16000;      //令牌数按千分之一存放在24位里
+const int RATELIMIT_MAX_RATE = 100000;
+
+// 超过限制时直接回送的响应，不读文件也不走响应序列化
+const char RATELIMIT_RESPONSE[] = "HTTP/1.1 429 Too Many Requests\r\n"
+                                  "Retry-After: 1\r\n"
+                                  "Content-length: 0\r\n"
+                                  "Connection: close\r\n\r\n";
+
+// 客户端地址对应的键：IPv4按整个地址，IPv6按/64前缀
+uint64_t ratelimit_key(const struct sockaddr *addr);
+// 按配置里的limit_req_rate/limit_conn_rate扣一个令牌，没有配置限流时总是返回true
+bool ratelimit_allow_request(uint64_t key);
+bool ratelimit_allow_connection(uint64_t key);
+// 单独一个令牌桶(例如每个虚拟主机一个)，按rate个/秒补充，容量burst(0表示和rate相同，都不超过RATELIMIT_MAX_BURST)，扣到一个返回true
+bool ratelimit_take(std::atomic<uint64_t> &bucket, int rate, int burst);
+
+#endif
@@ -1,6 +1,23 @@
 #include "requestData.h"
 #include "util.h"
 #include "epoll.h"
+#include "range.h"
+#include "mime.h"
+#include "response.h"
+#include "keepalive.h"
+#include "metrics.h"
+#include "admin.h"
+#include "config.h"
+#include "ratelimit.h"
+#include "bundle.h"
+#include "diskio.h"
+#include "filecache.h"
+#include "scan.h"
+#include "urlpath.h"
+#include "coroutine.h"
+#include "probes.h"
+#include <arpa/inet.h>
+#include <strings.h>
 #include <sys/epoll.h>
 #include <unistd.h>
 #include <sys/time.h>
@@ -13,55 +30,48 @@
 using namespace std;
 
 pthread_mutex_t qlock = PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t MimeType::lock = PTHREAD_MUTEX_INITIALIZER;
-std::unordered_map<std::string, std::string> MimeType::mime;
-
-std::string MimeType::getMime(const std::string &suffix){
-
-    if (mime.size() == 0)
-    {
-        pthread_mutex_lock(&lock);
-        if (mime.size() == 0){
-            mime[".html"] = "text/html";
-            mime[".avi"] = "video/x-msvideo";
-            mime[".bmp"] = "image/bmp";
-            mime[".c"] = "text/plain";
-            mime[".doc"] = "application/msword";
-            mime[".gif"] = "image/gif";
-            mime[".gz"] = "application/x-gzip";
-            mime[".htm"] = "text/html";
-            mime[".ico"] = "application/x-ico";
-            mime[".jpg"] = "image/jpeg";
-            mime[".png"] = "image/png";
-            mime[".txt"] = "text/plain";
-            mime[".mp3"] = "audio/mp3";
-            mime["default"] = "text/html";
-        }
-        pthread_mutex_unlock(&lock);
-    }
+priority_queue<mytimer*, deque<mytimer*>, timerCmp> myTimerQueue;
+std::atomic<int> live_connections(0);
+std::atomic<bool> server_draining(false);
+std::atomic<int> idle_connections(0);
 
-    if (mime.find(suffix) == mime.end())
-        return mime["default"];
-    else
-        return mime[suffix];
-}
+// 空闲长连接的LRU链表，头部是空闲最久的；请求结束时挂到尾部，有新事件分发时摘下，都是O(1)
+static pthread_mutex_t idle_lock = PTHREAD_MUTEX_INITIALIZER;
+static requestData *idle_head = NULL;
+static requestData *idle_tail = NULL;
 
-priority_queue<mytimer*, deque<mytimer*>, timerCmp> myTimerQueue;
+static CoTask receive_post(CoRequest &req);
+static CoTask proxy_handler(CoRequest &req);
 
 requestData::requestData(): 
-    now_read_pos(0), state(STATE_PARSE_URI), h_state(h_start), 
-    keep_alive(false), againTimes(0), timer(NULL){
+    againTimes(0), now_read_pos(0), state(STATE_PARSE_URI), h_state(h_start), 
+    keep_alive(false), timer(NULL), ssl(NULL), handshaked(false),
+    idle_prev(NULL), idle_next(NULL), in_idle_list(false), keepalive_ms(0), upstream(NULL), site(NULL),
+    defer_fd(-1), defer_offset(0), defer_len(0), defer_owned(false), fetched(false), co(NULL), resp_status(0),
+    header_deadline(0), body_deadline(0), head_bytes(0), path_stat_valid(false), resp_bytes(0),
+    close_after_send(false){
+    memset(&trace, 0, sizeof(trace));
     cout << "requestData constructed !" << endl;
 }
 
-requestData::requestData(int _epollfd, int _fd, std::string _path):
+requestData::requestData(int _epollfd, int _fd, std::string _path, ssl_st *_ssl):
+    againTimes(0), path(_path), fd(_fd), epollfd(_epollfd),
     now_read_pos(0), state(STATE_PARSE_URI), h_state(h_start), 
-    keep_alive(false), againTimes(0), timer(NULL),
-    path(_path), fd(_fd), epollfd(_epollfd)
-{}
+    keep_alive(false), timer(NULL),
+    ssl(_ssl), handshaked(_ssl == NULL), io(_fd, _ssl),
+    idle_prev(NULL), idle_next(NULL), in_idle_list(false), keepalive_ms(0), upstream(NULL), site(NULL),
+    defer_fd(-1), defer_offset(0), defer_len(0), defer_owned(false), fetched(false), co(NULL), resp_status(0),
+    header_deadline(0), body_deadline(0), head_bytes(0), path_stat_valid(false), resp_bytes(0),
+    close_after_send(false)
+{
+    memset(&client_addr, 0, sizeof(client_addr));
+    memset(&trace, 0, sizeof(trace));
+    ++live_connections;
+}
 
 requestData::~requestData(){
     cout << "~requestData()" << endl;
+    SWS_PROBE2(conn_close, fd, state);
     struct epoll_event ev;
     // 超时的一定都是读请求，没有"被动"写。
     ev.events = EPOLLIN | EPOLLET | EPOLLONESHOT;//修改文件描述符，重置socket上的EPOLLONESHOT事件，以确保下一次可读时，EPOLLIN事件能被触发
@@ -71,7 +81,17 @@ requestData::~requestData(){
         timer->clearReq();
         timer = NULL;
     }
+    if (co != NULL){
+        // 协程挂起在后端连接上时那个描述符还在epoll里，要先删掉，协程栈里的对象随后析构
+        if (co->wait_fd >= 0 && co->wait_fd != fd)
+            epoll_ctl(epollfd, EPOLL_CTL_DEL, co->wait_fd, NULL);
+        delete co;
+        co = NULL;
+    }
+    leaveIdle();
+    tls_free(ssl);
     close(fd);
+    --live_connections;
 }
 
 void requestData::addTimer(mytimer *mtimer){
@@ -85,22 +105,47 @@ int requestData::getFd(){
 
 void requestData::setFd(int _fd){
     fd = _fd;
+    io.fd = _fd;
+}
+
+void requestData::setClientAddr(const struct sockaddr_in &addr){
+    client_addr = addr;
 }
 
 void requestData::reset(){
     againTimes = 0;
     content.clear();
+    // 大请求之后把缓冲区缩回来，长连接上的小请求不一直占着它
+    if (content.capacity() > READ_BUFFER_KEEP)
+        content.shrink_to_fit();
     file_name.clear();
+    uri.clear();
     path.clear();
     now_read_pos = 0;
     state = STATE_PARSE_URI;
     h_state = h_start;
     headers.clear();
     keep_alive = false;
+    upstream = NULL;
+    fetched = false;
+    resp_status = 0;
+    resp_bytes = 0;
+    header_deadline = 0;
+    body_deadline = 0;
+    head_bytes = 0;
+    path_stat_valid = false;
+    site = NULL;
+    close_after_send = false;
 }
 
 
 
+void requestData::traceDispatch(){
+    // 还没读到任何内容的才是新请求，同一个请求的后续事件沿用已有的记录
+    if (state == STATE_PARSE_URI && content.empty())
+        trace_begin(trace, fd);
+}
+
 void requestData::seperateTimer(){
     if (timer){
         timer->clearReq();
@@ -108,12 +153,88 @@ void requestData::seperateTimer(){
     }
 }
 
+// 从空闲链表里摘下，调用时必须持有idle_lock
+void requestData::idleUnlinkLocked(){
+    if (!in_idle_list)
+        return;
+    if (idle_prev)
+        idle_prev->idle_next = idle_next;
+    else
+        idle_head = idle_next;
+    if (idle_next)
+        idle_next->idle_prev = idle_prev;
+    else
+        idle_tail = idle_prev;
+    idle_prev = idle_next = NULL;
+    in_idle_list = false;
+    --idle_connections;
+}
+
+void requestData::leaveIdle(){
+    pthread_mutex_lock(&idle_lock);
+    idleUnlinkLocked();
+    pthread_mutex_unlock(&idle_lock);
+}
+
+int evict_idle_connections(int max_evict){
+    int evicted = 0;
+    while (evicted < max_evict){
+        pthread_mutex_lock(&idle_lock);
+        requestData *victim = idle_head;
+        if (victim != NULL)
+            victim->idleUnlinkLocked();
+        pthread_mutex_unlock(&idle_lock);
+        if (victim == NULL)
+            break;
+        // 空闲连接不在任何工作线程手里，析构时会从epoll里删掉并让定时器失效
+        delete victim;
+        ++evicted;
+        ++server_metrics.idle_evicted;
+    }
+    return evicted;
+}
+
 void requestData::handleRequest(){
-    char buff[MAX_BUFF];
+    // HTTPS连接先在用户态完成握手，握手结束后如果内核接管了收发两个方向，
+    // 后面的读写就和明文连接一样直接走系统调用
+    if (!handshaked){
+        int hs = tls_handshake(ssl);
+        if (hs == TLS_HANDSHAKE_ERROR){
+            delete this;
+            return;
+        }
+        if (hs != TLS_HANDSHAKE_DONE){
+            rearm(hs == TLS_HANDSHAKE_WANT_WRITE ? EPOLLOUT : EPOLLIN);
+            return;
+        }
+        handshaked = true;
+        if (tls_ktls_send(ssl) && tls_ktls_recv(ssl))
+            io.ssl = NULL;
+    }
+
+    trace_stamp(trace, TRACE_DEQUEUE);
     bool isError = false;
     while (true){
+        if (state == STATE_COROUTINE){
+            // 协程自己读写socket，这里只负责把它从挂起的地方恢复
+            resumeCoroutine();
+            return;
+        }
+        if (state == STATE_SENDING){
+            // 客户端收走了一些数据，接着写上次没写完的响应
+            if (sendOutput() < 0 || (out.empty() && close_after_send))
+                isError = true;
+            else if (out.empty())
+                state = STATE_FINISH;
+            break;
+        }
+        if (state == STATE_DEFERRED){
+            // IO线程已经把文件读进页缓存，不用再读socket，直接接着处理
+            state = STATE_ANALYSIS;
+        }
+        else {
         /*------开始读取-----*/
-        int read_num = readn(fd, buff, MAX_BUFF);//把fd上的内容读到buff中
+        int read_num = io.readAppend(content, READ_SPILL_SIZE);//直接读到content末尾
         //读取出错则直接退出
         if (read_num < 0){
             perror("1");
@@ -122,24 +243,33 @@ void requestData::handleRequest(){
         }
         else if (read_num == 0){
             // 有请求出现但是读不到数据，可能是Request Aborted，或者来自网络的数据没有达到等原因
+            int saved_errno = errno;//perror可能会改写errno，先保存下来
             perror("read_num == 0");
-            if (errno == EAGAIN){
+            if (saved_errno == EAGAIN){
                 if (againTimes > AGAIN_MAX_TIMES)//超过一定次数就抛弃
                     isError = true;
                 else
                     ++againTimes;
             }
-            else if (errno != 0)
+            else if (saved_errno != 0)
                 isError = true;
             break;
         }
 
-        //读取到字符串now_read 再传递到content里面
-        string now_read(buff, buff + read_num);
-        content += now_read;
+        // 数据一点一点滴过来时每次都会重置定时器，所以期限要在这里检查
+        if (!withinDeadline(read_num)){
+            handleError(408, "Request Timeout");
+            isError = true;
+            break;
+        }
+        }
         if (state == STATE_PARSE_URI){//进行请求行的解析
             int flag = this->parse_URI();
             if (flag == PARSE_URI_AGAIN){
+                if (headerTooLarge()){
+                    handleError(414, "URI Too Long");
+                    isError = true;
+                }
                 break;
             }
             else if (flag == PARSE_URI_ERROR){
@@ -147,11 +277,22 @@ void requestData::handleRequest(){
                 isError = true;
                 break;
             }
+            // 请求行一解析完就检查限流，超限的请求不再解析首部，也不碰文件
+            if (!ratelimit_allow_request(ratelimit_key((struct sockaddr*)&client_addr))){
+                out.appendRef(std::string_view(RATELIMIT_RESPONSE, sizeof(RATELIMIT_RESPONSE) - 1));
+                sendOutput();
+                isError = true;
+                break;
+            }
         }   
 
         if (state == STATE_PARSE_HEADERS){//进行首部行的解析
             int flag = this->parse_Headers();
             if (flag == PARSE_HEADER_AGAIN){  
+                if (headerTooLarge()){
+                    handleError(431, "Request Header Fields Too Large");
+                    isError = true;
+                }
                 break;
             }
             else if (flag == PARSE_HEADER_ERROR){
@@ -160,26 +301,38 @@ void requestData::handleRequest(){
                 break;
             }
 
-            if(method == METHOD_POST) { //如果解析到的是post请求
-                state = STATE_RECV_BODY;//转移到STATE_RECV_BODY状态 
-            }
-            else {//如果解析到的是get请求
-                state = STATE_ANALYSIS;//直接转移到STATE_ANALYSIS状态
-            }
-        }
-
-        if (state == STATE_RECV_BODY) { //post请求的情况
-            int content_length = -1;//post请求报文的首部行里面必然会有Content-length字段而get没有，所以取出这个字段，求出后面实体主体时候要取用的长度
-            if (headers.find("Content-length") != headers.end()){//在parse_Headers函数里面会把首部行的key value放在一个map里面headers
-                content_length = stoi(headers["Content-length"]);
+            trace_stamp(trace, TRACE_PARSED);
+            SWS_PROBE3(parse_done, fd, method, uri.c_str());
+            // 首部收完才知道Host，先选站点再在它的docroot下解析路径
+            site = vhost_lookup(headers.get(HEADER_HOST));
+            if (!vhost_allow_request(site)){
+                out.appendRef(std::string_view(RATELIMIT_RESPONSE, sizeof(RATELIMIT_RESPONSE) - 1));
+                sendOutput();
+                isError = true;
+                break;
             }
-            else{
+            // 解码、规范化成相对docroot的文件名，同一个路径重复请求时直接用缓存的结果
+            int resolved = path_resolve(vhost_root(site), uri, file_name, path_stat);
+            if (resolved == PATH_BAD){
+                handleError(400, "Bad Request");
                 isError = true;
                 break;
             }
-            if (content.size() < content_length)
-                continue;
-            state = STATE_ANALYSIS;
+            path_stat_valid = (resolved == PATH_STAT_CACHED);
+            upstream = proxy_match(uri);
+            if (method == METHOD_POST)
+                startBodyClock();
+            if (upstream != NULL) { //转发给后端的请求交给协程处理函数，正文边收边转发，不在这里攒
+                startCoroutine(proxy_handler);
+                state = STATE_COROUTINE;
+            }
+            else if (method == METHOD_POST) { //post请求交给协程处理函数，正文由它自己读
+                startCoroutine(receive_post);
+                state = STATE_COROUTINE;
+            }
+            else {//如果解析到的是get请求
+                state = STATE_ANALYSIS;//直接转移到STATE_ANALYSIS状态
+            }
         }
 
         if (state == STATE_ANALYSIS){
@@ -189,9 +342,21 @@ void requestData::handleRequest(){
                 break;
             }
             else if (flag == ANALYSIS_SUCCESS){
+                ++server_metrics.requests;
                 state = STATE_FINISH;
                 break;
             }
+            else if (flag == ANALYSIS_DEFERRED){
+                // 交给IO线程之后这个对象随时可能在别的线程上继续处理，不能再访问this
+                state = STATE_DEFERRED;
+                if (diskio_submit(this))
+                    return;
+                if (defer_owned)
+                    close(defer_fd);
+                defer_fd = -1;
+                fetched = true;
+                continue;
+            }
             else{
                 isError = true;
                 break;
@@ -199,16 +364,28 @@ void requestData::handleRequest(){
         }
     }
 
+    // 发送缓冲区满了：回到epoll等EPOLLOUT，写完之后再结束这个请求
+    if (!out.empty()){
+        if (isError)
+            close_after_send = true;
+        state = STATE_SENDING;
+        rearm(EPOLLOUT);
+        return;
+    }
+
     if (isError){
+        requestDone();
         delete this;
         return;
     }
 
     // 如果设置了长连接支持 则加入epoll继续响应
+    bool idle = false;
     if (state == STATE_FINISH){
+        requestDone();
         if (keep_alive){
-            printf("ok\n");
             this->reset();
+            idle = true;
         }
         else{
             delete this;
@@ -216,99 +393,108 @@ void requestData::handleRequest(){
         }
     }
 
+    rearm(EPOLLIN, idle);
+}
+
+// 重新加入epoll等待下一次事件，idle为true表示一个请求刚结束，连接进入空闲LRU
+void requestData::rearm(__uint32_t events, bool idle){
+    // 请求头的期限已经过了，不用再等一个定时器，直接关闭
+    if (!idle && state != STATE_SENDING && header_deadline != 0 && header_deadline <= monotonic_ms()){
+        ++server_metrics.header_timeouts;
+        delete this;
+        return;
+    }
     // 一定要先加时间信息，否则可能会出现刚加进去，下个in触发来了，然后分离失败后，又加入队列，最后超时被删，然后正在线程中进行的任务出错，double free错误。
-    // 新增时间信息
+    // 定时器入队、挂空闲链表和epoll_mod都在qlock里做完：锁一释放，定时器就可能到期，
+    // 主线程会在handle_expired_event里delete这个对象，之后不能再访问this
     pthread_mutex_lock(&qlock);
-    mytimer *mtimer = new mytimer(this, 500);
+    // 请求读到一半时等剩余数据最多REQUEST_TIME_OUT，也不超过这个阶段的期限
+    int timeout = idle ? keepalive_ms : REQUEST_TIME_OUT;
+    int reason = idle ? TIMER_IDLE : TIMER_HEADER;
+    if (state == STATE_SENDING){
+        // 每写出一部分都重新计时，只有客户端完全不收数据才会超时
+        timeout = config_get().send_timeout;
+        reason = TIMER_SEND;
+    }
+    else if (!idle && header_deadline != 0){
+        long long left = header_deadline - monotonic_ms();
+        if (left < timeout)
+            timeout = left > 1 ? (int)left : 1;
+    }
+    mytimer *mtimer = new mytimer(this, timeout);
+    mtimer->reason = reason;
     timer = mtimer;
     myTimerQueue.push(mtimer);
-    pthread_mutex_unlock(&qlock);
 
-    __uint32_t _epo_event = EPOLLIN | EPOLLET | EPOLLONESHOT;
-    int ret = epoll_mod(epollfd, fd, static_cast<void*>(this), _epo_event);
+    __uint32_t _epo_event = events | EPOLLET | EPOLLONESHOT;
+    int ret;
+    if (idle){
+        // 挂链表和epoll_mod要在同一把锁里完成：锁一释放，这个对象就可能被主线程淘汰或者分发
+        pthread_mutex_lock(&idle_lock);
+        idle_prev = idle_tail;
+        idle_next = NULL;
+        if (idle_tail)
+            idle_tail->idle_next = this;
+        else
+            idle_head = this;
+        idle_tail = this;
+        in_idle_list = true;
+        ++idle_connections;
+        ret = epoll_mod(epollfd, fd, static_cast<void*>(this), _epo_event);
+        if (ret < 0)
+            idleUnlinkLocked();
+        pthread_mutex_unlock(&idle_lock);
+    }
+    else
+        ret = epoll_mod(epollfd, fd, static_cast<void*>(this), _epo_event);
     if (ret < 0){
-        // 返回错误处理
+        // 返回错误处理：先在锁里撤掉定时器，主线程就不会再delete它
+        seperateTimer();
+        pthread_mutex_unlock(&qlock);
         delete this;
         return;
     }
+    pthread_mutex_unlock(&qlock);
 }
 
 int requestData::parse_URI() {//解析报文中的请求行
 /*  POST /0606/02.php HTTP/1.1 \r\n      请求行示例*/
+    // 分界符都用scan.h里的扫描去找：先找行尾的\r，再在这一行里找两个空格
     string &str = content;
-    int pos = str.find('\r', now_read_pos);//从now_read_pos位置开始读取 返回/r位置，即请求行结束标志
-    if (pos < 0){
+    const char *begin = str.data();
+    const char *cr = scan_any(begin + now_read_pos, begin + str.size(), "\r", 1);
+    if (cr == begin + str.size()){
         return PARSE_URI_AGAIN; 
     }
+    const char *method_end = scan_any(begin, cr, " ", 1);
+    if (method_end == cr)
+        return PARSE_URI_ERROR;
+    std::string_view method_name(begin, method_end - begin);
+    if (method_name == "GET")
+        method = METHOD_GET;
+    else if (method_name == "POST")
+        method = METHOD_POST;
+    else
+        return PARSE_URI_ERROR;
 
-    string request_line = str.substr(0, pos); //取出 请求行
-    if (str.size() > pos + 1) 
-        str = str.substr(pos + 1);
-    else 
-        str.clear();
-
-    // 解析请求行中的请求类型(GET还是POST)
-    pos = request_line.find("GET"); 
-    if (pos < 0){
-        pos = request_line.find("POST");
-        if (pos < 0){
-            return PARSE_URI_ERROR;//如果GET和POST都没找到
-        }
-        else{
-            method = METHOD_POST; //设定标志位为POST请求标志
-        }
-    }
-    else{
-        method = METHOD_GET;//设定标志位为GET请求标志
-    }
-
-
-    // 解析请求行中的URL 即浏览器要请求的文件地址
-    pos = request_line.find("/", pos); 
-    if (pos < 0){
+    // 请求的路径，必须以'/'开头
+    const char *path = method_end + 1;
+    const char *path_end = scan_any(path, cr, " ", 1);
+    if (path_end == cr || path == path_end || *path != '/')
         return PARSE_URI_ERROR;
-    }
-    else{
-        int _pos = request_line.find(' ', pos);
-        if (_pos < 0)
-            return PARSE_URI_ERROR;
-        else{
-            if (_pos - pos > 1){
-                file_name = request_line.substr(pos + 1, _pos - pos - 1);
-                int __pos = file_name.find('?');
-                if (__pos >= 0)
-                {
-                    file_name = file_name.substr(0, __pos);
-                    cout<<"filename"<<file_name<<endl;
-                }
-            }
-            else
-                file_name = "index.html";
-        }
-        pos = _pos;
-    }
 
-    // 解析请求行中的HTTP 版本号
-    pos = request_line.find("/", pos);
-    if (pos < 0) {
+    // HTTP版本号，只认HTTP/1.0和HTTP/1.1
+    std::string_view version(path_end + 1, cr - path_end - 1);
+    if (version == "HTTP/1.1")
+        HTTPversion = HTTP_11;
+    else if (version == "HTTP/1.0")
+        HTTPversion = HTTP_10;
+    else
         return PARSE_URI_ERROR;
-    }
-    else{
-        if (request_line.size() - pos <= 3){
-            return PARSE_URI_ERROR;
-        }
-        else{
-            string ver = request_line.substr(pos + 1, 3);//从pos+1开始向后3位(也就是版本号1.1)
-            cout<< "version: "<<ver<<endl;
-            if (ver == "1.0")
-                HTTPversion = HTTP_10;
-            else if (ver == "1.1")
-                HTTPversion = HTTP_11;
-            else
-                return PARSE_URI_ERROR;
-        }
-    }
 
+    uri.assign(path, path_end - path);
+    // 原地删掉已经解析的部分，content的容量留给后面的读；行尾的\n留给parse_Headers跳过
+    str.erase(0, cr + 1 - begin);
     state = STATE_PARSE_HEADERS;
     return PARSE_URI_SUCCESS;
 }
@@ -316,214 +502,737 @@ int requestData::parse_URI() {//解析报文中的请求行
 
 
 int requestData::parse_Headers(){
-
+    // 按行解析，分界符用scan.h里的向量化扫描去找，不再逐字节走状态机
     string &str = content;
-    int key_start = -1, key_end = -1, value_start = -1, value_end = -1;
-    int now_read_line_begin = 0;
-    bool notFinish = true;
-    for (int i = 0; i < str.size() && notFinish; ++i) //下面是一个状态机 依次读取key value
+    const char *begin = str.data();
+    const char *end = begin + str.size();
+    const char *p = begin;
+    if (h_state == h_start){
+        // 请求行末尾剩下的换行
+        while (p < end && (*p == '\r' || *p == '\n'))
+            ++p;
+    }
+    while (p < end)
     {
-        switch(h_state){ //h_state初始化中是被初始化为h_start的
-
-            case h_start:{//开始
-                if (str[i] == '\n' || str[i] == '\r')
-                    break;
-                h_state = h_key;
-                key_start = i;
-                now_read_line_begin = i;
+        if (*p == '\r' && h_state != h_start){
+            // 空行，首部到此结束，后面的都是正文
+            if (end - p < 2)
                 break;
-            }
-            case h_key:{//读取key
-                if (str[i] == ':')
-                {
-                    key_end = i;
-                    if (key_end - key_start <= 0)
-                        return PARSE_HEADER_ERROR;
-                    h_state = h_colon;
-                }
-                else if (str[i] == '\n' || str[i] == '\r')
-                    return PARSE_HEADER_ERROR;
-                break;  
-            }
-            case h_colon:{//读取key之后的冒号
-                if (str[i] == ' '){
-                    h_state = h_spaces_after_colon;
-                }
-                else
-                    return PARSE_HEADER_ERROR;
-                break;  
-            }
-            case h_spaces_after_colon:{
-                h_state = h_value;
-                value_start = i;
-                break;  
-            }
-            case h_value: {
-                if (str[i] == '\r'){
-                    h_state = h_CR;
-                    value_end = i;
-                    if (value_end - value_start <= 0)
-                        return PARSE_HEADER_ERROR;
-                }
-                else if (i - value_start > 255)
-                    return PARSE_HEADER_ERROR;
-                break;  
-            }
-            case h_CR:{
-                if (str[i] == '\n'){
-                    h_state = h_LF;
-                    string key(str.begin() + key_start, str.begin() + key_end);
-                    string value(str.begin() + value_start, str.begin() + value_end);
-                    headers[key] = value;
-                    now_read_line_begin = i;
-                }
-                else
-                    return PARSE_HEADER_ERROR;
-                break;  
-            }
-            case h_LF:{
-                if (str[i] == '\r'){
-                    h_state = h_end_CR;
-                }
-                else{
-                    key_start = i;
-                    h_state = h_key;
-                }
-                break;
-            }
-            case h_end_CR:{
-                if (str[i] == '\n') {
-                    h_state = h_end_LF;
-                }
-                else
-                    return PARSE_HEADER_ERROR;
-                break;
-            }
-            case h_end_LF:
-            {
-                notFinish = false;
-                key_start = i;
-                now_read_line_begin = i;
-                break;
-            }
+            if (p[1] != '\n')
+                return PARSE_HEADER_ERROR;
+            h_state = h_end_LF;
+            str.erase(0, p + 2 - begin);
+            return PARSE_HEADER_SUCCESS;
         }
+        HeaderLine line;
+        int flag = scan_header_line(p, end, line);
+        if (flag == SCAN_LINE_ERROR)
+            return PARSE_HEADER_ERROR;
+        if (flag == SCAN_LINE_AGAIN)
+            break;
+        headers.set(std::string_view(line.key, line.key_len), std::string_view(line.value, line.value_len));
+        h_state = h_LF;
+        p = line.next;
     }
-
-    if (h_state == h_end_LF){
-        str = str.substr(now_read_line_begin);//把首部行结束处到报文结束处作为子串
-        return PARSE_HEADER_SUCCESS;
-    }
-    str = str.substr(now_read_line_begin);
+    // 只收到半行时下次从这一行的开头重新解析
+    str.erase(0, p - begin);
     return PARSE_HEADER_AGAIN;
 }
 
 int requestData::analysisRequest()
 {
-    if (method == METHOD_POST)
+    if (method == METHOD_GET)
     {
-        //get content
-        char header[MAX_BUFF];//head存放回送报文 后面的headers存放刚才读取的首部行key value对
-        sprintf(header, "HTTP/1.1 %d %s\r\n", 200, "OK");
-        if(headers.find("Connection") != headers.end() && headers["Connection"] == "keep-alive"){//如果发现请求报文里面设定了长连接 则把长连接信息写入回送报文里面
-            keep_alive = true;
-            sprintf(header, "%sConnection: keep-alive\r\n", header);
-            sprintf(header, "%sKeep-Alive: timeout=%d\r\n", header, EPOLL_WAIT_TIME);
+        if (admin_match(file_name))
+            return serveAdmin();
+        // 打包文件代替的是默认站点的docroot
+        if (site == NULL && bundle_enabled())
+            return serveBundle();
+        std::string_view filetype = MimeType::fromFileName(file_name);
+        // stat结果还在路径缓存的有效期内时先不打开文件，内存缓存命中就完全不用碰文件系统
+        int src_fd = -1;
+        struct stat sbuf;
+        if (path_stat_valid)
+            sbuf = path_stat;
+        else
+        {
+            src_fd = openat(vhost_root(site), file_name.c_str(), O_RDONLY, 0);
+            if (src_fd >= 0 && fstat(src_fd, &sbuf) == 0)
+                path_remember(vhost_root(site), uri, sbuf);
+            else if (src_fd >= 0)
+            {
+                close(src_fd);
+                src_fd = -1;
+            }
+            if (src_fd < 0)
+            {
+                handleError(404, "Not Found!");
+                return ANALYSIS_ERROR;
+            }
         }
-
-        char *send_content = "I have receiced this.";
-
-        sprintf(header, "%sContent-length: %zu\r\n", header, strlen(send_content));
-        sprintf(header, "%s\r\n", header);
-        size_t send_len = (size_t)writen(fd, header, strlen(header));
-        if(send_len != strlen(header))
+        if (!S_ISREG(sbuf.st_mode))
         {
-            perror("Send header failed");
+            if (src_fd >= 0)
+                close(src_fd);
+            handleError(404, "Not Found!");
             return ANALYSIS_ERROR;
         }
-        
-        send_len = (size_t)writen(fd, send_content, strlen(send_content));
-        if(send_len != strlen(send_content))
+        // 缓存命中时不用碰磁盘；没命中的小文件先确保在页缓存里，再读进缓存
+        BufSegment *cached = filecache_find(file_name, sbuf, vhost_cache(site));
+        if (cached == NULL)
         {
-            perror("Send content failed");
-            return ANALYSIS_ERROR;
+            if (src_fd < 0 && (src_fd = openat(vhost_root(site), file_name.c_str(), O_RDONLY, 0)) < 0)
+            {
+                handleError(404, "Not Found!");
+                return ANALYSIS_ERROR;
+            }
+            if (deferCold(src_fd, 0, sbuf.st_size, true))
+                return ANALYSIS_DEFERRED;
+            cached = filecache_load(file_name, src_fd, sbuf, vhost_cache(site));
         }
-        cout << "content size ==" << content.size() << endl;
-        vector<char> data(content.begin(), content.end());
-        
+        int ret = serveStaticFile(src_fd, 0, sbuf.st_size, sbuf.st_mtime, filetype, std::string_view(), false, cached);
+        if (cached != NULL)
+            seg_unref(cached);
+        if (src_fd >= 0)
+            close(src_fd);
+        return ret;
+    }
+    else
+        return ANALYSIS_ERROR;
+}
+
+// 请求要求长连接时写入Connection/Keep-Alive，超时取当前负载下的值，按秒通告
+void requestData::addConnectionHeaders(HttpResponse &response)
+{
+    if(strcasecmp(headers.get(HEADER_CONNECTION).c_str(), "keep-alive") == 0 && !server_draining)
+    {
+        keep_alive = true;
+        keepalive_ms = keepalive_timeout_ms();
+        response.append("Connection: keep-alive\r\n");
+        response.headerNum("Keep-Alive: timeout=", keepalive_ms / 1000);
+    }
+}
+
+int requestData::serveAdmin()
+{
+    string body, content_type;
+    if (!admin_render(file_name, body, content_type))
+    {
+        handleError(404, "Not Found!");
+        return ANALYSIS_ERROR;
+    }
+    HttpResponse response;
+    response.status(200);
+    response.date();
+    addConnectionHeaders(response);
+    response.header("Content-type: ", content_type);
+    response.append("Cache-Control: no-store\r\n");
+    response.headerNum("Content-length: ", body.size());
+    response.end();
+    responseStart(200, response.size() + body.size());
+    if (!response.appendTo(out))
+        return ANALYSIS_ERROR;
+    out.appendCopy(body);
+    return sendOutput();
+}
+
+// 响应头组织好、开始发送之前调用
+void requestData::responseStart(int status, size_t bytes)
+{
+    resp_status = status;
+    resp_bytes = bytes;
+    SWS_PROBE3(response_start, fd, status, bytes);
+}
+
+// 刚读到read_num字节之后检查请求头的期限，从第一个字节开始计时；
+// 正文的期限从请求头收完开始计时(startBodyClock)，由协程里的co_read检查
+bool requestData::withinDeadline(int read_num)
+{
+    long long now = monotonic_ms();
+    if (state == STATE_PARSE_URI || state == STATE_PARSE_HEADERS){
+        if (header_deadline == 0)
+            header_deadline = now + config_get().header_timeout;
+        head_bytes += read_num;
+        if (now <= header_deadline)
+            return true;
+        ++server_metrics.header_timeouts;
+        return false;
+    }
+    return true;
+}
+
+void requestData::startBodyClock()
+{
+    const ServerConfig &config = config_get();
+    body_deadline = monotonic_ms() + config.body_timeout;
+    // 和请求头一起到的那部分正文也算进速率
+    if (config.body_min_rate > 0)
+        body_deadline += (long long)content.size() * 1000 / config.body_min_rate;
+}
+
+// 请求头还没收完就已经超过上限，不用等收完再拒绝
+bool requestData::headerTooLarge()
+{
+    if (head_bytes <= config_get().max_header_size)
+        return false;
+    ++server_metrics.header_too_large;
+    return true;
+}
+
+// 一个请求结束(成功或者出错)，连接可能随后关闭，也可能留给下一个请求
+void requestData::requestDone()
+{
+    SWS_PROBE3(response_end, fd, resp_status, resp_bytes);
+    trace_finish(trace, resp_status, resp_bytes);
+    vhost_log(site, client_addr, method == METHOD_POST ? "POST" : "GET", uri, resp_status, resp_bytes);
+}
+
+// 把out里的内容尽量写出去，发送缓冲区满时不等待，剩下的由handleRequest等到EPOLLOUT再写；
+// 留下的文件片段改为引用自己dup的描述符，调用者随后可以关闭原来的文件
+int requestData::sendOutput()
+{
+    if (out.flush(io) && (out.empty() || out.retainFiles()))
         return ANALYSIS_SUCCESS;
+    perror("Send response failed");
+    out.clear();
+    return ANALYSIS_ERROR;
+}
+
+// 要发送的内容不在页缓存里时记下来交给IO线程，返回true；同一个请求只推迟一次
+bool requestData::deferCold(int src_fd, off_t offset, off_t len, bool owned)
+{
+    if (fetched || !diskio_enabled() || diskio_cached(src_fd, offset, len))
+        return false;
+    defer_fd = src_fd;
+    defer_offset = offset;
+    defer_len = len;
+    defer_owned = owned;
+    return true;
+}
+
+// 在IO线程里执行：把内容读进页缓存，再把请求交回工作线程从analysisRequest()重新开始
+void requestData::fetchDeferred()
+{
+    diskio_fetch(defer_fd, defer_offset, defer_len);
+    if (defer_owned)
+        close(defer_fd);
+    defer_fd = -1;
+    fetched = true;
+    diskio_resume(this);
+}
+
+// 检查请求正文的长度：格式不对回400，超过max_body_kb回413，错误页放进out，返回-1
+static long request_body_length(requestData *owner, const RequestHeaders &headers)
+{
+    long length = header_content_length(headers.get(HEADER_CONTENT_LENGTH));
+    if (length < 0)
+    {
+        owner->handleError(400, "Bad Request");
+        return -1;
     }
-    else if (method == METHOD_GET)
+    if (length > (long)config_get().max_body_kb * 1024)
+    {
+        owner->handleError(413, "Payload Too Large");
+        return -1;
+    }
+    return length;
+}
+
+// 收下POST请求的正文并回一个固定的响应，正文没收完时挂起等客户端
+static CoTask receive_post(CoRequest &req)
+{
+    if (!req.headers->has(HEADER_CONTENT_LENGTH))
     {
-        char header[MAX_BUFF];
-        sprintf(header, "HTTP/1.1 %d %s\r\n", 200, "OK");
-        if(headers.find("Connection") != headers.end() && headers["Connection"] == "keep-alive")
+        req.owner->handleError(411, "Length Required");
+        co_return ANALYSIS_ERROR;
+    }
+    long length = request_body_length(req.owner, *req.headers);
+    if (length < 0)
+        co_return ANALYSIS_ERROR;
+    size_t content_length = length;
+    std::string &body = *req.content;
+    char buff[MAX_BUFF];
+    while (body.size() < content_length){
+        size_t want = content_length - body.size();
+        ssize_t read_num = co_await co_read(req, buff, want < sizeof(buff) ? want : sizeof(buff));
+        if (read_num == CO_TIMEOUT)
+            ++server_metrics.body_timeouts;
+        if (read_num <= 0)
+            co_return CO_ERROR;
+        body.append(buff, read_num);
+    }
+
+    static const char send_content[] = "I have receiced this.";
+    HttpResponse response;
+    response.status(200);
+    response.date();
+    req.owner->addConnectionHeaders(response);
+    response.headerNum("Content-length: ", sizeof(send_content) - 1);
+    response.end();
+    std::string out;
+    if (!response.appendTo(out))
+        co_return CO_ERROR;
+    out.append(send_content, sizeof(send_content) - 1);
+    if (co_await co_write(req, out.data(), out.size()) != (ssize_t)out.size())
+        co_return CO_ERROR;
+    co_return 0;
+}
+
+// 为这个请求创建协程处理函数，创建出来先挂起，第一次resumeCoroutine()时才开始执行
+void requestData::startCoroutine(CoHandler handler)
+{
+    co = new CoRequest(this, io);
+    co->uri = uri;
+    co->headers = &headers;
+    co->content = &content;
+    co->deadline_ms = body_deadline;
+    co->task = handler(*co);
+    co->waiter = co->task.start();
+}
+
+void requestData::resumeCoroutine()
+{
+    // 挂起之前就被co_unpark唤醒时不注册等待，直接接着执行
+    do {
+        if (co->wait_fd >= 0 && co->wait_fd != fd)
+            epoll_del(epollfd, co->wait_fd, static_cast<void*>(this), 0);
+        co->wait_fd = -1;
+        std::coroutine_handle<> h = co->waiter;
+        co->waiter = nullptr;
+        h.resume();
+    } while (!co->task.done() && !armCoroutine());
+    if (!co->task.done())
+        return;
+
+    ssize_t ret = co->task.result();
+    delete co;
+    co = NULL;
+    if (ret >= 0)
+        ++server_metrics.requests;
+    if (!out.empty()){
+        // 处理函数里同步回送的响应(错误页、微缓存命中)没写完，等EPOLLOUT接着写
+        close_after_send = ret < 0 || !keep_alive;
+        state = STATE_SENDING;
+        rearm(EPOLLOUT);
+        return;
+    }
+    requestDone();
+    if (ret < 0 || !keep_alive){
+        delete this;
+        return;
+    }
+    this->reset();
+    rearm(EPOLLIN, true);
+}
+
+// 按协程挂起时记下的内容注册定时器和epoll事件。两件事都在qlock里做完，
+// 主线程不会在中间处理到这个定时器；锁一释放请求就可能在别的线程上恢复，之后不能再访问this。
+// co_park之前已经被唤醒时什么都不注册，返回false
+bool requestData::armCoroutine()
+{
+    pthread_mutex_lock(&qlock);
+    if (co->wait_unpark && co->unparked){
+        co->unparked = false;
+        pthread_mutex_unlock(&qlock);
+        return false;
+    }
+    co->parked = co->wait_unpark;
+    mytimer *mtimer = new mytimer(this, co->wait_ms);
+    mtimer->wake = true;
+    timer = mtimer;
+    myTimerQueue.push(mtimer);
+    if (co->wait_fd >= 0){
+        __uint32_t _epo_event = co->wait_events | EPOLLET | EPOLLONESHOT;
+        // 注册失败时不再有事件，定时器到期后协程会按超时恢复
+        if (co->wait_fd == fd)
+            epoll_mod(epollfd, fd, static_cast<void*>(this), _epo_event);
+        else if (epoll_add(epollfd, co->wait_fd, static_cast<void*>(this), _epo_event) < 0)
+            co->wait_fd = -1;
+    }
+    pthread_mutex_unlock(&qlock);
+    return true;
+}
+
+void requestData::wakeCoroutine()
+{
+    co->timed_out = true;
+    co->parked = false;
+    if (co->wait_fd == fd)
+        epoll_mod(epollfd, fd, static_cast<void*>(this), EPOLLONESHOT);
+    else if (co->wait_fd >= 0)
+        epoll_del(epollfd, co->wait_fd, static_cast<void*>(this), 0);
+    co->wait_fd = -1;
+}
+
+// 协程挂在co_park上时撤掉它的定时器，之后只有调用者会把它交回工作线程；还没挂起时只做记号
+bool requestData::unparkCoroutine()
+{
+    pthread_mutex_lock(&qlock);
+    bool claimed = co->parked;
+    if (claimed){
+        co->parked = false;
+        seperateTimer();
+    }
+    else
+        co->unparked = true;
+    pthread_mutex_unlock(&qlock);
+    return claimed;
+}
+
+// 从打包文件里找，客户端接受时优先发预压缩的版本
+int requestData::serveBundle()
+{
+    const BundleEntry *entry = bundle_find(file_name);
+    if (entry == NULL)
+    {
+        handleError(404, "Not Found!");
+        return ANALYSIS_ERROR;
+    }
+    int variant = BUNDLE_IDENTITY;
+    std::string_view encoding;
+    bool vary = entry->variants[BUNDLE_GZIP].length > 0 || entry->variants[BUNDLE_BROTLI].length > 0;
+    const string &accept = headers.get(HEADER_ACCEPT_ENCODING);
+    if (vary && !accept.empty())
+    {
+        // 按q值选，q=0是客户端明确不要的；一样时优先br。identity没有列出时最不优先，
+        // 列出了而且q值更高时发原文
+        int br_q = entry->variants[BUNDLE_BROTLI].length > 0 ? header_coding_q(accept, "br") : 0;
+        int gzip_q = entry->variants[BUNDLE_GZIP].length > 0 ? header_coding_q(accept, "gzip") : 0;
+        int identity_q = header_coding_q(accept, "identity");
+        int best_q = br_q >= gzip_q ? br_q : gzip_q;
+        if (best_q > 0 && best_q >= identity_q)
         {
-            keep_alive = true;
-            sprintf(header, "%sConnection: keep-alive\r\n", header);
-            sprintf(header, "%sKeep-Alive: timeout=%d\r\n", header, EPOLL_WAIT_TIME);
+            variant = br_q >= gzip_q ? BUNDLE_BROTLI : BUNDLE_GZIP;
+            encoding = variant == BUNDLE_BROTLI ? "br" : "gzip";
         }
-        int dot_pos = file_name.find('.');
-        const char* filetype;
-        if (dot_pos < 0) 
-            filetype = MimeType::getMime("default").c_str();
-        else
-            filetype = MimeType::getMime(file_name.substr(dot_pos)).c_str();
-        struct stat sbuf;
-        if (stat(file_name.c_str(), &sbuf) < 0)
+    }
+    const BundleVariant &body = entry->variants[variant];
+    if (deferCold(bundle_fd(), body.offset, body.length, false))
+        return ANALYSIS_DEFERRED;
+    // 小文件直接从映射里writev，和响应头合成一次系统调用；大文件仍然sendfile
+    const char *mapped = NULL;
+    if (body.length <= ((uint64_t)config_get().file_cache_max_kb << 10))
+        mapped = (const char*)bundle_base();
+    return serveStaticFile(bundle_fd(), body.offset, body.length, entry->mtime, bundle_mime(entry), encoding, vary, NULL, mapped);
+}
+
+// 逐跳首部只对客户端这一段连接有效，不转发给后端
+static bool hop_by_hop(int id)
+{
+    return id == HEADER_CONNECTION || id == HEADER_KEEP_ALIVE || id == HEADER_PROXY_CONNECTION || id == HEADER_TE ||
+           id == HEADER_UPGRADE || id == HEADER_TRANSFER_ENCODING || id == HEADER_EXPECT || id == HEADER_X_FORWARDED_PROTO;
+}
+
+static CoTask proxy_handler(CoRequest &req)
+{
+    return req.owner->serveProxy(req);
+}
+
+// 把请求转发给后端，再把响应转发回客户端；后端连接用完放回连接池。
+// 等后端和客户端的时候都挂起，错误页和微缓存命中照常放进out，由resumeCoroutine负责写完
+CoTask requestData::serveProxy(CoRequest &req)
+{
+    long body_len = 0;
+    bool has_length = headers.has(HEADER_CONTENT_LENGTH);
+    if (headers.has(HEADER_TRANSFER_ENCODING))
+    {
+        // 客户端用chunked发送的正文不支持转发
+        handleError(411, "Length Required");
+        co_return ANALYSIS_ERROR;
+    }
+    if (has_length)
+    {
+        body_len = request_body_length(this, headers);
+        if (body_len < 0)
+            co_return ANALYSIS_ERROR;
+    }
+    if (method == METHOD_POST && !has_length)
+    {
+        handleError(411, "Length Required");
+        co_return ANALYSIS_ERROR;
+    }
+
+    // 配置了微缓存的GET：命中直接回送；没有命中时同一个键只有这一个请求去找后端，其余的等它
+    const MicroRoute *micro = method == METHOD_GET && body_len == 0 ? microcache_match(uri) : NULL;
+    MicroFill fill;
+    MicroWaiter waiter(&req);
+    if (micro != NULL)
+    {
+        string cache_key;
+        MicroHit hit;
+        if (microcache_key(micro, "GET", uri, headers, cache_key))
         {
-            handleError(fd, 404, "Not Found!");
-            return ANALYSIS_ERROR;
+            int flag = microcache_lookup(cache_key, hit, waiter);
+            if (flag == MICRO_WAIT)
+            {
+                // 挂起等正在算的那个请求，结果出来时它把这个协程交回工作线程
+                co_await co_park(req, MICROCACHE_LOCK_TIMEOUT);
+                flag = microcache_collect(waiter, hit);
+            }
+            if (flag == MICRO_HIT)
+                co_return serveMicroHit(hit);
+            if (flag == MICRO_FILL)
+                fill.begin(cache_key);
         }
+    }
 
-        sprintf(header, "%sContent-type: %s\r\n", header, filetype);
-        // 通过Content-length返回文件大小
-        sprintf(header, "%sContent-length: %ld\r\n", header, sbuf.st_size);
+    string request_head(method == METHOD_POST ? "POST " : "GET ");
+    request_head += uri;
+    request_head += " HTTP/1.1\r\n";
+    bool expect_continue = strcasecmp(headers.get(HEADER_EXPECT).c_str(), "100-continue") == 0;
+    // 常用首部按规范写法转发，其余的保持客户端的写法
+    for (int id = 0; id < HEADER_COUNT; ++id)
+    {
+        if (!headers.has(id) || hop_by_hop(id) || id == HEADER_X_FORWARDED_FOR)
+            continue;
+        request_head += header_name(id);
+        request_head += ": " + headers.get(id) + "\r\n";
+    }
+    for (unordered_map<string, string>::const_iterator it = headers.other.begin(); it != headers.other.end(); ++it)
+        request_head += it->first + ": " + it->second + "\r\n";
+    if (!headers.has(HEADER_HOST))
+        request_head += "Host: localhost\r\n";
+    // 客户端带来的X-Forwarded-For后面追加上它自己的地址
+    char client_ip[INET_ADDRSTRLEN] = "";
+    inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, sizeof(client_ip));
+    request_head += "X-Forwarded-For: ";
+    if (headers.has(HEADER_X_FORWARDED_FOR))
+        request_head += headers.get(HEADER_X_FORWARDED_FOR) + ", ";
+    request_head += client_ip;
+    request_head += "\r\n";
+    if (ssl != NULL)
+        request_head += "X-Forwarded-Proto: https\r\n";
+    request_head += "Connection: keep-alive\r\n\r\n";
 
-        sprintf(header, "%s\r\n", header);
-        size_t send_len = (size_t)writen(fd, header, strlen(header));
-        if(send_len != strlen(header)){
-            perror("Send header failed");
-            return ANALYSIS_ERROR;
+    std::string_view body_prefix(content.data(), content.size() < (size_t)body_len ? content.size() : body_len);
+    long body_remaining = body_len - (long)body_prefix.size();
+    // 客户端在等100 Continue才会发正文，后端那边去掉了Expect，这里直接替它回应
+    if (expect_continue && body_remaining > 0)
+    {
+        static const char continue_line[] = "HTTP/1.1 100 Continue\r\n\r\n";
+        if (co_await co_write(req, continue_line, sizeof(continue_line) - 1) != sizeof(continue_line) - 1)
+            co_return ANALYSIS_ERROR;
+    }
+
+    ProxyExchange exchange(upstream);
+    ssize_t ret = co_await exchange.forward(req, request_head, body_prefix, body_remaining);
+    if (ret == PROXY_BAD_GATEWAY)
+    {
+        handleError(502, "Bad Gateway");
+        co_return ANALYSIS_ERROR;
+    }
+    if (ret == PROXY_GATEWAY_TIMEOUT)
+    {
+        handleError(504, "Gateway Timeout");
+        co_return ANALYSIS_ERROR;
+    }
+    if (ret != PROXY_OK)
+        co_return ANALYSIS_ERROR;
+
+    bool capture = fill.filling() && exchange.cacheable(MICROCACHE_MAX_BODY, micro);
+    HttpResponse response;
+    response.append(exchange.statusLine());
+    response.append(exchange.headers());
+    if (fill.filling())
+        response.append("X-Cache: MISS\r\n");
+    // 正文没有长度信息，或者请求正文没读完后端就回了响应，都只能在响应之后关闭客户端连接
+    if (exchange.framed() && exchange.requestComplete())
+        addConnectionHeaders(response);
+    else
+        response.append("Connection: close\r\n");
+    response.end();
+    string response_head;
+    if (!response.appendTo(response_head))
+        co_return ANALYSIS_ERROR;
+    // 正文的长度不一定知道，按响应头的大小记，至少状态码是对的
+    responseStart(atoi(response_head.c_str() + 9), response_head.size());
+    if (co_await co_write(req, response_head.data(), response_head.size()) != (ssize_t)response_head.size())
+        co_return ANALYSIS_ERROR;
+    string body;
+    if (co_await exchange.relayBody(req, capture ? &body : NULL) != PROXY_OK)
+        co_return ANALYSIS_ERROR;
+    if (capture)
+    {
+        string head(exchange.statusLine());
+        head += exchange.headers();
+        fill.commit(micro->ttl_ms, head, body);
+    }
+    co_return ANALYSIS_SUCCESS;
+}
+
+// 微缓存命中：缓存的状态行和首部、我们自己的连接首部、缓存的正文拼成一条链发出去，正文不拷贝
+int requestData::serveMicroHit(const MicroHit &hit)
+{
+    HttpResponse response;
+    response.append("X-Cache: HIT\r\n");
+    addConnectionHeaders(response);
+    response.end();
+    responseStart(atoi(hit.seg->data + 9), hit.seg->len + response.size());
+    out.append(hit.seg, 0, hit.head_len);
+    bool ok = response.appendTo(out);
+    if (ok && hit.seg->len > hit.head_len)
+        out.append(hit.seg, hit.head_len, hit.seg->len - hit.head_len);
+    seg_unref(hit.seg);
+    return ok ? sendOutput() : ANALYSIS_ERROR;
+}
+
+// 发送src_fd中[base, base + size)这段内容，支持Range/If-Range
+// 正文全部用sendfile发送，不管文件多大，每个连接都不需要额外的内存
+// encoding非空时表示发送的是预压缩的版本，vary表示这个文件有多种表示
+int requestData::serveStaticFile(int src_fd, off_t base, off_t size, time_t mtime, std::string_view filetype,
+                                 std::string_view encoding, bool vary, BufSegment *cached, const char *mapped)
+{
+    char etag[64];
+    int etag_len = 0;
+    trace_stamp(trace, TRACE_FILE);
+    etag[etag_len++] = '"';
+    etag_len += fmt_uint(etag + etag_len, size);
+    etag[etag_len++] = '-';
+    etag_len += fmt_uint(etag + etag_len, mtime);
+    if (!encoding.empty() && encoding.size() < 8)
+    {
+        // 不同的表示要有不同的ETag
+        etag[etag_len++] = '-';
+        memcpy(etag + etag_len, encoding.data(), encoding.size());
+        etag_len += encoding.size();
+    }
+    etag[etag_len++] = '"';
+    std::string_view etag_view(etag, etag_len);
+    char last_modified[32];
+    std::string_view last_modified_view(last_modified, fmt_http_date(last_modified, mtime));
+
+    // If-Range里的校验值和当前文件对不上时，说明文件已经变了，要回送完整的文件
+    vector<ByteRange> ranges;
+    int range_state = RANGE_NONE;
+    if (headers.has(HEADER_RANGE))
+    {
+        bool if_range_ok = true;
+        if (headers.has(HEADER_IF_RANGE))
+        {
+            const string &validator = headers.get(HEADER_IF_RANGE);
+            if_range_ok = (validator == etag_view || validator == last_modified_view);
         }
-        int src_fd = open(file_name.c_str(), O_RDONLY, 0);
-        char *src_addr = static_cast<char*>(mmap(NULL, sbuf.st_size, PROT_READ, MAP_PRIVATE, src_fd, 0));
-        close(src_fd);
-    
-        // 发送文件并校验完整性
-        send_len = writen(fd, src_addr, sbuf.st_size);
-        if(send_len != sbuf.st_size){
-            perror("Send file failed");
-            return ANALYSIS_ERROR;
+        if (if_range_ok)
+            range_state = parse_range(headers.get(HEADER_RANGE), size, ranges);
+    }
+
+    HttpResponse response;
+    if (range_state == RANGE_UNSATISFIABLE)
+    {
+        response.status(416);
+        response.date();
+        response.append("Content-Range: bytes */");
+        response.headerNum("", size);
+        response.append("Content-length: 0\r\nConnection: close\r\n\r\n");
+        responseStart(416, response.size());
+        if (response.appendTo(out))
+            sendOutput();
+        return ANALYSIS_ERROR;
+    }
+
+    response.status(range_state == RANGE_SATISFIABLE ? 206 : 200);
+    response.date();
+    addConnectionHeaders(response);
+    response.append("Accept-Ranges: bytes\r\n");
+    response.header("ETag: ", etag_view);
+    response.header("Last-Modified: ", last_modified_view);
+    if (!encoding.empty())
+        response.header("Content-Encoding: ", encoding);
+    if (vary)
+        response.append("Vary: Accept-Encoding\r\n");
+
+    // 多个区间时用multipart/byteranges，先把每一段的分隔头拼好，才能算出Content-length
+    vector<string> part_heads;
+    off_t body_len = size;
+    if (range_state == RANGE_SATISFIABLE && ranges.size() == 1)
+    {
+        body_len = ranges[0].end - ranges[0].start + 1;
+        response.header("Content-type: ", filetype);
+        char content_range[80];
+        int cr_len = snprintf(content_range, sizeof(content_range), "bytes %ld-%ld/%ld",
+                              (long)ranges[0].start, (long)ranges[0].end, (long)size);
+        response.header("Content-Range: ", std::string_view(content_range, cr_len));
+    }
+    else if (range_state == RANGE_SATISFIABLE)
+    {
+        static unsigned long boundary_seq = 0;
+        char boundary[32];
+        snprintf(boundary, sizeof(boundary), "%08lx%08lx",
+                 (unsigned long)mtime ^ (unsigned long)size, __sync_add_and_fetch(&boundary_seq, 1));
+        body_len = 0;
+        for (size_t i = 0; i < ranges.size(); ++i)
+        {
+            char part[256];
+            int part_len = snprintf(part, sizeof(part),
+                                    "\r\n--%s\r\nContent-type: %.*s\r\nContent-Range: bytes %ld-%ld/%ld\r\n\r\n",
+                                    boundary, (int)filetype.size(), filetype.data(), (long)ranges[i].start, (long)ranges[i].end, (long)size);
+            part_heads.push_back(string(part, part_len));
+            body_len += part_len + (ranges[i].end - ranges[i].start + 1);
         }
-        munmap(src_addr, sbuf.st_size);
-        return ANALYSIS_SUCCESS;
+        part_heads.push_back("\r\n--" + string(boundary) + "--\r\n");
+        body_len += part_heads.back().size();
+        response.append("Content-type: multipart/byteranges; boundary=");
+        response.appendCopy(boundary);
+        response.append("\r\n");
     }
     else
+        response.header("Content-type: ", filetype);
+
+    // 通过Content-length返回正文大小
+    response.headerNum("Content-length: ", body_len);
+    response.end();
+    responseStart(range_state == RANGE_SATISFIABLE ? 206 : 200, response.size() + body_len);
+    if (range_state != RANGE_SATISFIABLE)
+        ranges.assign(1, ByteRange{0, size - 1});
+
+    // 响应头、分隔头和正文拼成一条链：正文已经在内存里(缓存的文件或者打包文件的映射)时引用内存，
+    // 和响应头一起一次writev发出去；否则引用文件的那一段，用sendfile发送
+    if (!response.appendTo(out))
         return ANALYSIS_ERROR;
+    for (size_t i = 0; i < ranges.size(); ++i)
+    {
+        if (!part_heads.empty())
+            out.appendCopy(part_heads[i]);
+        off_t part_len = ranges[i].end - ranges[i].start + 1;
+        if (part_len <= 0)
+            continue;
+        if (cached != NULL)
+            out.append(cached, ranges[i].start, part_len);
+        else if (mapped != NULL)
+            out.appendRef(std::string_view(mapped + base + ranges[i].start, part_len));
+        else
+            out.appendFile(src_fd, base + ranges[i].start, part_len);
+    }
+    if (!part_heads.empty())
+        out.appendCopy(part_heads.back());
+    int ret = sendOutput();
+    trace_stamp(trace, TRACE_HEADER);
+    return ret;
 }
 
 //发送错误信息
-void requestData::handleError(int fd, int err_num, string short_msg){
+void requestData::handleError(int err_num, string short_msg){
     short_msg = " " + short_msg;
-    char send_buff[MAX_BUFF];
-    string body_buff, header_buff;
+    string body_buff;
     body_buff += "<html><title>TKeed Error</title>";
     body_buff += "<body bgcolor=\"ffffff\">";
     body_buff += to_string(err_num) + short_msg;
     body_buff += "<hr><em> WeiXuan's Web Server</em>\n</body></html>";
 
-    header_buff += "HTTP/1.1 " + to_string(err_num) + short_msg + "\r\n";
-    header_buff += "Content-type: text/html\r\n";
-    header_buff += "Connection: close\r\n";
-    header_buff += "Content-length: " + to_string(body_buff.size()) + "\r\n";
-    header_buff += "\r\n";
-    sprintf(send_buff, "%s", header_buff.c_str());
-    writen(fd, send_buff, strlen(send_buff));
-    sprintf(send_buff, "%s", body_buff.c_str());
-    writen(fd, send_buff, strlen(send_buff));
+    HttpResponse response;
+    response.status(err_num);
+    response.date();
+    response.append("Content-type: text/html\r\nConnection: close\r\n");
+    response.headerNum("Content-length: ", body_buff.size());
+    response.end();
+    responseStart(err_num, response.size() + body_buff.size());
+    if (response.appendTo(out)){
+        out.appendCopy(body_buff);
+        sendOutput();
+    }
 }
 
-mytimer::mytimer(requestData *_request_data, int timeout): deleted(false), request_data(_request_data){
+mytimer::mytimer(requestData *_request_data, int timeout): deleted(false), wake(false), reason(TIMER_IDLE), request_data(_request_data){
     //cout << "mytimer()" << endl;
     struct timeval now;//timeval 中的tv_sec为1970年01月01日0点到创建struct timeval时的秒数，tv_usec为微秒数，
     gettimeofday(&now, NULL);//获取系统当前时间到1970年01月01日0点时struct timeval秒数，tv_usec微秒数，
@@ -534,6 +1243,12 @@ mytimer::mytimer(requestData *_request_data, int timeout): deleted(false), reque
 mytimer::~mytimer(){
     cout << "~mytimer()" << endl;
     if (request_data != NULL) {
+        ++server_metrics.timer_expired;
+        if (reason == TIMER_HEADER)
+            ++server_metrics.header_timeouts;
+        else if (reason == TIMER_SEND)
+            ++server_metrics.send_timeouts;
+        SWS_PROBE2(timer_expire, request_data->getFd(), expired_time);
         cout << "request_data=" << request_data << endl;
         delete request_data;
         request_data = NULL;
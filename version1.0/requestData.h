@@ -1,12 +1,24 @@
 #ifndef REQUESTDATA
 #define REQUESTDATA
 #include <string>
+#include <string_view>
+#include <atomic>
 #include <cstring>
 #include <unordered_map>
 #include "requestData.h"
 #include "util.h"
 #include "epoll.h"
+#include "tls.h"
+#include "response.h"
+#include "proxy.h"
+#include "trace.h"
+#include "bufchain.h"
+#include "header.h"
+#include "vhost.h"
+#include "microcache.h"
+#include "coroutine.h"
 #include <sys/epoll.h>
+#include <netinet/in.h>
 #include <unistd.h>
 #include <sys/time.h>
 #include <unordered_map>
@@ -19,10 +31,13 @@ using namespace std;
 
 const int STATE_PARSE_URI = 1;
 const int STATE_PARSE_HEADERS = 2;
-const int STATE_RECV_BODY = 3;
 const int STATE_ANALYSIS = 4;
 const int STATE_FINISH = 5;
+const int STATE_DEFERRED = 6;   //等IO线程把文件内容读进页缓存
+const int STATE_COROUTINE = 7;  //交给协程处理函数，见coroutine.h
+const int STATE_SENDING = 8;    //响应没写完，等EPOLLOUT之后接着写out里剩下的内容
 const int MAX_BUFF = 4096;
+const size_t READ_BUFFER_KEEP = 16384;  //一个请求结束后content保留的最大容量
 
 // 有请求出现但是读不到数据,可能是Request Aborted,
 // 或者来自网络的数据没有达到等原因,
@@ -39,24 +54,24 @@ const int PARSE_HEADER_SUCCESS = 0;
 
 const int ANALYSIS_ERROR = -2;
 const int ANALYSIS_SUCCESS = 0;
+const int ANALYSIS_DEFERRED = 1;    //文件不在页缓存里，请求已经交给IO线程
 
 const int METHOD_POST = 1;
 const int METHOD_GET = 2;
 const int HTTP_10 = 1;
 const int HTTP_11 = 2;
 
+// 定时器到期关闭连接时按原因计数
+const int TIMER_IDLE = 0;       //等下一个请求(或者新连接等第一个字节)
+const int TIMER_HEADER = 1;     //请求头没收完，正文没收完由协程里的co_read计时
+const int TIMER_SEND = 2;       //客户端不收响应
+
 const int EPOLL_WAIT_TIME = 500;
+const int REQUEST_TIME_OUT = 500;   //请求读到一半时等待剩余数据的超时(毫秒)，空闲长连接的超时见keepalive.h
 
-class MimeType
-{
-private:
-    static pthread_mutex_t lock;
-    static std::unordered_map<std::string, std::string> mime;
-    MimeType();
-    MimeType(const MimeType &m);
-public:
-    static std::string getMime(const std::string &suffix);
-};
+extern std::atomic<int> live_connections;   //当前客户端连接数
+extern std::atomic<bool> server_draining;   //升级中：不再保持长连接，处理完就关闭
+extern std::atomic<int> idle_connections;   //空闲长连接数
 
 enum HeadersState
 {
@@ -74,6 +89,9 @@ enum HeadersState
 struct mytimer;
 struct requestData;
 
+// 关闭最多max_evict个空闲最久的长连接，返回实际关闭的数目；只能在主循环里处理完一批事件之后调用
+int evict_idle_connections(int max_evict);
+
 struct requestData
 {
 private:
@@ -86,36 +104,103 @@ private:
     int method;
     int HTTPversion;
     std::string file_name;
+    std::string uri;    //请求行里的原始路径，包括'/'和查询串，转发给后端时原样使用
     int now_read_pos;
     int state;
     int h_state;
     bool isfinish;
     bool keep_alive;
-    std::unordered_map<std::string, std::string> headers;
+    RequestHeaders headers;
     mytimer *timer;
+    ssl_st *ssl;        //HTTPS连接的OpenSSL对象，明文连接为NULL
+    bool handshaked;
+    ConnIO io;          //所有对客户端的读写都经过这里
+    // 空闲长连接LRU链表的指针，链表头是空闲最久的连接
+    requestData *idle_prev;
+    requestData *idle_next;
+    bool in_idle_list;
+    int keepalive_ms;   //响应里通告给客户端的长连接超时，空闲定时器用同一个值
+    UpstreamGroup *upstream;    //这个请求要转发到的后端组，静态文件请求为NULL
+    VirtualHost *site;          //按Host选出的虚拟主机，NULL表示默认站点
+    struct sockaddr_in client_addr;     //客户端地址，限流和X-Forwarded-For用
+    // 推迟到IO线程读取的文件内容，defer_owned表示defer_fd要在读完后关闭
+    int defer_fd;
+    off_t defer_offset;
+    off_t defer_len;
+    bool defer_owned;
+    bool fetched;       //这个请求的文件内容已经由IO线程读过，不再探测
+    CoRequest *co;      //正在运行的协程处理函数，没有时为NULL
+    TraceRecord trace;  //抽中追踪时各阶段的时间戳
+    int resp_status;    //这个请求回送的状态码，还没有回送时为0
+    // 防慢速攻击：请求头和正文各自的绝对期限(monotonic_ms)，0表示还没开始计时
+    long long header_deadline;
+    long long body_deadline;
+    int head_bytes;     //这个请求目前为止收到的请求行和请求头字节数
+    // 路径缓存里还在有效期内的stat结果，有的话打开文件前不用再stat
+    struct stat path_stat;
+    bool path_stat_valid;
+    size_t resp_bytes;  //回送的字节数(头加正文)
+    // 还没写出去的响应，所有同步回送的响应都先放进这里再写
+    BufChain out;
+    bool close_after_send;      //out写完之后关闭连接(错误响应)
 
 private:
     int parse_URI();
     int parse_Headers();
     int analysisRequest();
+    void rearm(__uint32_t events, bool idle = false);
+    void idleUnlinkLocked();
+    int serveAdmin();
+    int serveMicroHit(const MicroHit &hit);
+    friend int evict_idle_connections(int max_evict);
+    int serveStaticFile(int src_fd, off_t base, off_t size, time_t mtime, std::string_view filetype,
+                        std::string_view encoding = std::string_view(), bool vary = false,
+                        BufSegment *cached = NULL, const char *mapped = NULL);
+    int serveBundle();
+    bool deferCold(int src_fd, off_t offset, off_t len, bool owned);
+    void responseStart(int status, size_t bytes);
+    bool withinDeadline(int read_num);
+    void startBodyClock();
+    bool headerTooLarge();
+    void requestDone();
+    int sendOutput();
+    void startCoroutine(CoHandler handler);
+    void resumeCoroutine();
+    bool armCoroutine();
 
 public:
 
     requestData();
-    requestData(int _epollfd, int _fd, std::string _path);
+    requestData(int _epollfd, int _fd, std::string _path, ssl_st *_ssl = NULL);
     ~requestData();
     void addTimer(mytimer *mtimer);
     void reset();
     void seperateTimer();
+    void leaveIdle();
     int getFd();
     void setFd(int _fd);
+    void setClientAddr(const struct sockaddr_in &addr);
     void handleRequest();
-    void handleError(int fd, int err_num, std::string short_msg);
+    // 主线程分发事件前调用，新请求按抽样率开始追踪
+    void traceDispatch();
+    void fetchDeferred();
+    void addConnectionHeaders(HttpResponse &response);
+    // 协程挂起时等待的是这个请求的事件，出错事件也要交给协程自己处理
+    bool coroutineWaiting() const { return co != NULL; }
+    // 主线程里：协程等待超时，撤掉它等待的描述符，之后由工作线程恢复执行
+    void wakeCoroutine();
+    // 别的线程上唤醒挂在co_park上的协程，见co_unpark
+    bool unparkCoroutine();
+    void handleError(int err_num, std::string short_msg);
+    // 反向代理的协程处理函数，由proxy_handler启动
+    CoTask serveProxy(CoRequest &req);
 };
 
 struct mytimer
 {
     bool deleted;
+    bool wake;          //超时后不关闭连接，而是唤醒挂起的协程
+    int reason;         //TIMER_IDLE/TIMER_HEADER/TIMER_SEND
     size_t expired_time;
     requestData *request_data;
 
@@ -0,0 +1,216 @@
+#include "response.h"
+#include "util.h"
+#include "bufchain.h"
+#include <string.h>
+
+static const char digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+// 从低位开始每次转换两位数字，最后再整体搬到buf开头
+int fmt_uint(char *buf, unsigned long value)
+{
+    char tmp[24];
+    char *p = tmp + sizeof(tmp);
+    while (value >= 100){
+        unsigned idx = (value % 100) * 2;
+        value /= 100;
+        *--p = digit_pairs[idx + 1];
+        *--p = digit_pairs[idx];
+    }
+    if (value >= 10){
+        unsigned idx = value * 2;
+        *--p = digit_pairs[idx + 1];
+        *--p = digit_pairs[idx];
+    }
+    else
+        *--p = '0' + value;
+    int len = tmp + sizeof(tmp) - p;
+    memcpy(buf, p, len);
+    return len;
+}
+
+int fmt_http_date(char *buf, time_t t)
+{
+    static const char wday[][4] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+    static const char month[][4] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                    "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+    struct tm tm_buf;
+    gmtime_r(&t, &tm_buf);
+    char *p = buf;
+    memcpy(p, wday[tm_buf.tm_wday], 3); p += 3;
+    *p++ = ','; *p++ = ' ';
+    *p++ = '0' + tm_buf.tm_mday / 10; *p++ = '0' + tm_buf.tm_mday % 10;
+    *p++ = ' ';
+    memcpy(p, month[tm_buf.tm_mon], 3); p += 3;
+    *p++ = ' ';
+    p += fmt_uint(p, tm_buf.tm_year + 1900);
+    *p++ = ' ';
+    *p++ = '0' + tm_buf.tm_hour / 10; *p++ = '0' + tm_buf.tm_hour % 10;
+    *p++ = ':';
+    *p++ = '0' + tm_buf.tm_min / 10; *p++ = '0' + tm_buf.tm_min % 10;
+    *p++ = ':';
+    *p++ = '0' + tm_buf.tm_sec / 10; *p++ = '0' + tm_buf.tm_sec % 10;
+    memcpy(p, " GMT", 4); p += 4;
+    return p - buf;
+}
+
+std::string_view http_date_now()
+{
+    static thread_local time_t cached_sec = 0;
+    static thread_local char cached[64];
+    static thread_local int cached_len = 0;
+    time_t now = time(NULL);
+    if (now != cached_sec){
+        cached_len = fmt_http_date(cached, now);
+        cached_sec = now;
+    }
+    return std::string_view(cached, cached_len);
+}
+
+std::string_view status_line(int code)
+{
+    switch (code){
+        case 200: return "HTTP/1.1 200 OK\r\n";
+        case 206: return "HTTP/1.1 206 Partial Content\r\n";
+        case 304: return "HTTP/1.1 304 Not Modified\r\n";
+        case 400: return "HTTP/1.1 400 Bad Request\r\n";
+        case 403: return "HTTP/1.1 403 Forbidden\r\n";
+        case 404: return "HTTP/1.1 404 Not Found\r\n";
+        case 408: return "HTTP/1.1 408 Request Timeout\r\n";
+        case 411: return "HTTP/1.1 411 Length Required\r\n";
+        case 413: return "HTTP/1.1 413 Payload Too Large\r\n";
+        case 414: return "HTTP/1.1 414 URI Too Long\r\n";
+        case 416: return "HTTP/1.1 416 Range Not Satisfiable\r\n";
+        case 429: return "HTTP/1.1 429 Too Many Requests\r\n";
+        case 431: return "HTTP/1.1 431 Request Header Fields Too Large\r\n";
+        case 500: return "HTTP/1.1 500 Internal Server Error\r\n";
+        case 502: return "HTTP/1.1 502 Bad Gateway\r\n";
+        case 503: return "HTTP/1.1 503 Service Unavailable\r\n";
+        case 504: return "HTTP/1.1 504 Gateway Timeout\r\n";
+        default: return std::string_view();
+    }
+}
+
+HttpResponse::HttpResponse(): iovcnt(0), scratch_len(0), total(0), overflow(false)
+{}
+
+void HttpResponse::push(const void *base, size_t len)
+{
+    if (len == 0)
+        return;
+    if (iovcnt == RESPONSE_MAX_IOV){
+        overflow = true;
+        return;
+    }
+    // 和上一个片段在内存上连续时直接合并
+    if (iovcnt > 0 && (const char*)iov[iovcnt - 1].iov_base + iov[iovcnt - 1].iov_len == base)
+        iov[iovcnt - 1].iov_len += len;
+    else{
+        iov[iovcnt].iov_base = const_cast<void*>(base);
+        iov[iovcnt].iov_len = len;
+        ++iovcnt;
+    }
+    total += len;
+}
+
+char *HttpResponse::reserve(size_t len)
+{
+    if (scratch_len + len > (size_t)RESPONSE_SCRATCH){
+        overflow = true;
+        return NULL;
+    }
+    char *p = scratch + scratch_len;
+    scratch_len += len;
+    return p;
+}
+
+void HttpResponse::status(int code)
+{
+    std::string_view line = status_line(code);
+    if (!line.empty()){
+        append(line);
+        return;
+    }
+    char *p = reserve(32);
+    if (p == NULL)
+        return;
+    int len = 0;
+    memcpy(p, "HTTP/1.1 ", 9); len += 9;
+    len += fmt_uint(p + len, code);
+    memcpy(p + len, " Unknown\r\n", 10); len += 10;
+    scratch_len -= 32 - len;
+    push(p, len);
+}
+
+void HttpResponse::date()
+{
+    append("Date: ");
+    appendCopy(http_date_now());
+    append("\r\n");
+}
+
+void HttpResponse::append(std::string_view fragment)
+{
+    push(fragment.data(), fragment.size());
+}
+
+void HttpResponse::appendCopy(std::string_view s)
+{
+    char *p = reserve(s.size());
+    if (p == NULL)
+        return;
+    memcpy(p, s.data(), s.size());
+    push(p, s.size());
+}
+
+void HttpResponse::header(std::string_view name, std::string_view value)
+{
+    append(name);
+    appendCopy(value);
+    append("\r\n");
+}
+
+void HttpResponse::headerNum(std::string_view name, unsigned long value)
+{
+    append(name);
+    char *p = reserve(20);
+    if (p == NULL)
+        return;
+    int len = fmt_uint(p, value);
+    scratch_len -= 20 - len;
+    push(p, len);
+    append("\r\n");
+}
+
+void HttpResponse::end()
+{
+    append("\r\n");
+}
+
+bool HttpResponse::appendTo(std::string &out) const
+{
+    if (overflow)
+        return false;
+    out.reserve(out.size() + total);
+    for (int i = 0; i < iovcnt; ++i)
+        out.append((const char*)iov[i].iov_base, iov[i].iov_len);
+    return true;
+}
+
+bool HttpResponse::appendTo(BufChain &out) const
+{
+    if (overflow)
+        return false;
+    for (int i = 0; i < iovcnt; ++i)
+        out.appendCopy(std::string_view((const char*)iov[i].iov_base, iov[i].iov_len));
+    return true;
+}
@@ -0,0 +1,58 @@
+#ifndef RESPONSE
+#define RESPONSE
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
+
+class BufChain;
+
+const int RESPONSE_MAX_IOV = 48;       //一个响应头最多的片段数
+const int RESPONSE_SCRATCH = 1024;     //动态内容(数字、日期、ETag等)的暂存区大小
+
+// 把无符号整数写到buf里(不加'\0')，返回写入的字节数，buf至少要20个字节
+int fmt_uint(char *buf, unsigned long value);
+// 按RFC 7231的IMF-fixdate格式化时间，例如"Sun, 06 Nov 1994 08:49:37 GMT"，固定29个字节
+int fmt_http_date(char *buf, time_t t);
+// 当前时间的Date字符串，每个线程缓存一份，每秒最多重新格式化一次
+std::string_view http_date_now();
+// 常用状态码的状态行(含\r\n)，是静态常量
+std::string_view status_line(int code);
+
+/* 响应头序列化：常量片段直接引用静态内存，
+   动态片段写进对象内部的暂存区，最后和正文一起用一次writev发出去 */
+class HttpResponse
+{
+private:
+    struct iovec iov[RESPONSE_MAX_IOV];
+    int iovcnt;
+    char scratch[RESPONSE_SCRATCH];
+    int scratch_len;
+    size_t total;
+    bool overflow;
+
+    void push(const void *base, size_t len);
+    char *reserve(size_t len);
+
+public:
+    HttpResponse();
+    void status(int code);
+    void date();
+    // 追加一个常量片段，调用者保证内存在appendTo()之前有效
+    void append(std::string_view fragment);
+    // 追加的内容会被拷贝进暂存区
+    void appendCopy(std::string_view s);
+    // name要包含冒号和空格，例如"Content-type: "
+    void header(std::string_view name, std::string_view value);
+    void headerNum(std::string_view name, unsigned long value);
+    void end();
+
+    size_t size() const { return total; }
+    // 把响应头拼接到out后面，给需要自己控制写入时机的调用者(协程处理函数)用，暂存区溢出时返回false
+    bool appendTo(std::string &out) const;
+    // 把响应头拷贝进out，后面可以接着引用共享的正文，暂存区溢出时返回false
+    bool appendTo(BufChain &out) const;
+};
+
+#endif
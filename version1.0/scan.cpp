@@ -0,0 +1,235 @@
+#include "scan.h"
+#include <string.h>
+#include <atomic>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86
+#endif
+
+typedef const char *(*ScanFn)(const char *p, const char *end, const char *set, int set_len);
+
+const unsigned long long SWAR_ONES = 0x0101010101010101ULL;
+const unsigned long long SWAR_HIGHS = 0x8080808080808080ULL;
+
+// 下面的实现按集合大小展开成模板，集合的字节放在寄存器里；分界符集合只有两三个字节，
+// 大的集合很少用，统一按SCAN_MAX_SET展开
+template <int N>
+static const char *scan_tail(const char *p, const char *end, const char *set)
+{
+    for (; p < end; ++p)
+        for (int k = 0; k < N; ++k)
+            if (*p == set[k])
+                return p;
+    return end;
+}
+
+// 不用向量指令，一次看8个字节：和集合里的每个字节异或，结果里有0字节就说明命中，
+// 命中的那8个字节再逐个找出位置；原来按位图逐字节查的版本比状态机还慢
+template <int N>
+static const char *scan_scalar(const char *p, const char *end, const char *set)
+{
+    unsigned long long patterns[N];
+    for (int k = 0; k < N; ++k)
+        patterns[k] = SWAR_ONES * (unsigned char)set[k];
+    while (end - p >= 8)
+    {
+        unsigned long long word;
+        memcpy(&word, p, 8);
+        unsigned long long hit = 0;
+        for (int k = 0; k < N; ++k)
+        {
+            unsigned long long x = word ^ patterns[k];
+            hit |= (x - SWAR_ONES) & ~x & SWAR_HIGHS;
+        }
+        if (hit != 0)
+            break;
+        p += 8;
+    }
+    return scan_tail<N>(p, end, set);
+}
+
+#ifdef SCAN_X86
+// 集合里每个字节各比较一次再合并，SSE2是x86-64的基线，不用检查CPUID。
+// 分界符只有两三个，这比PCMPESTRI快：后者一条指令延迟十几个周期，实测和原来的状态机差不多
+template <int N>
+static const char *scan_sse2(const char *p, const char *end, const char *set)
+{
+    __m128i needles[N];
+    for (int k = 0; k < N; ++k)
+        needles[k] = _mm_set1_epi8(set[k]);
+    while (end - p >= 16)
+    {
+        __m128i hay = _mm_loadu_si128((const __m128i*)p);
+        __m128i hit = _mm_cmpeq_epi8(hay, needles[0]);
+        for (int k = 1; k < N; ++k)
+            hit = _mm_or_si128(hit, _mm_cmpeq_epi8(hay, needles[k]));
+        unsigned mask = (unsigned)_mm_movemask_epi8(hit);
+        if (mask != 0)
+            return p + __builtin_ctz(mask);
+        p += 16;
+    }
+    // 不足16字节的尾部不能越过end去读
+    return scan_scalar<N>(p, end, set);
+}
+
+// 和SSE2的做法一样，一次32个字节；尾部也在这个函数里用VEX编码的16字节比较做完，
+// 不回到非VEX的SSE2代码，免得在两种编码之间切换的开销
+template <int N>
+__attribute__((target("avx2")))
+static const char *scan_avx2(const char *p, const char *end, const char *set)
+{
+    __m256i needles[N];
+    for (int k = 0; k < N; ++k)
+        needles[k] = _mm256_set1_epi8(set[k]);
+    // 首部的键和大多数值都不到16字节，先看一次16字节，命中了就不用碰32字节的寄存器
+    if (end - p >= 16)
+    {
+        __m128i hay = _mm_loadu_si128((const __m128i*)p);
+        __m128i hit = _mm_cmpeq_epi8(hay, _mm256_castsi256_si128(needles[0]));
+        for (int k = 1; k < N; ++k)
+            hit = _mm_or_si128(hit, _mm_cmpeq_epi8(hay, _mm256_castsi256_si128(needles[k])));
+        unsigned mask = (unsigned)_mm_movemask_epi8(hit);
+        if (mask != 0)
+            return p + __builtin_ctz(mask);
+        p += 16;
+    }
+    while (end - p >= 32)
+    {
+        __m256i hay = _mm256_loadu_si256((const __m256i*)p);
+        __m256i hit = _mm256_cmpeq_epi8(hay, needles[0]);
+        for (int k = 1; k < N; ++k)
+            hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(hay, needles[k]));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(hit);
+        if (mask != 0)
+            return p + __builtin_ctz(mask);
+        p += 32;
+    }
+    if (end - p >= 16)
+    {
+        __m128i hay = _mm_loadu_si128((const __m128i*)p);
+        __m128i hit = _mm_cmpeq_epi8(hay, _mm256_castsi256_si128(needles[0]));
+        for (int k = 1; k < N; ++k)
+            hit = _mm_or_si128(hit, _mm_cmpeq_epi8(hay, _mm256_castsi256_si128(needles[k])));
+        unsigned mask = (unsigned)_mm_movemask_epi8(hit);
+        if (mask != 0)
+            return p + __builtin_ctz(mask);
+        p += 16;
+    }
+    return scan_tail<N>(p, end, set);
+}
+#endif
+
+// 按集合大小分派到展开好的模板
+#define SCAN_DISPATCH(impl)                                                                 \
+    static const char *impl##_any(const char *p, const char *end, const char *set, int set_len) \
+    {                                                                                       \
+        if (set_len == 2)                                                                   \
+            return impl<2>(p, end, set);                                                    \
+        if (set_len == 3)                                                                   \
+            return impl<3>(p, end, set);                                                    \
+        char padded[SCAN_MAX_SET];                                                          \
+        for (int k = 0; k < SCAN_MAX_SET; ++k)                                              \
+            padded[k] = set[k < set_len ? k : 0];                                           \
+        return impl<SCAN_MAX_SET>(p, end, padded);                                          \
+    }
+
+SCAN_DISPATCH(scan_scalar)
+#ifdef SCAN_X86
+SCAN_DISPATCH(scan_sse2)
+SCAN_DISPATCH(scan_avx2)
+#endif
+
+static bool cpu_supports(int level)
+{
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (level == SCAN_AVX2)
+        return __builtin_cpu_supports("avx2");
+    if (level == SCAN_SSE2)
+        return true;
+#endif
+    return level == SCAN_SCALAR;
+}
+
+static ScanFn scan_fn(int level)
+{
+#ifdef SCAN_X86
+    if (level == SCAN_AVX2)
+        return scan_avx2_any;
+    if (level == SCAN_SSE2)
+        return scan_sse2_any;
+#endif
+    return scan_scalar_any;
+}
+
+static int best_level()
+{
+    if (cpu_supports(SCAN_AVX2))
+        return SCAN_AVX2;
+    if (cpu_supports(SCAN_SSE2))
+        return SCAN_SSE2;
+    return SCAN_SCALAR;
+}
+
+// 程序启动时(静态初始化，早于任何线程)就选好，之后只有基准测试会用scan_select切换
+static std::atomic<int> current_level(best_level());
+static std::atomic<ScanFn> current_fn(scan_fn(current_level.load()));
+
+const char *scan_any(const char *p, const char *end, const char *set, int set_len)
+{
+    // 单个字节时glibc的memchr已经是向量化的
+    if (set_len == 1)
+    {
+        const char *hit = (const char*)memchr(p, set[0], end - p);
+        return hit != NULL ? hit : end;
+    }
+    return current_fn.load(std::memory_order_relaxed)(p, end, set, set_len);
+}
+
+bool scan_select(int level)
+{
+    if (!cpu_supports(level))
+        return false;
+    current_level = level;
+    current_fn = scan_fn(level);
+    return true;
+}
+
+const char *scan_impl_name()
+{
+    int level = current_level;
+    if (level == SCAN_AVX2)
+        return "avx2";
+    if (level == SCAN_SSE2)
+        return "sse2";
+    return "scalar";
+}
+
+int scan_header_line(const char *p, const char *end, HeaderLine &line)
+{
+    const char *colon = scan_any(p, end, "\r\n:", 3);
+    if (colon == end)
+        return SCAN_LINE_AGAIN;
+    if (*colon != ':' || colon == p)
+        return SCAN_LINE_ERROR;
+    if (end - colon < 2)
+        return SCAN_LINE_AGAIN;
+    if (colon[1] != ' ')
+        return SCAN_LINE_ERROR;
+    const char *value = colon + 2;
+    const char *eol = scan_any(value, end, "\r\n", 2);
+    if (eol == end)
+        return SCAN_LINE_AGAIN;
+    if (*eol != '\r' || eol == value)
+        return SCAN_LINE_ERROR;
+    if (end - eol < 2)
+        return SCAN_LINE_AGAIN;
+    if (eol[1] != '\n')
+        return SCAN_LINE_ERROR;
+    line.key = p;
+    line.key_len = colon - p;
+    line.value = value;
+    line.value_len = eol - value;
+    line.next = eol + 2;
+    return SCAN_LINE_OK;
+}
@@ -0,0 +1,39 @@
+#ifndef SCAN
+#define SCAN
+#include <stddef.h>
+
+/* 请求行和首部的字节扫描：在一段内存里找第一个属于给定集合的字节(CR、LF、冒号、空格这类分界符)，
+   x86上一次比较16(SSE2)或32(AVX2)个字节，程序启动时按CPUID选好实现，
+   其它平台用一次看8个字节的SWAR版本。编译不需要-mavx2，AVX2版本用target属性单独编译。
+   PCMPESTRI(SSE4.2)试过，延迟太高，和逐字节的状态机差不多，没有保留 */
+
+const int SCAN_SCALAR = 0;
+const int SCAN_SSE2 = 1;
+const int SCAN_AVX2 = 2;
+const int SCAN_MAX_SET = 16;            //集合最多的字节数
+
+const int SCAN_LINE_OK = 0;
+const int SCAN_LINE_AGAIN = 1;          //这一行还没收完
+const int SCAN_LINE_ERROR = -1;
+
+// 返回[p, end)里第一个属于set的字节的位置，没有时返回end
+const char *scan_any(const char *p, const char *end, const char *set, int set_len);
+// 强制使用某一级实现(基准测试对比用)，CPU不支持时返回false
+bool scan_select(int level);
+// 当前使用的实现，"scalar"/"sse2"/"avx2"
+const char *scan_impl_name();
+
+struct HeaderLine
+{
+    const char *key;
+    size_t key_len;
+    const char *value;
+    size_t value_len;
+    const char *next;                   //下一行的开头
+};
+
+// 解析一行"key: value\r\n"，冒号后面必须正好跟一个空格，值不能为空；
+// 值的长度不在这里限制，整个请求头的大小由max_header_size边收边检查
+int scan_header_line(const char *p, const char *end, HeaderLine &line);
+
+#endif
@@ -1,4 +1,5 @@
 #include "threadpool.h"
+#include <string.h>
 
 /* 线程池创建并初始化 */
 threadpool_t *threadpool_create(int thread_count, int queue_size, int flags) {
@@ -21,6 +22,9 @@ threadpool_t *threadpool_create(int thread_count, int queue_size, int flags) {
         pool->queue_size = queue_size;                  //初始化请求队列大小
         pool->head = pool->tail = pool->count = 0;      //初始化请求队列头,尾，队列中任务数量
         pool->shutdown = pool->started = 0;             //初始化启动和关闭标志为0
+        pool->target_count = thread_count;
+        pool->threads_capacity = thread_count;
+        pool->name[0] = '\0';
         pool->threads = (pthread_t *)malloc(sizeof(pthread_t) * thread_count);              //初始化线程池中线程队列
         pool->queue = (threadpool_task_t *)malloc(sizeof(threadpool_task_t) * queue_size);  //初始化线程池中任务队列 
     
@@ -166,6 +170,65 @@ int threadpool_free(threadpool_t *pool)
     return 0;
 }
 
+// 调整线程数目：变多时直接创建新线程，变少时通知空闲线程自己退出
+int threadpool_resize(threadpool_t *pool, int thread_count)
+{
+    if(pool == NULL || thread_count <= 0 || thread_count > MAX_THREADS) {
+        return THREADPOOL_INVALID;
+    }
+    if(pthread_mutex_lock(&(pool->lock)) != 0) {
+        return THREADPOOL_LOCK_FAILURE;
+    }
+    int err = 0;
+    do {
+        if(pool->shutdown) {
+            err = THREADPOOL_SHUTDOWN;
+            break;
+        }
+        pool->target_count = thread_count;
+        if(thread_count > pool->threads_capacity) {
+            pthread_t *threads = (pthread_t *)realloc(pool->threads, sizeof(pthread_t) * thread_count);
+            if(threads == NULL) {
+                err = THREADPOOL_INVALID;
+                break;
+            }
+            pool->threads = threads;
+            pool->threads_capacity = thread_count;
+        }
+        while(pool->thread_count < thread_count) {
+            if(pthread_create(&(pool->threads[pool->thread_count]), NULL, threadpool_thread, (void*)pool) != 0) {
+                err = THREADPOOL_THREAD_FAILURE;
+                break;
+            }
+            if(pool->name[0] != '\0')
+                pthread_setname_np(pool->threads[pool->thread_count], pool->name);
+            pool->thread_count++;
+            pool->started++;
+        }
+        if(pool->thread_count > thread_count && pthread_cond_broadcast(&(pool->notify)) != 0) {
+            err = THREADPOOL_LOCK_FAILURE;
+        }
+    } while(false);
+
+    if(pthread_mutex_unlock(&(pool->lock)) != 0) {
+        err = THREADPOOL_LOCK_FAILURE;
+    }
+    return err;
+}
+
+int threadpool_set_name(threadpool_t *pool, const char *name) {
+    if(pool == NULL || pthread_mutex_lock(&(pool->lock)) != 0) {
+        return THREADPOOL_LOCK_FAILURE;
+    }
+    strncpy(pool->name, name, sizeof(pool->name) - 1);
+    pool->name[sizeof(pool->name) - 1] = '\0';
+    for(int i = 0; i < pool->thread_count; ++i) {
+        pthread_setname_np(pool->threads[i], pool->name);
+    }
+    pthread_mutex_unlock(&(pool->lock));
+    return 0;
+}
+
 // 线程绑定函数：从请求队列中，取出第一个任务，并去执行；如果没有任务，则阻塞
 static void *threadpool_thread(void *threadpool)
 {
@@ -183,10 +246,29 @@ static void *threadpool_thread(void *threadpool)
                 因为wait函数内部在调用阻塞的时候，会对互斥锁进行解锁，
                 这样子生产者那边才可以继续加锁生产数据，解锁发送唤醒信号，
                 当wait函数收到唤醒信号后解除阻塞，继续向下执行，会重新加锁   */
-        while((pool->count == 0) && (!pool->shutdown)) {
+        while((pool->count == 0) && (!pool->shutdown) && (pool->thread_count <= pool->target_count)) {
             pthread_cond_wait(&(pool->notify), &(pool->lock));
         }
 
+        // 线程池被缩小了：把自己从threads数组里摘掉后退出，不需要别人来join
+        if(!pool->shutdown && pool->thread_count > pool->target_count) {
+            pthread_t self = pthread_self();
+            for(int i = 0; i < pool->thread_count; ++i) {
+                if(pthread_equal(pool->threads[i], self)) {
+                    pool->threads[i] = pool->threads[pool->thread_count - 1];
+                    break;
+                }
+            }
+            --pool->thread_count;
+            --pool->started;
+            if(pool->count > 0) {//唤醒自己的信号可能是给任务的，转交给别的线程
+                pthread_cond_signal(&(pool->notify));
+            }
+            pthread_detach(self);
+            pthread_mutex_unlock(&(pool->lock));
+            pthread_exit(NULL);
+        }
+
      /* ----- 该线程获取执行权以后,开始执行任务处理环节----- */
         //如果此时线程池已经标志关闭了，则该线程退出
         if((pool->shutdown == immediate_shutdown) ||  ((pool->shutdown == graceful_shutdown) && (pool->count == 0))) {
@@ -40,12 +40,17 @@ struct threadpool_t
     int count;                       //挂在队列中任务数目
     int shutdown;                    //线程池关闭标志
     int started;                     //已经启动的线程数量
+    int target_count;                //期望的线程数目，比thread_count少时多出来的线程会自己退出
+    int threads_capacity;            //threads数组的容量
+    char name[16];                   //线程名，在top、perf和采样剖析的结果里区分不同的线程池
 };
 
 threadpool_t *threadpool_create(int thread_count, int queue_size, int flags);                //线程池创建并初始化        
 int threadpool_add(threadpool_t *pool, void (*function)(void *), void *argument, int flags); //给线程池中添加任务
 int threadpool_destroy(threadpool_t *pool, int flags);                                       //按照正常流程，摧毁线程池
-int threadpool_free(threadpool_t *pool);                                                     //直接释放线程池
+int threadpool_free(threadpool_t *pool);
+int threadpool_set_name(threadpool_t *pool, const char *name);                              //给所有线程起名，之后新建的线程用同一个名字
+int threadpool_resize(threadpool_t *pool, int thread_count);                                 //调整线程数目，不影响队列中的任务                                                     //直接释放线程池
 static void *threadpool_thread(void *threadpool);                                            //线程绑定函数：从请求队列中，取出第一个任务，并去执行                                        //从线程池中取出线程，去执行请求队列的第一个任务
 
 #endif
\ No newline at end of file
@@ -0,0 +1,330 @@
+#include "tls.h"
+#include "util.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef USE_KTLS
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+static SSL_CTX *ssl_ctx = NULL;
+
+int tls_init(const char *cert_file, const char *key_file)
+{
+    ssl_ctx = SSL_CTX_new(TLS_server_method());
+    if (ssl_ctx == NULL){
+        ERR_print_errors_fp(stderr);
+        return -1;
+    }
+    SSL_CTX_set_min_proto_version(ssl_ctx, TLS1_2_VERSION);
+    // 让OpenSSL在握手完成后把密钥交给内核
+    SSL_CTX_set_options(ssl_ctx, SSL_OP_ENABLE_KTLS);
+    // 握手后不再发NewSessionTicket，避免握手之后还有用户态要写的数据
+    SSL_CTX_set_num_tickets(ssl_ctx, 0);
+    // socket写不进去时SSL_write返回WANT_WRITE，没写完的部分留在发送链里，可写之后从同一个位置重试，
+    // 重试时缓冲区的地址可能变了(用户态拼成记录的临时缓冲区)
+    SSL_CTX_set_mode(ssl_ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    // kTLS只支持AES-GCM和CHACHA20-POLY1305
+    SSL_CTX_set_cipher_list(ssl_ctx, "ECDHE+AESGCM:ECDHE+CHACHA20");
+    SSL_CTX_set_ciphersuites(ssl_ctx, "TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384:TLS_CHACHA20_POLY1305_SHA256");
+    if (SSL_CTX_use_certificate_chain_file(ssl_ctx, cert_file) <= 0
+        || SSL_CTX_use_PrivateKey_file(ssl_ctx, key_file, SSL_FILETYPE_PEM) <= 0
+        || SSL_CTX_check_private_key(ssl_ctx) <= 0)
+    {
+        ERR_print_errors_fp(stderr);
+        SSL_CTX_free(ssl_ctx);
+        ssl_ctx = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+bool tls_enabled()
+{
+    return ssl_ctx != NULL;
+}
+
+ssl_st *tls_new(int fd)
+{
+    SSL *ssl = SSL_new(ssl_ctx);
+    if (ssl == NULL)
+        return NULL;
+    if (SSL_set_fd(ssl, fd) != 1){
+        SSL_free(ssl);
+        return NULL;
+    }
+    SSL_set_accept_state(ssl);
+    return ssl;
+}
+
+int tls_handshake(ssl_st *ssl)
+{
+    ERR_clear_error();
+    int ret = SSL_do_handshake(ssl);
+    if (ret == 1)
+        return TLS_HANDSHAKE_DONE;
+    switch (SSL_get_error(ssl, ret)){
+        case SSL_ERROR_WANT_READ:
+            return TLS_HANDSHAKE_WANT_READ;
+        case SSL_ERROR_WANT_WRITE:
+            return TLS_HANDSHAKE_WANT_WRITE;
+        default:
+            return TLS_HANDSHAKE_ERROR;
+    }
+}
+
+bool tls_ktls_send(ssl_st *ssl)
+{
+    return BIO_get_ktls_send(SSL_get_wbio(ssl));
+}
+
+bool tls_ktls_recv(ssl_st *ssl)
+{
+    return BIO_get_ktls_recv(SSL_get_rbio(ssl));
+}
+
+void tls_free(ssl_st *ssl)
+{
+    if (ssl == NULL)
+        return;
+    // 尽力发一个close_notify，不等对端回应
+    if (SSL_is_init_finished(ssl))
+        SSL_shutdown(ssl);
+    SSL_free(ssl);
+}
+
+// 和writen一样不阻塞：写不进去时返回已经写出的字节数，errno为EAGAIN
+static ssize_t ssl_writen(SSL *ssl, int fd, const void *buff, size_t n)
+{
+    const char *ptr = (const char*)buff;
+    size_t done = 0;
+    while (done < n){
+        ERR_clear_error();
+        int ret = SSL_write(ssl, ptr + done, (int)(n - done));
+        if (ret > 0){
+            done += ret;
+            continue;
+        }
+        int err = SSL_get_error(ssl, ret);
+        if (err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ){
+            errno = EAGAIN;
+            return done;
+        }
+        return -1;
+    }
+    return done;
+}
+
+// OpenSSL一次最多交出一条记录(16KB)，用户态解密时先读到记录大小的缓冲区再追加
+ssize_t ConnIO::readAppend(std::string &buf, size_t limit) const
+{
+    if (ssl == NULL)
+        return ::read_append(fd, buf, limit);
+    static thread_local char record[16384];
+    ssize_t readSum = 0;
+    while ((size_t)readSum < limit)
+    {
+        size_t want = limit - readSum < sizeof(record) ? limit - readSum : sizeof(record);
+        ssize_t nread = readn(record, want);
+        if (nread <= 0)
+            return readSum > 0 ? readSum : nread;
+        buf.append(record, nread);
+        readSum += nread;
+        if ((size_t)nread < want)
+            break;
+    }
+    return readSum;
+}
+
+ssize_t ConnIO::readn(void *buff, size_t n) const
+{
+    if (ssl == NULL)
+        return ::readn(fd, buff, n);
+    size_t nleft = n;
+    ssize_t readSum = 0;
+    char *ptr = (char*)buff;
+    while (nleft > 0)
+    {
+        ERR_clear_error();
+        int nread = SSL_read(ssl, ptr, (int)nleft);
+        if (nread <= 0){
+            int err = SSL_get_error(ssl, nread);
+            if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE){
+                errno = EAGAIN;
+                return readSum;
+            }
+            else if (err == SSL_ERROR_ZERO_RETURN){
+                errno = 0;
+                break;
+            }
+            return -1;
+        }
+        readSum += nread;
+        nleft -= nread;
+        ptr += nread;
+    }
+    return readSum;
+}
+
+ssize_t ConnIO::writen(const void *buff, size_t n) const
+{
+    if (ssl == NULL)
+        return ::writen(fd, const_cast<void*>(buff), n);
+    return ssl_writen(ssl, fd, buff, n);
+}
+
+// 用户态加密时把小片段拼成一个TLS记录再写，减少记录数；写不进去时返回已经写出的字节数，
+// 下次从同一个位置重试，拼出来的记录开头和这次一样
+ssize_t ConnIO::writevn(struct iovec *iov, int iovcnt) const
+{
+    if (ssl == NULL)
+        return ::writevn(fd, iov, iovcnt);
+    char buff[16384];
+    size_t used = 0;
+    ssize_t writeSum = 0;
+    for (int i = 0; i < iovcnt; ++i){
+        const char *p = (const char*)iov[i].iov_base;
+        size_t left = iov[i].iov_len;
+        while (left > 0){
+            if (used == 0 && left >= sizeof(buff)){
+                ssize_t nwritten = ssl_writen(ssl, fd, p, left);
+                if (nwritten < 0)
+                    return -1;
+                writeSum += nwritten;
+                if ((size_t)nwritten < left)
+                    return writeSum;
+                break;
+            }
+            size_t n = left < sizeof(buff) - used ? left : sizeof(buff) - used;
+            memcpy(buff + used, p, n);
+            used += n;
+            p += n;
+            left -= n;
+            if (used == sizeof(buff)){
+                ssize_t nwritten = ssl_writen(ssl, fd, buff, used);
+                if (nwritten < 0)
+                    return -1;
+                writeSum += nwritten;
+                if ((size_t)nwritten < used)
+                    return writeSum;
+                used = 0;
+            }
+        }
+    }
+    if (used > 0){
+        ssize_t nwritten = ssl_writen(ssl, fd, buff, used);
+        if (nwritten < 0)
+            return -1;
+        writeSum += nwritten;
+    }
+    return writeSum;
+}
+
+ssize_t ConnIO::sendfilen(int in_fd, off_t offset, size_t n) const
+{
+    if (ssl == NULL)
+        return ::sendfilen(fd, in_fd, offset, n);
+    ssize_t sendSum = 0;
+    if (tls_ktls_send(ssl)){
+        // 只有发送方向由内核接管时，仍然可以让OpenSSL调用sendfile
+        while ((size_t)sendSum < n){
+            ERR_clear_error();
+            ossl_ssize_t ret = SSL_sendfile(ssl, in_fd, offset + sendSum, n - sendSum, 0);
+            if (ret > 0){
+                sendSum += ret;
+                continue;
+            }
+            int err = SSL_get_error(ssl, (int)ret);
+            if (err == SSL_ERROR_WANT_WRITE || (err == SSL_ERROR_SYSCALL && errno == EAGAIN)){
+                errno = EAGAIN;
+                return sendSum;
+            }
+            return sendSum > 0 ? sendSum : -1;
+        }
+        return sendSum;
+    }
+    // 没有kTLS：分块pread之后在用户态加密，内存占用固定；写不进去的那一块下次重新pread
+    char buff[16384];
+    while ((size_t)sendSum < n){
+        size_t want = n - sendSum < sizeof(buff) ? n - sendSum : sizeof(buff);
+        ssize_t nread = pread(in_fd, buff, want, offset + sendSum);
+        if (nread < 0 && errno == EINTR)
+            continue;
+        if (nread <= 0){
+            errno = EIO;
+            return sendSum;
+        }
+        ssize_t nwritten = ssl_writen(ssl, fd, buff, nread);
+        if (nwritten < 0)
+            return -1;
+        sendSum += nwritten;
+        if (nwritten < nread)
+            return sendSum;
+    }
+    return sendSum;
+}
+
+#else
+
+int tls_init(const char *cert_file, const char *key_file)
+{
+    fprintf(stderr, "HTTPS disabled: rebuild with -DUSE_KTLS -lssl -lcrypto\n");
+    return -1;
+}
+
+bool tls_enabled()
+{
+    return false;
+}
+
+ssl_st *tls_new(int fd)
+{
+    return NULL;
+}
+
+int tls_handshake(ssl_st *ssl)
+{
+    return TLS_HANDSHAKE_ERROR;
+}
+
+bool tls_ktls_send(ssl_st *ssl)
+{
+    return false;
+}
+
+bool tls_ktls_recv(ssl_st *ssl)
+{
+    return false;
+}
+
+void tls_free(ssl_st *ssl)
+{}
+
+ssize_t ConnIO::readn(void *buff, size_t n) const
+{
+    return ::readn(fd, buff, n);
+}
+
+ssize_t ConnIO::readAppend(std::string &buf, size_t limit) const
+{
+    return ::read_append(fd, buf, limit);
+}
+
+ssize_t ConnIO::writen(const void *buff, size_t n) const
+{
+    return ::writen(fd, const_cast<void*>(buff), n);
+}
+
+ssize_t ConnIO::writevn(struct iovec *iov, int iovcnt) const
+{
+    return ::writevn(fd, iov, iovcnt);
+}
+
+ssize_t ConnIO::sendfilen(int in_fd, off_t offset, size_t n) const
+{
+    return ::sendfilen(fd, in_fd, offset, n);
+}
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef TLS
+#define TLS
+#include <cstddef>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <string>
+
+/* HTTPS支持：握手在用户态由OpenSSL完成，握手结束后OpenSSL通过
+   setsockopt(SOL_TLS, TLS_TX/TLS_RX)把对称密钥交给内核(kTLS)，
+   之后加解密都在内核里做，静态文件仍然可以走sendfile零拷贝。
+   内核不支持kTLS时退回到OpenSSL在用户态加解密。
+   需要编译时定义USE_KTLS并链接-lssl -lcrypto，否则只提供明文的桩实现 */
+
+struct ssl_st;
+
+const int TLS_HANDSHAKE_DONE = 0;
+const int TLS_HANDSHAKE_WANT_READ = 1;
+const int TLS_HANDSHAKE_WANT_WRITE = 2;
+const int TLS_HANDSHAKE_ERROR = -1;
+
+int tls_init(const char *cert_file, const char *key_file);  //加载证书和私钥，成功返回0
+bool tls_enabled();
+ssl_st *tls_new(int fd);
+int tls_handshake(ssl_st *ssl);
+bool tls_ktls_send(ssl_st *ssl);  //发送方向已经由内核接管
+bool tls_ktls_recv(ssl_st *ssl);  //接收方向已经由内核接管
+void tls_free(ssl_st *ssl);
+
+// 一个连接上的读写出口：明文连接和kTLS收发都已开启的连接直接走系统调用，
+// 否则经过OpenSSL；语义和util.h里同名的函数一致，写函数在发送缓冲区满时返回已经写出的字节数，errno为EAGAIN
+struct ConnIO
+{
+    int fd;
+    ssl_st *ssl;
+
+    ConnIO(int _fd = -1, ssl_st *_ssl = NULL): fd(_fd), ssl(_ssl) {}
+    ssize_t readn(void *buff, size_t n) const;
+    ssize_t readAppend(std::string &buf, size_t limit) const;
+    ssize_t writen(const void *buff, size_t n) const;
+    ssize_t writevn(struct iovec *iov, int iovcnt) const;
+    ssize_t sendfilen(int in_fd, off_t offset, size_t n) const;
+};
+
+#endif
@@ -0,0 +1,203 @@
+// 把一个目录打包成服务器可以直接mmap的打包文件，格式见bundle.h
+// 编译：g++ -O2 tools/bundlePack.cpp mime.cpp -o bundlePack
+// 运行：./bundlePack <docroot> <输出文件>
+// 同目录下的x.gz/x.br会作为x的预压缩版本一起打包，没有对应原文件时按普通文件打包
+#include "../bundle.h"
+#include "../mime.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <map>
+#include <string>
+#include <vector>
+using namespace std;
+
+struct PackFile
+{
+    string path;                        //相对docroot，不带开头的'/'
+    string sources[BUNDLE_VARIANTS];    //每种表示对应的磁盘文件，空表示没有
+    uint64_t sizes[BUNDLE_VARIANTS];
+    int64_t mtime;
+};
+
+static string root;
+static map<string, struct stat> found;
+
+static int collect(const char *fpath, const struct stat *sb, int typeflag, struct FTW *)
+{
+    if (typeflag == FTW_F && S_ISREG(sb->st_mode))
+        found[string(fpath + root.size() + 1)] = *sb;
+    return 0;
+}
+
+static bool ends_with(const string &s, const char *suffix)
+{
+    size_t len = strlen(suffix);
+    return s.size() > len && s.compare(s.size() - len, len, suffix) == 0;
+}
+
+static uint64_t align_up(uint64_t value, uint64_t align)
+{
+    return (value + align - 1) / align * align;
+}
+
+static bool copy_file(int out_fd, const string &src, uint64_t offset, uint64_t size)
+{
+    int in_fd = open(src.c_str(), O_RDONLY);
+    if (in_fd < 0)
+        return false;
+    char buff[1 << 16];
+    uint64_t done = 0;
+    while (done < size)
+    {
+        ssize_t n = read(in_fd, buff, sizeof(buff));
+        if (n <= 0)
+            break;
+        if (pwrite(out_fd, buff, n, offset + done) != n)
+            break;
+        done += n;
+    }
+    close(in_fd);
+    return done == size;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3)
+    {
+        fprintf(stderr, "usage: %s <docroot> <bundle>\n", argv[0]);
+        return 1;
+    }
+    root = argv[1];
+    while (root.size() > 1 && root.back() == '/')
+        root.pop_back();
+    if (nftw(root.c_str(), collect, 64, FTW_PHYS) != 0)
+    {
+        perror("walk docroot failed");
+        return 1;
+    }
+
+    // 预压缩文件挂到原文件下面
+    vector<PackFile> files;
+    map<string, size_t> index;
+    for (map<string, struct stat>::iterator it = found.begin(); it != found.end(); ++it)
+    {
+        const string &path = it->first;
+        if ((ends_with(path, ".gz") && found.count(path.substr(0, path.size() - 3)))
+            || (ends_with(path, ".br") && found.count(path.substr(0, path.size() - 3))))
+            continue;
+        if (path.size() > 0xffff)
+        {
+            fprintf(stderr, "path too long: %s\n", path.c_str());
+            return 1;
+        }
+        PackFile file;
+        file.path = path;
+        file.sources[BUNDLE_IDENTITY] = root + "/" + path;
+        file.sizes[BUNDLE_IDENTITY] = it->second.st_size;
+        file.sizes[BUNDLE_GZIP] = file.sizes[BUNDLE_BROTLI] = 0;
+        file.mtime = it->second.st_mtime;
+        const char *suffixes[BUNDLE_VARIANTS] = {"", ".gz", ".br"};
+        for (int v = BUNDLE_GZIP; v < BUNDLE_VARIANTS; ++v)
+        {
+            map<string, struct stat>::iterator sidecar = found.find(path + suffixes[v]);
+            if (sidecar != found.end() && sidecar->second.st_size > 0)
+            {
+                file.sources[v] = root + "/" + sidecar->first;
+                file.sizes[v] = sidecar->second.st_size;
+            }
+        }
+        index[path] = files.size();
+        files.push_back(file);
+    }
+
+    uint32_t table_size = 16;
+    while (table_size < files.size() * 2)
+        table_size <<= 1;
+    uint64_t page = sysconf(_SC_PAGESIZE);
+
+    // 字符串区：路径，然后是去重后的Content-type
+    string strings;
+    vector<BundleEntry> table(table_size);
+    memset(table.data(), 0, sizeof(BundleEntry) * table_size);
+    map<string, uint32_t> mime_offsets;
+    vector<uint32_t> slots(files.size());
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        BundleEntry entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.hash = bundle_hash(files[i].path);
+        entry.path_offset = strings.size();
+        entry.path_len = files[i].path.size();
+        strings += files[i].path;
+        string mime(MimeType::fromFileName(files[i].path));
+        if (!mime_offsets.count(mime))
+        {
+            mime_offsets[mime] = strings.size();
+            strings += mime;
+        }
+        entry.mime_offset = mime_offsets[mime];
+        entry.mime_len = mime.size();
+        entry.mtime = files[i].mtime;
+        uint32_t slot = entry.hash & (table_size - 1);
+        while (table[slot].hash != 0)
+            slot = (slot + 1) & (table_size - 1);
+        table[slot] = entry;
+        slots[i] = slot;
+    }
+
+    BundleHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, BUNDLE_MAGIC, sizeof(BUNDLE_MAGIC));
+    header.version = BUNDLE_VERSION;
+    header.entry_count = files.size();
+    header.table_size = table_size;
+    header.page_size = page;
+    header.strings_offset = sizeof(BundleHeader) + sizeof(BundleEntry) * (uint64_t)table_size;
+    header.strings_size = strings.size();
+    header.data_offset = align_up(header.strings_offset + strings.size(), page);
+
+    // 每段内容从页边界开始，预热和sendfile都按页对齐
+    uint64_t offset = header.data_offset;
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        for (int v = 0; v < BUNDLE_VARIANTS; ++v)
+        {
+            if (files[i].sources[v].empty())
+                continue;
+            table[slots[i]].variants[v].offset = offset;
+            table[slots[i]].variants[v].length = files[i].sizes[v];
+            offset = align_up(offset + files[i].sizes[v], page);
+        }
+    }
+    header.file_size = offset;
+
+    // 先写临时文件再rename，正在运行的服务器映射的旧文件不受影响
+    string tmp = string(argv[2]) + ".tmp";
+    int out_fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out_fd < 0)
+    {
+        perror("create bundle failed");
+        return 1;
+    }
+    bool ok = ftruncate(out_fd, header.file_size) == 0
+           && pwrite(out_fd, &header, sizeof(header), 0) == sizeof(header)
+           && pwrite(out_fd, table.data(), sizeof(BundleEntry) * table_size, sizeof(header)) == (ssize_t)(sizeof(BundleEntry) * table_size)
+           && pwrite(out_fd, strings.data(), strings.size(), header.strings_offset) == (ssize_t)strings.size();
+    for (size_t i = 0; ok && i < files.size(); ++i)
+        for (int v = 0; ok && v < BUNDLE_VARIANTS; ++v)
+            if (!files[i].sources[v].empty())
+                ok = copy_file(out_fd, files[i].sources[v], table[slots[i]].variants[v].offset, files[i].sizes[v]);
+    if (!ok || fsync(out_fd) < 0 || close(out_fd) < 0 || rename(tmp.c_str(), argv[2]) < 0)
+    {
+        perror("write bundle failed");
+        unlink(tmp.c_str());
+        return 1;
+    }
+    printf("packed %zu files into %s, %llu bytes\n", files.size(), argv[2], (unsigned long long)header.file_size);
+    return 0;
+}
@@ -0,0 +1,69 @@
+// 把服务器写的请求追踪文件(格式见trace.h)转成Chrome trace JSON
+// 编译：g++ -O2 tools/traceToChrome.cpp -o traceToChrome
+// 运行：./traceToChrome <追踪文件> > trace.json，然后在chrome://tracing或ui.perfetto.dev里打开
+// 每个请求按阶段拆成几段：queue(线程池排队)、parse(读取和解析请求头)、open(打开文件)、
+// header(组织并发送响应头)、body(发送正文)，没有经过的阶段并入下一段
+#include "../trace.h"
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+using namespace std;
+
+static const char *stage_names[TRACE_STAGES] = {"dispatch", "queue", "parse", "open", "header", "body"};
+
+int main(int argc, char *argv[])
+{
+    if (argc != 2)
+    {
+        fprintf(stderr, "usage: %s <trace file>\n", argv[0]);
+        return 1;
+    }
+    FILE *in = fopen(argv[1], "rb");
+    if (in == NULL)
+    {
+        perror("open trace file failed");
+        return 1;
+    }
+    TraceFileHeader header;
+    if (fread(&header, sizeof(header), 1, in) != 1 || memcmp(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0
+        || header.version != TRACE_VERSION || header.record_size != sizeof(TraceRecord) || header.ticks_per_us <= 0)
+    {
+        fprintf(stderr, "%s: not a trace file of this version\n", argv[1]);
+        return 1;
+    }
+    vector<TraceRecord> records;
+    TraceRecord record;
+    uint64_t base = 0;
+    while (fread(&record, sizeof(record), 1, in) == 1)
+    {
+        if (record.ts[TRACE_DISPATCH] == 0)
+            continue;
+        if (base == 0 || record.ts[TRACE_DISPATCH] < base)
+            base = record.ts[TRACE_DISPATCH];
+        records.push_back(record);
+    }
+    fclose(in);
+
+    printf("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    bool first = true;
+    for (size_t i = 0; i < records.size(); ++i)
+    {
+        const TraceRecord &r = records[i];
+        uint64_t prev = r.ts[TRACE_DISPATCH];
+        for (int stage = TRACE_DEQUEUE; stage < TRACE_STAGES; ++stage)
+        {
+            if (r.ts[stage] == 0 || r.ts[stage] < prev)
+                continue;
+            printf("%s{\"name\":\"%s\",\"cat\":\"request\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+                   "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"id\":%llu,\"fd\":%d,\"status\":%u,\"bytes\":%llu}}",
+                   first ? "" : ",\n", stage_names[stage], r.tid,
+                   (prev - base) / header.ticks_per_us, (r.ts[stage] - prev) / header.ticks_per_us,
+                   (unsigned long long)r.id, r.fd, r.status, (unsigned long long)r.bytes);
+            first = false;
+            prev = r.ts[stage];
+        }
+    }
+    printf("\n]}\n");
+    fprintf(stderr, "%zu requests\n", records.size());
+    return 0;
+}
@@ -0,0 +1,171 @@
+#include "trace.h"
+#include "config.h"
+#include "metrics.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <atomic>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+
+// 一个工作线程的记录缓冲：只有这个线程写head，只有后台线程写tail
+struct TraceRing
+{
+    std::atomic<uint32_t> head{0};
+    std::atomic<uint32_t> tail{0};
+    uint32_t tid;
+    TraceRecord records[TRACE_RING_SIZE];
+};
+
+static FILE *trace_out = NULL;
+static bool use_tsc = false;
+static double ticks_per_us = 1000.0;
+static std::atomic<uint64_t> next_id(1);
+static std::atomic<uint64_t> sample_seq(0);
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<TraceRing*> rings;
+static thread_local TraceRing *my_ring = NULL;
+
+static uint64_t monotonic_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// 只有不变TSC(不随变频、各核同步)才能直接当时钟用，用CLOCK_MONOTONIC量出每微秒的tick数
+static void calibrate_clock()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) && (edx & (1 << 8)))
+    {
+        uint64_t ns_begin = monotonic_ns();
+        uint64_t tsc_begin = __rdtsc();
+        usleep(20000);
+        uint64_t ns_end = monotonic_ns();
+        uint64_t tsc_end = __rdtsc();
+        if (ns_end > ns_begin && tsc_end > tsc_begin)
+        {
+            ticks_per_us = (double)(tsc_end - tsc_begin) * 1000.0 / (ns_end - ns_begin);
+            use_tsc = true;
+        }
+    }
+#endif
+}
+
+uint64_t trace_now()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (use_tsc)
+        return __rdtsc();
+#endif
+    return monotonic_ns();
+}
+
+void trace_begin(TraceRecord &trace, int fd)
+{
+    int sample = config_get().trace_sample;
+    if (trace_out == NULL || sample <= 0 || trace.id != 0)
+        return;
+    if (sample_seq.fetch_add(1, std::memory_order_relaxed) % sample != 0)
+        return;
+    memset(&trace, 0, sizeof(trace));
+    trace.id = next_id.fetch_add(1, std::memory_order_relaxed);
+    trace.fd = fd;
+    trace.ts[TRACE_DISPATCH] = trace_now();
+}
+
+void trace_finish(TraceRecord &trace, int status, size_t bytes)
+{
+    if (trace.id == 0)
+        return;
+    trace_stamp(trace, TRACE_DONE);
+    trace.status = status;
+    trace.bytes = bytes;
+    if (my_ring == NULL)
+    {
+        my_ring = new TraceRing;
+        my_ring->tid = syscall(SYS_gettid);
+        pthread_mutex_lock(&rings_lock);
+        rings.push_back(my_ring);
+        pthread_mutex_unlock(&rings_lock);
+    }
+    uint32_t head = my_ring->head.load(std::memory_order_relaxed);
+    if (head - my_ring->tail.load(std::memory_order_acquire) >= (uint32_t)TRACE_RING_SIZE)
+        ++server_metrics.trace_dropped;
+    else
+    {
+        trace.tid = my_ring->tid;
+        my_ring->records[head % TRACE_RING_SIZE] = trace;
+        my_ring->head.store(head + 1, std::memory_order_release);
+        ++server_metrics.trace_recorded;
+    }
+    trace.id = 0;
+}
+
+static void *trace_writer(void *)
+{
+    std::vector<TraceRing*> snapshot;
+    while (true)
+    {
+        usleep(TRACE_FLUSH_MS * 1000);
+        pthread_mutex_lock(&rings_lock);
+        snapshot = rings;
+        pthread_mutex_unlock(&rings_lock);
+        bool wrote = false;
+        for (size_t i = 0; i < snapshot.size(); ++i)
+        {
+            TraceRing *ring = snapshot[i];
+            uint32_t tail = ring->tail.load(std::memory_order_relaxed);
+            uint32_t head = ring->head.load(std::memory_order_acquire);
+            if (tail != head)
+                wrote = true;
+            for (; tail != head; ++tail)
+                fwrite(&ring->records[tail % TRACE_RING_SIZE], sizeof(TraceRecord), 1, trace_out);
+            ring->tail.store(head, std::memory_order_release);
+        }
+        if (wrote)
+            fflush(trace_out);
+    }
+    return NULL;
+}
+
+int trace_start(const char *path)
+{
+    trace_out = fopen(path, "wb");
+    if (trace_out == NULL)
+    {
+        perror("open trace file failed");
+        return -1;
+    }
+    calibrate_clock();
+    TraceFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    header.version = TRACE_VERSION;
+    header.record_size = sizeof(TraceRecord);
+    header.ticks_per_us = ticks_per_us;
+    fwrite(&header, sizeof(header), 1, trace_out);
+    fflush(trace_out);
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, trace_writer, NULL) != 0)
+    {
+        perror("create trace writer failed");
+        fclose(trace_out);
+        trace_out = NULL;
+        return -1;
+    }
+    pthread_setname_np(tid, "sws-trace");
+    pthread_detach(tid);
+    printf("tracing 1/%d requests to %s (%s clock, %.1f ticks/us)\n",
+           config_get().trace_sample, path, use_tsc ? "tsc" : "monotonic", ticks_per_us);
+    return 0;
+}
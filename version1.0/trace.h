@@ -0,0 +1,60 @@
+#ifndef TRACE
+#define TRACE
+#include <stdint.h>
+#include <stddef.h>
+
+/* 抽样的请求追踪：按trace_sample抽中的请求在每个阶段记一个时间戳，
+   请求结束时把记录放进当前线程自己的环形缓冲(单生产者单消费者，不加锁)，
+   后台线程定期把所有线程的缓冲写到trace_file。
+   时间戳在支持不变TSC的x86上直接读TSC，否则用CLOCK_MONOTONIC，文件头里记下每微秒的tick数。
+   用tools/traceToChrome.cpp把文件转成Chrome trace JSON，在chrome://tracing或Perfetto里查看 */
+
+// 阶段按时间先后排列，没有经过的阶段时间戳为0
+const int TRACE_DISPATCH = 0;   //主线程把事件交给线程池
+const int TRACE_DEQUEUE = 1;    //工作线程开始处理
+const int TRACE_PARSED = 2;     //请求头解析完
+const int TRACE_FILE = 3;       //文件打开、stat完，开始组织响应
+const int TRACE_HEADER = 4;     //响应头发送完
+const int TRACE_DONE = 5;       //正文发送完，请求结束
+const int TRACE_STAGES = 6;
+
+const int TRACE_RING_SIZE = 1024;       //每个线程缓冲的记录数，写满时丢弃新记录
+const int TRACE_FLUSH_MS = 100;         //后台线程写文件的间隔
+
+const char TRACE_MAGIC[8] = {'S', 'W', 'S', 'T', 'R', 'A', 'C', 'E'};
+const uint32_t TRACE_VERSION = 1;
+
+struct TraceFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    double ticks_per_us;
+};
+
+struct TraceRecord
+{
+    uint64_t id;                    //0表示这个请求没有被抽中
+    uint32_t tid;                   //结束请求的线程
+    int32_t fd;
+    uint32_t status;                //响应状态码，0表示没有发出响应
+    uint32_t reserved;
+    uint64_t bytes;                 //响应的字节数(头加正文)
+    uint64_t ts[TRACE_STAGES];
+};
+
+// 打开追踪文件并启动后台写文件的线程，只在启动时调用
+int trace_start(const char *path);
+uint64_t trace_now();
+// 一个新请求的第一个事件被分发时调用，按抽样率决定是否追踪
+void trace_begin(TraceRecord &trace, int fd);
+// 请求结束：记下结束时间、状态码和响应字节数，把记录交给后台线程，然后清空
+void trace_finish(TraceRecord &trace, int status, size_t bytes);
+
+inline void trace_stamp(TraceRecord &trace, int stage)
+{
+    if (trace.id != 0 && trace.ts[stage] == 0)
+        trace.ts[stage] = trace_now();
+}
+
+#endif
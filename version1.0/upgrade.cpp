@@ -0,0 +1,153 @@
+#include "upgrade.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+static int upgrade_sock = -1;  //新进程里和旧进程通信的socket
+
+int upgrade_signal_fd()
+{
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR2);
+    sigaddset(&mask, SIGHUP);
+    // 之后创建的线程都会继承这个屏蔽字，信号只会从signalfd里被主循环读到
+    if (pthread_sigmask(SIG_BLOCK, &mask, NULL) != 0)
+        return -1;
+    return signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+}
+
+int upgrade_read_signal(int signal_fd)
+{
+    struct signalfd_siginfo info;
+    ssize_t n = read(signal_fd, &info, sizeof(info));
+    if (n != sizeof(info))
+        return 0;
+    return (int)info.ssi_signo;
+}
+
+int upgrade_receive_listen_fds(int fds[], int max_fds)
+{
+    const char *env = getenv(UPGRADE_ENV);
+    if (env == NULL)
+        return 0;
+    upgrade_sock = atoi(env);
+    unsetenv(UPGRADE_ENV);
+
+    int count = 0;
+    char control[CMSG_SPACE(sizeof(int) * MAX_LISTEN_FDS)];
+    struct iovec iov;
+    iov.iov_base = &count;
+    iov.iov_len = sizeof(count);
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t n;
+    while ((n = recvmsg(upgrade_sock, &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR)
+        ;
+    if (n != sizeof(count))
+        return -1;
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+        return -1;
+    int received = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    if (received != count || count > max_fds)
+        return -1;
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * count);
+    return count;
+}
+
+void upgrade_notify_ready()
+{
+    if (upgrade_sock < 0)
+        return;
+    char ready = 'R';
+    if (write(upgrade_sock, &ready, 1) != 1)
+        perror("upgrade notify failed");
+    close(upgrade_sock);
+    upgrade_sock = -1;
+}
+
+int upgrade_spawn(const char *exe, char *const argv[], const int fds[], int fd_num, pid_t &pid)
+{
+    if (fd_num <= 0 || fd_num > MAX_LISTEN_FDS)
+        return -1;
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0)
+        return -1;
+
+    pid = fork();
+    if (pid < 0){
+        close(sv[0]);
+        close(sv[1]);
+        return -1;
+    }
+    if (pid == 0){
+        // 子进程：只保留和旧进程通信的socket，其余描述符(客户端连接、epoll等)全部关闭，
+        // 监听描述符稍后通过SCM_RIGHTS重新拿到
+        if (sv[1] != 3)
+            dup2(sv[1], 3);
+        else
+            fcntl(3, F_SETFD, 0);
+        close_range(4, ~0U, 0);
+        sigset_t empty;
+        sigemptyset(&empty);
+        sigprocmask(SIG_SETMASK, &empty, NULL);
+        setenv(UPGRADE_ENV, "3", 1);
+        execv(exe, argv);
+        _exit(127);
+    }
+
+    close(sv[1]);
+    char control[CMSG_SPACE(sizeof(int) * MAX_LISTEN_FDS)];
+    memset(control, 0, sizeof(control));
+    struct iovec iov;
+    iov.iov_base = &fd_num;
+    iov.iov_len = sizeof(fd_num);
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * fd_num);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fd_num);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * fd_num);
+    // socket的缓冲区是空的，这几个字节不会阻塞；发完之后旧进程这一端改成非阻塞交给epoll，
+    // 新进程那一端仍然是阻塞的，它在启动时同步接收
+    if (sendmsg(sv[0], &msg, 0) != sizeof(fd_num) || fcntl(sv[0], F_SETFL, O_NONBLOCK) < 0){
+        perror("upgrade sendmsg failed");
+        upgrade_finish(sv[0], pid);
+        return -1;
+    }
+    return sv[0];
+}
+
+int upgrade_finish(int sock, pid_t pid)
+{
+    // 超时时socket里还没有数据，read返回-1；新进程中途退出时read返回0
+    char ready = 0;
+    int ret = (read(sock, &ready, 1) == 1 && ready == 'R') ? 0 : -1;
+    close(sock);
+
+    if (ret < 0){
+        // 新进程没能启动，旧进程继续服务
+        fprintf(stderr, "upgrade failed, new process %d did not become ready\n", (int)pid);
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+    }
+    return ret;
+}
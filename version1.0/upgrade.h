@@ -0,0 +1,25 @@
+#ifndef UPGRADE
+#define UPGRADE
+#include <sys/types.h>
+
+/* 不停机升级：
+   旧进程收到SIGUSR2后fork+exec新的可执行文件，通过Unix域socket用SCM_RIGHTS把监听描述符传过去，
+   新进程在epoll里注册好监听描述符后回一个字节，旧进程随后停止accept，处理完手上的请求再退出。
+   旧进程把等回复的socket放进主循环的epoll里，等待期间照常处理请求。
+   SIGHUP只重新读取配置文件，不重启进程。 */
+
+const int MAX_LISTEN_FDS = 4;
+const char UPGRADE_ENV[] = "SIMPLEWEBSERVER_UPGRADE_FD";
+const int UPGRADE_READY_TIMEOUT = 10000;  //等待新进程就绪的最长时间(毫秒)
+const int UPGRADE_PREWARM_MAX = 5000;     //新进程预热最多用的时间(毫秒)，加上启动的时间也要在UPGRADE_READY_TIMEOUT之内
+
+int upgrade_signal_fd();                                            //屏蔽SIGUSR2/SIGHUP并返回对应的signalfd，必须在创建线程之前调用
+int upgrade_read_signal(int signal_fd);                             //读出一个待处理的信号，没有则返回0
+int upgrade_receive_listen_fds(int fds[], int max_fds);             //新进程：从旧进程接收监听描述符，不是升级启动时返回0
+void upgrade_notify_ready();                                        //新进程：已经开始accept，通知旧进程
+//旧进程：启动新进程并交出监听描述符，返回等新进程回复的非阻塞socket，失败返回-1
+int upgrade_spawn(const char *exe, char *const argv[], const int fds[], int fd_num, pid_t &pid);
+//旧进程：sock可读或者等超时后调用，新进程就绪返回0，否则杀掉新进程返回-1；两种情况都会关闭sock
+int upgrade_finish(int sock, pid_t pid);
+
+#endif
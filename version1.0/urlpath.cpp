@@ -0,0 +1,169 @@
+#include "urlpath.h"
+#include "config.h"
+#include "metrics.h"
+#include "util.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+
+static int root_fd = AT_FDCWD;
+
+struct PathSlot
+{
+    int root;                           //docroot目录的描述符，同一个路径在不同站点下是不同的文件
+    std::string raw;                    //原始路径，不含查询串
+    std::string name;
+    bool has_stat;
+    long long stat_until;               //monotonic_ms，过了这个时间要重新stat
+    struct stat sbuf;
+};
+
+static thread_local PathSlot path_cache[PATH_CACHE_SLOTS];
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+// 去掉查询串和片段
+static std::string_view path_part(std::string_view raw)
+{
+    size_t end = raw.find_first_of("?#");
+    return end == std::string_view::npos ? raw : raw.substr(0, end);
+}
+
+// out里从seg_start开始是刚结束的一段，按它是""、"."、".."还是普通名字处理
+static bool close_segment(std::string &out, size_t seg_start, bool more)
+{
+    size_t len = out.size() - seg_start;
+    if (len == 0)
+        return true;
+    if (len == 1 && out[seg_start] == '.')
+    {
+        out.resize(seg_start);
+        return true;
+    }
+    if (len == 2 && out[seg_start] == '.' && out[seg_start + 1] == '.')
+    {
+        if (seg_start == 0)
+            return false;
+        // 连同上一段一起去掉，out[seg_start - 1]是上一段后面的'/'
+        size_t prev = seg_start >= 2 ? out.rfind('/', seg_start - 2) : std::string::npos;
+        out.resize(prev == std::string::npos ? 0 : prev + 1);
+        return true;
+    }
+    if (more)
+        out += '/';
+    return true;
+}
+
+bool url_normalize(std::string_view raw, std::string &out)
+{
+    raw = path_part(raw);
+    out.clear();
+    out.reserve(raw.size());
+    size_t seg_start = 0;
+    for (size_t i = 0; i < raw.size(); ++i)
+    {
+        char c = raw[i];
+        if (c == '%')
+        {
+            if (i + 2 >= raw.size())
+                return false;
+            int hi = hex_value(raw[i + 1]), lo = hex_value(raw[i + 2]);
+            if (hi < 0 || lo < 0)
+                return false;
+            c = (char)(hi * 16 + lo);
+            if (c == '\0')
+                return false;
+            i += 2;
+        }
+        if (c == '/')
+        {
+            if (!close_segment(out, seg_start, true))
+                return false;
+            seg_start = out.size();
+            continue;
+        }
+        out += c;
+    }
+    if (!close_segment(out, seg_start, false))
+        return false;
+    if (out.empty())
+        out = "index.html";
+    return true;
+}
+
+int docroot_open(const char *dir)
+{
+    int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        perror(dir);
+        return -1;
+    }
+    root_fd = fd;
+    return 0;
+}
+
+int docroot_fd()
+{
+    return root_fd;
+}
+
+static PathSlot &slot_of(int root, std::string_view key)
+{
+    uint64_t h = 14695981039346656037ULL ^ (uint64_t)(unsigned)root;
+    for (size_t i = 0; i < key.size(); ++i)
+    {
+        h ^= (unsigned char)key[i];
+        h *= 1099511628211ULL;
+    }
+    return path_cache[(h >> 32) & (PATH_CACHE_SLOTS - 1)];
+}
+
+int path_resolve(int root, std::string_view raw, std::string &file_name, struct stat &sbuf)
+{
+    std::string_view key = path_part(raw);
+    PathSlot &slot = slot_of(root, key);
+    if (slot.root == root && slot.raw == key)
+    {
+        ++server_metrics.path_cache_hits;
+        file_name = slot.name;
+        if (slot.has_stat && monotonic_ms() < slot.stat_until)
+        {
+            sbuf = slot.sbuf;
+            return PATH_STAT_CACHED;
+        }
+        return PATH_RESOLVED;
+    }
+    ++server_metrics.path_cache_misses;
+    if (!url_normalize(key, file_name))
+        return PATH_BAD;
+    slot.root = root;
+    slot.raw.assign(key.data(), key.size());
+    slot.name = file_name;
+    slot.has_stat = false;
+    return PATH_RESOLVED;
+}
+
+void path_remember(int root, std::string_view raw, const struct stat &sbuf)
+{
+    int cache_ms = config_get().path_cache_ms;
+    if (cache_ms <= 0)
+        return;
+    std::string_view key = path_part(raw);
+    PathSlot &slot = slot_of(root, key);
+    if (slot.root != root || slot.raw != key)
+        return;
+    slot.sbuf = sbuf;
+    slot.has_stat = true;
+    slot.stat_until = monotonic_ms() + cache_ms;
+}
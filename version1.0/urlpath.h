@@ -0,0 +1,31 @@
+#ifndef URLPATH
+#define URLPATH
+#include <string>
+#include <string_view>
+#include <sys/stat.h>
+
+/* 请求路径到文件的解析：一次扫描完成%XX解码、去掉查询串、合并重复的'/'、处理"."和".."，
+   得到相对docroot的文件名，再用openat在docroot目录下打开，".."不可能越过docroot。
+   每个工作线程有一个直接映射的小缓存，按docroot和原始路径记住规范化的结果和最近一次stat的结果，
+   同一个路径再来时不用再解码，path_cache_ms之内也不用再stat */
+
+const int PATH_CACHE_SLOTS = 256;       //每个线程的缓存槽数，2的幂
+
+const int PATH_BAD = -1;                //非法编码或者越过了根目录
+const int PATH_RESOLVED = 0;            //得到了文件名，需要自己stat
+const int PATH_STAT_CACHED = 1;         //stat结果也在缓存里
+
+// raw以'/'开头，可以带查询串；结果不以'/'开头，根目录是"index.html"，末尾的'/'保留
+bool url_normalize(std::string_view raw, std::string &out);
+
+// 启动时打开docroot目录，之后所有静态文件都相对它打开；没有配置时相对当前目录
+int docroot_open(const char *dir);
+int docroot_fd();
+
+// 解析请求行里的原始路径，root是要在哪个docroot下打开(虚拟主机各有一个)，返回PATH_*；
+// 返回PATH_STAT_CACHED时sbuf已经填好
+int path_resolve(int root, std::string_view raw, std::string &file_name, struct stat &sbuf);
+// 自己stat之后把结果记进当前线程的缓存
+void path_remember(int root, std::string_view raw, const struct stat &sbuf);
+
+#endif
@@ -4,6 +4,9 @@
 #include <signal.h>
 #include <errno.h>
 #include <string.h>
+#include <limits.h>
+#include <sys/sendfile.h>
+#include <time.h>
 
 //循环读取数据，直到把给定长度n的所有数据读完为止
 ssize_t readn(int fd, void *buff, size_t n)
@@ -34,6 +37,49 @@ ssize_t readn(int fd, void *buff, size_t n)
     return readSum;
 }
 
+/* 把数据直接读到buf末尾，返回值的含义和readn一样，读满limit字节或者读到EAGAIN为止。
+   readv同时给出buf剩余的容量和线程局部的溢出区：连接的缓冲区只按实际收到的数据增长，
+   大请求也是一次系统调用读很多，只有超出容量的部分从溢出区再拷贝一次 */
+ssize_t read_append(int fd, std::string &buf, size_t limit)
+{
+    static thread_local char spill[READ_SPILL_SIZE];
+    ssize_t readSum = 0;
+    while ((size_t)readSum < limit)
+    {
+        // 先把剩余容量变成可写的部分，resize会清零，所以一次最多用READ_SPILL_SIZE
+        size_t used = buf.size();
+        size_t room = buf.capacity() - used;
+        if (room > READ_SPILL_SIZE)
+            room = READ_SPILL_SIZE;
+        buf.resize(used + room);
+        struct iovec iov[2];
+        iov[0].iov_base = &buf[0] + used;
+        iov[0].iov_len = room;
+        iov[1].iov_base = spill;
+        iov[1].iov_len = sizeof(spill);
+        ssize_t nread = room > 0 ? readv(fd, iov, 2) : readv(fd, iov + 1, 1);
+        if (nread < 0) {
+            buf.resize(used);
+            if (errno == EINTR)
+                continue;
+            else if (errno == EAGAIN)
+                return readSum;
+            else
+                return -1;
+        }
+        if ((size_t)nread <= room)
+            buf.resize(used + nread);
+        else
+            buf.append(spill, nread - room);
+        if (nread == 0)
+            break;
+        readSum += nread;
+    }
+    return readSum;
+}
+
+/* 下面三个写函数和readn一样不会阻塞：发送缓冲区满时返回已经写出的字节数(errno为EAGAIN)，
+   剩下的由调用者记住，回到epoll等EPOLLOUT之后再写，不在工作线程上等客户端收数据 */
 ssize_t writen(int fd, void *buff, size_t n)
 {
     size_t nleft = n;
@@ -46,10 +92,10 @@ ssize_t writen(int fd, void *buff, size_t n)
         {
             if (nwritten < 0)
             {
-                if (errno == EINTR || errno == EAGAIN){//这两种情况不是真正的写入错误，需要单独判断重新写入
-                    nwritten = 0;
+                if (errno == EINTR)//不是真正的写入错误，需要单独判断重新写入
                     continue;
-                }
+                else if (errno == EAGAIN)//发送缓冲区满了
+                    return writeSum;
                 else
                     return -1;
             }
@@ -61,6 +107,65 @@ ssize_t writen(int fd, void *buff, size_t n)
     return writeSum;
 }
 
+// 把iov里的片段依次写出，部分写入时在原数组上前移，调用之后iov的内容会被修改
+ssize_t writevn(int fd, struct iovec *iov, int iovcnt)
+{
+    ssize_t nwritten = 0;
+    ssize_t writeSum = 0;
+    while (iovcnt > 0)
+    {
+        if ((nwritten = writev(fd, iov, iovcnt > IOV_MAX ? IOV_MAX : iovcnt)) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            else if (errno == EAGAIN)
+                return writeSum;
+            else
+                return -1;
+        }
+        writeSum += nwritten;
+        // 跳过已经写完的片段，调整写了一半的那个片段
+        while (iovcnt > 0 && (size_t)nwritten >= iov->iov_len){
+            nwritten -= iov->iov_len;
+            ++iov;
+            --iovcnt;
+        }
+        if (iovcnt > 0){
+            iov->iov_base = (char*)iov->iov_base + nwritten;
+            iov->iov_len -= nwritten;
+        }
+    }
+    return writeSum;
+}
+
+// 用sendfile把in_fd从offset开始的n个字节发到out_fd，数据不经过用户态，
+// 也不需要把整个文件mmap进来，所以大文件的内存占用是固定的
+ssize_t sendfilen(int out_fd, int in_fd, off_t offset, size_t n)
+{
+    size_t nleft = n;
+    ssize_t nsent = 0;
+    ssize_t sendSum = 0;
+    while (nleft > 0)
+    {
+        if ((nsent = sendfile(out_fd, in_fd, &offset, nleft)) <= 0)
+        {
+            if (nsent == 0){//文件在发送过程中被截断了，不能当成发送缓冲区满
+                errno = EIO;
+                return sendSum;
+            }
+            if (errno == EINTR)
+                continue;
+            else if (errno == EAGAIN)
+                return sendSum;
+            else
+                return -1;
+        }
+        sendSum += nsent;
+        nleft -= nsent;
+    }
+    return sendSum;
+}
+
 //处理sigpipe信号
 void handle_for_sigpipe(){
     struct sigaction sa; //信号处理结构体
@@ -81,4 +186,11 @@ int setSocketNonBlocking(int fd){
     if(fcntl(fd, F_SETFL, flag) == -1)
         return -1;
     return 0;
-}
\ No newline at end of file
+}
+// 用粗粒度时钟，精度几毫秒但不用陷入内核，每读一次数据都可以调用
+long long monotonic_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
@@ -1,10 +1,19 @@
 #ifndef UTIL
 #define UTIL
 #include <cstdlib>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <string>
+
+const int READ_SPILL_SIZE = 65536;      //read_append每个线程的溢出区大小
 
 ssize_t readn(int fd, void *buff, size_t n);
+ssize_t read_append(int fd, std::string &buf, size_t limit);
 ssize_t writen(int fd, void *buff, size_t n);
+ssize_t writevn(int fd, struct iovec *iov, int iovcnt);
+ssize_t sendfilen(int out_fd, int in_fd, off_t offset, size_t n);
 void handle_for_sigpipe();
 int setSocketNonBlocking(int fd);
+long long monotonic_ms();   //单调时钟的毫秒数，只用来算时间差和期限
 
 #endif
\ No newline at end of file
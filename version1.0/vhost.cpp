@@ -0,0 +1,232 @@
+#include "vhost.h"
+#include "metrics.h"
+#include "ratelimit.h"
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+using namespace std;
+
+struct VhostSlot
+{
+    string name;                        //小写；通配名去掉开头的'*'，以'.'开头
+    VirtualHost *host;                  //NULL表示空槽
+};
+
+static vector<VirtualHost*> hosts;
+static vector<VhostSlot> table;         //大小是2的幂，至少是名字数的两倍
+static size_t name_count = 0;
+
+static char fold(char c)
+{
+    return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+}
+
+static uint64_t fold_hash(string_view s)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < s.size(); ++i)
+    {
+        h ^= (unsigned char)fold(s[i]);
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// name已经是小写
+static bool equal_fold(const string &name, string_view s)
+{
+    if (name.size() != s.size())
+        return false;
+    for (size_t i = 0; i < s.size(); ++i)
+        if (name[i] != fold(s[i]))
+            return false;
+    return true;
+}
+
+static VhostSlot *probe(string_view name)
+{
+    size_t mask = table.size() - 1;
+    for (size_t i = fold_hash(name) & mask; ; i = (i + 1) & mask)
+        if (table[i].host == NULL || equal_fold(table[i].name, name))
+            return &table[i];
+}
+
+static bool insert(const string &name, VirtualHost *host)
+{
+    // 表至少保持一半是空的，探测链很短；名字都是启动时加的，直接整个重建
+    if ((name_count + 1) * 2 > table.size())
+    {
+        vector<VhostSlot> old;
+        old.swap(table);
+        table.resize(old.empty() ? 16 : old.size() * 2);
+        for (size_t i = 0; i < old.size(); ++i)
+            if (old[i].host != NULL)
+                *probe(old[i].name) = old[i];
+    }
+    VhostSlot *slot = probe(name);
+    if (slot->host != NULL)
+    {
+        fprintf(stderr, "vhost %s defined twice\n", name.c_str());
+        return false;
+    }
+    slot->name = name;
+    slot->host = host;
+    ++name_count;
+    return true;
+}
+
+static bool parse_option(const string &option, VirtualHost *host)
+{
+    size_t eq = option.find('=');
+    if (eq == string::npos || eq + 1 == option.size())
+        return false;
+    string key = option.substr(0, eq);
+    string value = option.substr(eq + 1);
+    if (key == "access_log")
+    {
+        host->log_fd = open(value.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+        if (host->log_fd < 0)
+            perror(value.c_str());
+        return host->log_fd >= 0;
+    }
+    char *end = NULL;
+    long number = strtol(value.c_str(), &end, 10);
+    if (*end != '\0' || number < 0)
+        return false;
+    if (key == "cache_mb" && number <= 65536)
+        host->cache = filecache_create((int)number);
+    else if (key == "limit_req_rate" && number <= RATELIMIT_MAX_RATE)
+        host->limit_req_rate = (int)number;
+    else if (key == "limit_req_burst" && number <= RATELIMIT_MAX_BURST)
+        host->limit_req_burst = (int)number;
+    else
+        return false;
+    return true;
+}
+
+bool vhost_add(const vector<string> &args)
+{
+    if (args.size() < 2)
+        return false;
+    VirtualHost *host = new VirtualHost;
+    host->root_fd = open(args[1].c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (host->root_fd < 0)
+    {
+        perror(args[1].c_str());
+        return false;
+    }
+    host->cache = NULL;
+    host->limit_req_rate = 0;
+    host->limit_req_burst = 0;
+    host->log_fd = -1;
+    for (size_t i = 2; i < args.size(); ++i)
+        if (!parse_option(args[i], host))
+            return false;
+    // 没有指定cache_mb时也有自己的分区，上限跟随file_cache_mb
+    if (host->cache == NULL)
+        host->cache = filecache_create(-1);
+
+    size_t start = 0;
+    while (start <= args[0].size())
+    {
+        size_t comma = args[0].find(',', start);
+        if (comma == string::npos)
+            comma = args[0].size();
+        string name = args[0].substr(start, comma - start);
+        start = comma + 1;
+        if (name.empty())
+            continue;
+        for (size_t i = 0; i < name.size(); ++i)
+            name[i] = fold(name[i]);
+        if (host->name.empty())
+            host->name = name;
+        if (name.size() > 2 && name[0] == '*' && name[1] == '.')
+            name.erase(0, 1);
+        else if (name.find('*') != string::npos)
+            return false;
+        if (!insert(name, host))
+            return false;
+    }
+    if (host->name.empty())
+        return false;
+    hosts.push_back(host);
+    return true;
+}
+
+VirtualHost *vhost_lookup(string_view host)
+{
+    if (name_count == 0)
+        return NULL;
+    // 去掉端口和末尾的'.'，IPv6地址的端口在']'后面
+    size_t colon = host.rfind(':');
+    if (colon != string_view::npos && host.find(']', colon) == string_view::npos)
+        host = host.substr(0, colon);
+    if (!host.empty() && host.back() == '.')
+        host.remove_suffix(1);
+    if (host.empty())
+    {
+        ++server_metrics.vhost_unknown;
+        return NULL;
+    }
+    VhostSlot *slot = probe(host);
+    if (slot->host == NULL)
+    {
+        // 再按"*.上一级域名"查一次
+        size_t dot = host.find('.');
+        if (dot != string_view::npos && dot > 0)
+            slot = probe(host.substr(dot));
+    }
+    if (slot->host == NULL)
+        ++server_metrics.vhost_unknown;
+    return slot->host;
+}
+
+bool vhost_allow_request(VirtualHost *host)
+{
+    if (host == NULL)
+        return true;
+    ++host->requests;
+    if (host->limit_req_rate <= 0 || ratelimit_take(host->bucket, host->limit_req_rate, host->limit_req_burst))
+        return true;
+    ++host->limited;
+    ++server_metrics.vhost_limited;
+    return false;
+}
+
+void vhost_log(VirtualHost *host, const struct sockaddr_in &addr, string_view method,
+               string_view uri, int status, size_t bytes)
+{
+    // 没有回送任何响应就断开的请求不记
+    if (host == NULL || host->log_fd < 0 || status == 0)
+        return;
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &addr.sin_addr, ip, sizeof(ip));
+    time_t now = time(NULL);
+    struct tm tm_now;
+    char date[32];
+    strftime(date, sizeof(date), "%d/%b/%Y:%H:%M:%S +0000", gmtime_r(&now, &tm_now));
+    char line[VHOST_LOG_LINE];
+    int max_uri = VHOST_LOG_LINE - 128;
+    int len = snprintf(line, sizeof(line), "%s - - [%s] \"%.*s %.*s\" %d %zu\n", ip, date,
+                       (int)method.size(), method.data(),
+                       uri.size() > (size_t)max_uri ? max_uri : (int)uri.size(), uri.data(), status, bytes);
+    // O_APPEND下一次write的一行不会和别的线程写的交错
+    if (write(host->log_fd, line, len) < 0)
+        perror("access log");
+}
+
+void vhost_dump(string &out)
+{
+    for (size_t i = 0; i < hosts.size(); ++i)
+        out += hosts[i]->name + " requests=" + to_string(hosts[i]->requests)
+             + " limited=" + to_string(hosts[i]->limited) + '\n';
+}
+
+void vhost_roots(vector<int> &roots)
+{
+    for (size_t i = 0; i < hosts.size(); ++i)
+        roots.push_back(hosts[i]->root_fd);
+}
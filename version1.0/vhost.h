@@ -0,0 +1,59 @@
+#ifndef VHOST
+#define VHOST
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <netinet/in.h>
+#include "filecache.h"
+#include "urlpath.h"
+
+/* 基于名字的虚拟主机：按请求的Host首部选站点，每个站点有自己的docroot、小文件缓存分区、
+   请求限流和访问日志。配置里一行一个站点：
+       vhost example.com,www.example.com /var/www/example cache_mb=8 limit_req_rate=200 access_log=/var/log/example.log
+       vhost *.blog.example.com /var/www/blogs
+   名字不区分大小写，端口号会被去掉；"*.a.com"匹配"x.a.com"这样正好多一级的名字。
+   所有名字放在启动时建好的开放寻址表里，查找只算一次哈希，最多再按通配名查一次，
+   和站点数目无关。Host不匹配任何站点时用全局的docroot(默认站点) */
+
+const int VHOST_LOG_LINE = 1024;        //一条访问日志的最大长度，过长的路径截断
+
+struct VirtualHost
+{
+    std::string name;                   //第一个名字，日志和管理接口里用
+    int root_fd;                        //docroot目录的描述符
+    FileCache *cache;                   //这个站点自己的小文件缓存分区
+    int limit_req_rate;                 //整个站点每秒的请求数，0表示不限
+    int limit_req_burst;
+    int log_fd;                         //访问日志，-1表示不记录
+    std::atomic<uint64_t> bucket{0};
+    std::atomic<long> requests{0};
+    std::atomic<long> limited{0};
+};
+
+// 配置文件里的vhost指令，args[0]是名字列表，args[1]是docroot，后面是key=value选项；只能在启动时调用
+bool vhost_add(const std::vector<std::string> &args);
+// 按Host首部找站点，没有配置虚拟主机或者都不匹配时返回NULL(默认站点)
+VirtualHost *vhost_lookup(std::string_view host);
+// 按站点的limit_req_rate扣一个令牌，默认站点总是返回true
+bool vhost_allow_request(VirtualHost *host);
+// 一个请求处理完后写一行访问日志，格式同common log format
+void vhost_log(VirtualHost *host, const struct sockaddr_in &addr, std::string_view method,
+               std::string_view uri, int status, size_t bytes);
+// 每个站点的请求数，给管理接口用
+void vhost_dump(std::string &out);
+// 所有站点docroot目录的描述符，不含默认站点，给启动预热用
+void vhost_roots(std::vector<int> &roots);
+
+inline int vhost_root(const VirtualHost *host)
+{
+    return host != NULL ? host->root_fd : docroot_fd();
+}
+
+inline FileCache *vhost_cache(const VirtualHost *host)
+{
+    return host != NULL ? host->cache : NULL;
+}
+
+#endif